@@ -0,0 +1,220 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "pcg/pcg_extras.hpp"
+
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+
+// Bitboards shared by the board game implementations.
+// Squares are numbered h * width + w, so bit 0 is the top left corner.
+// Boards up to 5x5 may use uint32_t masks. Boards up to 8x8 use uint64_t
+// masks. Boards up to 11x11 use 128-bit masks.
+
+namespace alphazero::bitboard {
+
+using Mask128 = pcg_extras::pcg128_t;
+
+// Index of the lowest set bit. x must not be 0.
+[[nodiscard]] inline int lsb(uint64_t x) noexcept {
+#if defined _MSC_VER
+  unsigned long i;
+  _BitScanForward64(&i, x);
+  return static_cast<int>(i);
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
+// Index of the highest set bit. x must not be 0.
+[[nodiscard]] inline int msb(uint64_t x) noexcept {
+#if defined _MSC_VER
+  unsigned long i;
+  _BitScanReverse64(&i, x);
+  return static_cast<int>(i);
+#else
+  return 63 - __builtin_clzll(x);
+#endif
+}
+
+[[nodiscard]] inline int popcount(uint64_t x) noexcept {
+#if defined _MSC_VER
+  return static_cast<int>(__popcnt64(x));
+#else
+  return __builtin_popcountll(x);
+#endif
+}
+
+// Without these, uint32_t masks would be ambiguous between the overloads.
+[[nodiscard]] inline int lsb(uint32_t x) noexcept { return lsb(uint64_t{x}); }
+[[nodiscard]] inline int popcount(uint32_t x) noexcept {
+  return popcount(uint64_t{x});
+}
+
+[[nodiscard]] inline uint64_t low_bits(Mask128 x) noexcept {
+  return static_cast<uint64_t>(x);
+}
+[[nodiscard]] inline uint64_t high_bits(Mask128 x) noexcept {
+  return static_cast<uint64_t>(x >> 64);
+}
+
+[[nodiscard]] inline int lsb(Mask128 x) noexcept {
+  const auto low = low_bits(x);
+  return low != 0 ? lsb(low) : 64 + lsb(high_bits(x));
+}
+
+[[nodiscard]] inline int msb(Mask128 x) noexcept {
+  const auto high = high_bits(x);
+  return high != 0 ? 64 + msb(high) : msb(low_bits(x));
+}
+
+[[nodiscard]] inline int popcount(Mask128 x) noexcept {
+  return popcount(low_bits(x)) + popcount(high_bits(x));
+}
+
+// Removes and returns the lowest set bit. x must not be 0.
+template <typename Mask>
+[[nodiscard]] inline int pop_lsb(Mask& x) noexcept {
+  const auto i = lsb(x);
+  x &= x - 1;
+  return i;
+}
+
+// Even directions move towards lower squares.
+enum Direction {
+  UP = 0,
+  DOWN = 1,
+  LEFT = 2,
+  RIGHT = 3,
+};
+constexpr const int NUM_DIRECTIONS = 4;
+constexpr const std::array<int, NUM_DIRECTIONS> DIR_H = {-1, 1, 0, 0};
+constexpr const std::array<int, NUM_DIRECTIONS> DIR_W = {0, 0, -1, 1};
+
+[[nodiscard]] constexpr int opposite(int d) noexcept { return d ^ 1; }
+
+// Masks and tables for a WIDTH x HEIGHT board stored in Mask.
+template <typename Mask, int WIDTH, int HEIGHT>
+class Board {
+ public:
+  static constexpr int SQUARES = WIDTH * HEIGHT;
+  static_assert(SQUARES <= static_cast<int>(sizeof(Mask) * 8),
+                "The board does not fit in the mask");
+
+  [[nodiscard]] static constexpr Mask bit(int square) noexcept {
+    return Mask{1} << square;
+  }
+  [[nodiscard]] static constexpr Mask bit(int h, int w) noexcept {
+    return bit(h * WIDTH + w);
+  }
+
+  struct Tables {
+    Mask full = 0;
+    Mask left_column = 0;
+    Mask right_column = 0;
+    Mask edges = 0;
+    Mask corners = 0;
+    // Every square past a square in a direction.
+    std::array<std::array<Mask, SQUARES>, NUM_DIRECTIONS> rays{};
+  };
+
+  static constexpr Tables make_tables() {
+    auto t = Tables{};
+    for (auto h = 0; h < HEIGHT; ++h) {
+      for (auto w = 0; w < WIDTH; ++w) {
+        const auto b = bit(h, w);
+        t.full |= b;
+        if (w == 0) {
+          t.left_column |= b;
+        }
+        if (w == WIDTH - 1) {
+          t.right_column |= b;
+        }
+        if (h == 0 || h == HEIGHT - 1 || w == 0 || w == WIDTH - 1) {
+          t.edges |= b;
+        }
+        if ((h == 0 || h == HEIGHT - 1) && (w == 0 || w == WIDTH - 1)) {
+          t.corners |= b;
+        }
+        for (auto d = 0; d < NUM_DIRECTIONS; ++d) {
+          auto th = h + DIR_H[d];
+          auto tw = w + DIR_W[d];
+          while (th >= 0 && th < HEIGHT && tw >= 0 && tw < WIDTH) {
+            t.rays[d][h * WIDTH + w] |= bit(th, tw);
+            th += DIR_H[d];
+            tw += DIR_W[d];
+          }
+        }
+      }
+    }
+    return t;
+  }
+
+  // Constant initialized when Mask supports constexpr math.
+  static inline const Tables TABLES = make_tables();
+
+  // Moves every square one step in direction d. Squares that leave the board
+  // are dropped.
+  [[nodiscard]] static Mask shift(Mask m, int d) noexcept {
+    switch (d) {
+      case UP:
+        return m >> WIDTH;
+      case DOWN:
+        return (m << WIDTH) & TABLES.full;
+      case LEFT:
+        return (m >> 1) & ~TABLES.right_column;
+      default:
+        return (m << 1) & ~TABLES.left_column & TABLES.full;
+    }
+  }
+
+  // All squares next to a square in m.
+  [[nodiscard]] static Mask neighbors(Mask m) noexcept {
+    return shift(m, UP) | shift(m, DOWN) | shift(m, LEFT) | shift(m, RIGHT);
+  }
+
+  // Whether any square in targets is connected to seeds by steps through
+  // open. Floods out one step at a time and stops at the first target.
+  [[nodiscard]] static bool reaches(Mask seeds, Mask open,
+                                    Mask targets) noexcept {
+    auto reached = seeds & open;
+    while ((reached & targets) == 0) {
+      const auto next = (reached | neighbors(reached)) & open;
+      if (next == reached) {
+        return false;
+      }
+      reached = next;
+    }
+    return true;
+  }
+
+  // Squares a piece on square can slide to in direction d before hitting a
+  // blocker.
+  [[nodiscard]] static Mask slide(int square, int d, Mask blockers) noexcept {
+    auto ray = TABLES.rays[d][square];
+    const auto hit = ray & blockers;
+    if (hit != 0) {
+      const auto blocker = d % 2 == 0 ? msb(hit) : lsb(hit);
+      ray &= ~(TABLES.rays[d][blocker] | bit(blocker));
+    }
+    return ray;
+  }
+
+  // Custodian captures by a piece moved to square. A target next to the
+  // square is captured when the square past it in the same direction is an
+  // anvil.
+  [[nodiscard]] static Mask sandwiched(int square, Mask targets,
+                                       Mask anvils) noexcept {
+    const auto from = bit(square);
+    auto out = Mask{0};
+    for (auto d = 0; d < NUM_DIRECTIONS; ++d) {
+      out |= shift(from, d) & targets & shift(anvils, opposite(d));
+    }
+    return out;
+  }
+};
+
+}  // namespace alphazero::bitboard
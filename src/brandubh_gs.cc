@@ -1,14 +1,36 @@
 #include "brandubh_gs.h"
 
+#include "bitboard.h"
 #include "color.h"
 #include "tafl_helper.h"
+#include "zobrist.h"
 
 namespace alphazero::brandubh_gs {
 
+using Board = bitboard::Board<uint64_t, WIDTH, HEIGHT>;
+using bitboard::NUM_DIRECTIONS;
+
+constexpr const auto THRONE = Board::bit(3, 3);
+constexpr const auto CORNERS = Board::make_tables().corners;
+
+BrandubhGS::BrandubhGS(uint16_t max_turns) : max_turns_(max_turns) {
+  // King
+  board_.king = Board::bit(3, 3);
+
+  // Defenders
+  board_.def = Board::bit(2, 3) | Board::bit(3, 2) | Board::bit(4, 3) |
+               Board::bit(3, 4);
+
+  // Attackers
+  board_.atk = Board::bit(1, 3) | Board::bit(0, 3) | Board::bit(3, 1) |
+               Board::bit(3, 0) | Board::bit(5, 3) | Board::bit(6, 3) |
+               Board::bit(3, 5) | Board::bit(3, 6);
+
+  key_ = tafl_bitboard::position_key(board_, player_);
+}
+
 [[nodiscard]] std::unique_ptr<GameState> BrandubhGS::copy() const noexcept {
-  return std::make_unique<BrandubhGS>(board_, player_, turn_, max_turns_,
-                                      current_repetition_count_,
-                                      repetition_counts_, board_intern_);
+  return std::make_unique<BrandubhGS>(*this);
 }
 
 [[nodiscard]] bool BrandubhGS::operator==(const GameState& other) const
@@ -17,123 +39,38 @@ namespace alphazero::brandubh_gs {
   if (other_cs == nullptr) {
     return false;
   }
-  for (auto p = 0; p < 3; ++p) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        if (other_cs->board_(p, h, w) != board_(p, h, w)) {
-          return false;
-        }
-      }
-    }
-  }
-  return (other_cs->player_ == player_ &&
+  return (other_cs->key_ == key_ && other_cs->board_ == board_ &&
+          other_cs->player_ == player_ &&
           other_cs->current_repetition_count_ == current_repetition_count_);
 }
 
 void BrandubhGS::hash(absl::HashState h) const {
-  h = absl::HashState::combine_contiguous(std::move(h), board_.data(),
-                                          board_.size());
-  absl::HashState::combine(std::move(h), player_, current_repetition_count_);
-}
-
-uint8_t piece_to_player(const BoardTensor& bt, uint8_t target_h,
-                        uint8_t target_w) {
-  if (bt(ATK_LAYER, target_h, target_w) == 1) {
-    return ATK_PLAYER;
-  } else if (bt(KING_LAYER, target_h, target_w) == 1 ||
-             bt(DEF_LAYER, target_h, target_w) == 1) {
-    return DEF_PLAYER;
-  }
-
-  throw std::runtime_error{
-      "piece to player called on a square without pieces...rip"};
-}
-
-bool is_players_piece(const BoardTensor& bt, uint8_t player, int target_h,
-                      int target_w) {
-  return (player == DEF_PLAYER && (bt(KING_LAYER, target_h, target_w) == 1 ||
-                                   bt(DEF_LAYER, target_h, target_w) == 1)) ||
-         (player == ATK_PLAYER && bt(ATK_LAYER, target_h, target_w) == 1);
+  absl::HashState::combine(std::move(h), fingerprint());
 }
 
-bool is_opponent_piece(const BoardTensor& bt, uint8_t player, int target_h,
-                       int target_w) {
-  return (player == ATK_PLAYER && (bt(KING_LAYER, target_h, target_w) == 1 ||
-                                   bt(DEF_LAYER, target_h, target_w) == 1)) ||
-         (player == DEF_PLAYER && bt(ATK_LAYER, target_h, target_w) == 1);
+[[nodiscard]] uint64_t BrandubhGS::fingerprint() const noexcept {
+  return key_ ^ zobrist::mix(current_repetition_count_);
 }
 
-bool is_valid_square(const BoardTensor& bt, bool is_king, int target_h,
-                     int target_w) {
-  // Positions off the edge of the board are never valid.
-  if (target_w < 0 || target_w >= WIDTH || target_h < 0 || target_h >= HEIGHT) {
-    return false;
-  }
-  // Corners are only valid to the king.
-  if ((target_w == 0 && target_h == 0) ||
-      (target_w == WIDTH - 1 && target_h == 0) ||
-      (target_w == 0 && target_h == HEIGHT - 1) ||
-      (target_w == WIDTH - 1 && target_h == HEIGHT - 1)) {
-    return is_king;
+// Squares a piece on square can move to in direction d.
+// Pieces slide until blocked. Only the king may use the corners or stop on
+// the throne. Other pieces may pass over the empty throne.
+uint64_t move_targets(const Bitboards& b, int square, int d,
+                      bool is_king) noexcept {
+  if (is_king) {
+    return Board::slide(square, d, b.occupied());
   }
-  // Otherwise is valid if it is empty.
-  return bt(0, target_h, target_w) == 0 && bt(1, target_h, target_w) == 0 &&
-         bt(2, target_h, target_w) == 0;
+  return Board::slide(square, d, b.occupied() | CORNERS) & ~THRONE;
 }
 
 [[nodiscard]] bool BrandubhGS::has_valid_moves() const noexcept {
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      if (is_players_piece(board_, player_, h, w)) {
-        bool is_king = board_(0, h, w) == 1;
-        {
-          auto target_w = w + 1;
-          while (is_valid_square(board_, is_king, h, target_w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (h == 3 && target_w == 3 && !is_king) {
-              ++target_w;
-              continue;
-            }
-            return true;
-          }
-        }
-        {
-          auto target_w = w - 1;
-          while (is_valid_square(board_, is_king, h, target_w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (h == 3 && target_w == 3 && !is_king) {
-              --target_w;
-              continue;
-            }
-            return true;
-          }
-        }
-        {
-          auto target_h = h + 1;
-          while (is_valid_square(board_, is_king, target_h, w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (target_h == 3 && w == 3 && !is_king) {
-              ++target_h;
-              continue;
-            }
-            return true;
-          }
-        }
-        {
-          auto target_h = h - 1;
-          while (is_valid_square(board_, is_king, target_h, w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (target_h == 3 && w == 3 && !is_king) {
-              --target_h;
-              continue;
-            }
-            return true;
-          }
-        }
+  auto pieces = board_.player(player_);
+  while (pieces != 0) {
+    const auto s = bitboard::pop_lsb(pieces);
+    const auto is_king = (board_.king & Board::bit(s)) != 0;
+    for (auto d = 0; d < NUM_DIRECTIONS; ++d) {
+      if (move_targets(board_, s, d, is_king) != 0) {
+        return true;
       }
     }
   }
@@ -143,143 +80,41 @@ bool is_valid_square(const BoardTensor& bt, bool is_king, int target_h,
 [[nodiscard]] Vector<uint8_t> BrandubhGS::valid_moves() const noexcept {
   auto valids = Vector<uint8_t>{NUM_MOVES};
   valids.setZero();
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      if (is_players_piece(board_, player_, h, w)) {
-        bool is_king = board_(0, h, w) == 1;
-        {
-          auto target_w = w + 1;
-          while (is_valid_square(board_, is_king, h, target_w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (h == 3 && target_w == 3 && !is_king) {
-              ++target_w;
-              continue;
-            }
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + target_w + 0] = 1;
-            ++target_w;
-          }
-        }
-        {
-          auto target_w = w - 1;
-          while (is_valid_square(board_, is_king, h, target_w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (h == 3 && target_w == 3 && !is_king) {
-              --target_w;
-              continue;
-            }
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + target_w + 0] = 1;
-            --target_w;
-          }
-        }
-        {
-          auto target_h = h + 1;
-          while (is_valid_square(board_, is_king, target_h, w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (target_h == 3 && w == 3 && !is_king) {
-              ++target_h;
-              continue;
-            }
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + WIDTH + target_h] = 1;
-            ++target_h;
-          }
-        }
-        {
-          auto target_h = h - 1;
-          while (is_valid_square(board_, is_king, target_h, w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (target_h == 3 && w == 3 && !is_king) {
-              --target_h;
-              continue;
-            }
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + WIDTH + target_h] = 1;
-            --target_h;
-          }
-        }
+  auto pieces = board_.player(player_);
+  while (pieces != 0) {
+    const auto s = bitboard::pop_lsb(pieces);
+    const auto is_king = (board_.king & Board::bit(s)) != 0;
+    for (auto d = 0; d < NUM_DIRECTIONS; ++d) {
+      auto targets = move_targets(board_, s, d, is_king);
+      while (targets != 0) {
+        const auto t = bitboard::pop_lsb(targets);
+        valids[tafl_bitboard::move_index<WIDTH, HEIGHT>(s, t)] = 1;
       }
     }
   }
   return valids;
 }
 
-bool is_hostile_to(const BoardTensor& bt, uint8_t player, bool is_king,
-                   int target_h, int target_w) {
+// Squares that capture pieces of player when on the far side of them.
+uint64_t hostile_to(const Bitboards& b, uint8_t player) {
   // Corners are always hostile to all.
-  if ((target_w == 0 && target_h == 0) ||
-      (target_w == WIDTH - 1 && target_h == 0) ||
-      (target_w == 0 && target_h == HEIGHT - 1) ||
-      (target_w == WIDTH - 1 && target_h == HEIGHT - 1)) {
-    return true;
-  }
-  if (target_w == 3 && target_h == 3) {
-    // To match OpenTafl Brandubh, the throne is also hostile to the king.
-    (void)is_king;  // void cast to avoid unused warning.
-    // Throne is never hostile to the king.
-    // if (is_king) {
-    // return false;
-    // }
-    // The throne is only hostile to other defenders if the king isn't there.
-    if (player == DEF_PLAYER) {
-      return bt(KING_LAYER, 3, 3) == 0;
-    }
-    // Throne is otherwise hostile to all.
-    return true;
-  }
-  // Otherwise, opponent pieces decide if a square is hostile.
-  return is_opponent_piece(bt, player, target_h, target_w);
-}
-
-bool captured(const BoardTensor& bt, int from_h, int from_w, int delta_h,
-              int delta_w) {
-  auto target_h = from_h + delta_h;
-  auto target_w = from_w + delta_w;
-  if (target_w < 0 || target_w >= WIDTH || target_h < 0 || target_h >= HEIGHT) {
-    return false;
-  }
-  // For now matching OpenTafl, this is no longer special.
-  // Special case: King on throne requires complete surrounding.
-  // if (target_w == 3 && target_h == 3 && bt(KING_LAYER, 3, 3) == 1) {
-  //   if (bt(ATK_LAYER, 2, 3) == 1 && bt(ATK_LAYER, 4, 3) == 1 &&
-  //       bt(ATK_LAYER, 3, 2) == 1 && bt(ATK_LAYER, 3, 4) == 1) {
-  //     return true;
-  //   }
-  //   return false;
-  // }
-
-  uint8_t from_player = piece_to_player(bt, from_h, from_w);
-  // Only opponent pieces can be captured.
-  if (!is_opponent_piece(bt, from_player, target_h, target_w)) {
-    return false;
-  }
-
-  // Only captured if the final square is hostile to the target player.
-  uint8_t target_player = piece_to_player(bt, target_h, target_w);
-  auto final_h = target_h + delta_h;
-  auto final_w = target_w + delta_w;
-  if (final_w < 0 || final_w >= WIDTH || final_h < 0 || final_h >= HEIGHT) {
-    return false;
+  auto hostile = CORNERS | b.opponent(player);
+  // To match OpenTafl Brandubh, the throne is also hostile to the king.
+  // The throne is only hostile to other defenders if the king isn't there.
+  // Throne is otherwise hostile to all.
+  if (player != DEF_PLAYER || (b.king & THRONE) == 0) {
+    hostile |= THRONE;
   }
-  return is_hostile_to(bt, target_player,
-                       bt(KING_LAYER, target_h, target_w) == 1, final_h,
-                       final_w);
+  return hostile;
 }
 
 void BrandubhGS::play_move(uint32_t move) {
   if (move < 0 || move >= NUM_MOVES) {
     throw std::runtime_error{"Invalid move: You have a bug in your code."};
   }
-  // Initialize board interning if it is turn is 0.
-  // We initialize it with the first move because we only want to share it
-  // within one game, not across all games.
-  if (turn_ == 0) {
-    board_intern_ =
-        std::make_shared<absl::flat_hash_set<RepetitionKeyWrapper>>();
-    auto [key, _inserted_new] = board_intern_->emplace(board_, player_);
-    const auto key_ptr = key->data;
-    repetition_counts_[key_ptr] = 1;
+  // The start position counts towards repetitions.
+  if (history_.empty()) {
+    history_.push_back(key_);
   }
 
   // Move specified piece to row/column.
@@ -299,71 +134,34 @@ void BrandubhGS::play_move(uint32_t move) {
   } else {
     new_w = new_loc;
   }
-  board_(0, new_h, new_w) = board_(0, piece_h, piece_w);
-  board_(1, new_h, new_w) = board_(1, piece_h, piece_w);
-  board_(2, new_h, new_w) = board_(2, piece_h, piece_w);
-
-  board_(0, piece_h, piece_w) = 0;
-  board_(1, piece_h, piece_w) = 0;
-  board_(2, piece_h, piece_w) = 0;
+  const auto to_square = new_h * WIDTH + new_w;
+  const auto from = Board::bit(piece_h, piece_w);
+  const auto to = Board::bit(to_square);
+  key_ ^= board_.key(from);
+  board_.move(from, to);
+  key_ ^= board_.key(to);
 
   // Check if it captures anything.
-  if (captured(board_, new_h, new_w, -1, 0)) {
-    board_(0, new_h - 1, new_w) = 0;
-    board_(1, new_h - 1, new_w) = 0;
-    board_(2, new_h - 1, new_w) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
-  }
-  if (captured(board_, new_h, new_w, 1, 0)) {
-    board_(0, new_h + 1, new_w) = 0;
-    board_(1, new_h + 1, new_w) = 0;
-    board_(2, new_h + 1, new_w) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
-  }
-  if (captured(board_, new_h, new_w, 0, -1)) {
-    board_(0, new_h, new_w - 1) = 0;
-    board_(1, new_h, new_w - 1) = 0;
-    board_(2, new_h, new_w - 1) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
-  }
-  if (captured(board_, new_h, new_w, 0, 1)) {
-    board_(0, new_h, new_w + 1) = 0;
-    board_(1, new_h, new_w + 1) = 0;
-    board_(2, new_h, new_w + 1) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
+  // For now matching OpenTafl, the king on the throne is not special.
+  const auto opponent = (player_ + 1) % 2;
+  const auto captured =
+      Board::sandwiched(to_square, board_.player(opponent),
+                        hostile_to(board_, opponent));
+  if (captured != 0) {
+    key_ ^= board_.key(captured);
+    board_.remove(captured);
+    // All old repetitions are invalid since we no longer have the same
+    // number of pieces.
+    history_.clear();
   }
 
   player_ = (player_ + 1) % 2;
+  key_ ^= tafl_bitboard::DEF_TO_MOVE_KEY;
   ++turn_;
 
   // Update repetitions.
-  auto [key, _inserted_new] = board_intern_->emplace(board_, player_);
-  const auto key_ptr = key->data;
-  if (!repetition_counts_.contains(key_ptr)) {
-    repetition_counts_[key_ptr] = 1;
-  } else {
-    ++repetition_counts_[key_ptr];
-  }
-  current_repetition_count_ = repetition_counts_[key_ptr];
-}
-
-[[nodiscard]] bool king_exists(const BoardTensor& bt) noexcept {
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      if (bt(KING_LAYER, h, w) == 1) {
-        return true;
-      }
-    }
-  }
-  return false;
+  history_.push_back(key_);
+  current_repetition_count_ = tafl_bitboard::repetition_count(history_);
 }
 
 [[nodiscard]] std::optional<Vector<float>> BrandubhGS::scores() const noexcept {
@@ -386,14 +184,12 @@ void BrandubhGS::play_move(uint32_t move) {
     return scores;
   }
   // Check if the king is on a corner.
-  if (board_(KING_LAYER, 0, 0) == 1 || board_(KING_LAYER, HEIGHT - 1, 0) == 1 ||
-      board_(KING_LAYER, 0, WIDTH - 1) == 1 ||
-      board_(KING_LAYER, HEIGHT - 1, WIDTH - 1) == 1) {
+  if ((board_.king & CORNERS) != 0) {
     scores(1) = 1;
     return scores;
   }
   // Check if the king still exists.
-  if (!king_exists(board_)) {
+  if (board_.king == 0) {
     scores(0) = 1;
     return scores;
   }
@@ -411,59 +207,37 @@ void BrandubhGS::play_move(uint32_t move) {
   return std::nullopt;
 }
 
-[[nodiscard]] Tensor<float, 3> BrandubhGS::canonicalized() const noexcept {
-  auto out = CanonicalTensor{};
+void BrandubhGS::canonicalize_into(float* data) const noexcept {
+  auto out = sized_tensor_map<CanonicalTensor>(data);
+  out.setZero();
 
   // Board planes.
+  const auto layers = std::array<uint64_t, 3>{board_.king, board_.def,
+                                              board_.atk};
   for (auto p = 0; p < 3; ++p) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(p, h, w) = board_(p, h, w);
-      }
+    auto pieces = layers[p];
+    while (pieces != 0) {
+      const auto s = bitboard::pop_lsb(pieces);
+      out(p, s / WIDTH, s % WIDTH) = 1;
     }
   }
 
   // Current player planes.
-  auto p = player_ + 3;
-  auto op = (player_ + 1) % 2 + 3;
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      out(p, h, w) = 1;
-      out(op, h, w) = 0;
-    }
-  }
+  out.chip(player_ + 3, 0).setConstant(1);
 
   // Repetition count.
-  if (current_repetition_count_ == 0) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 0;
-        out(6, h, w) = 0;
-      }
-    }
-  } else if (current_repetition_count_ == 1) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 1;
-        out(6, h, w) = 0;
-      }
-    }
-  } else if (current_repetition_count_ == 2) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 0;
-        out(6, h, w) = 1;
-      }
-    }
-  } else if (current_repetition_count_ > 2) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 1;
-        out(6, h, w) = 1;
-      }
-    }
+  if (current_repetition_count_ == 1 || current_repetition_count_ > 2) {
+    out.chip(5, 0).setConstant(1);
   }
+  if (current_repetition_count_ >= 2) {
+    out.chip(6, 0).setConstant(1);
+  }
+}
 
+[[nodiscard]] Tensor<float, 3> BrandubhGS::canonicalized() const noexcept {
+  auto out = Tensor<float, 3>{CANONICAL_SHAPE[0], CANONICAL_SHAPE[1],
+                              CANONICAL_SHAPE[2]};
+  canonicalize_into(out.data());
   return out;
 }
 
@@ -481,23 +255,21 @@ void BrandubhGS::play_move(uint32_t move) {
       '\n';
   for (auto h = 0; h < HEIGHT; ++h) {
     for (auto w = 0; w < WIDTH; ++w) {
-      if ((h == 0 && w == 0) || (h == HEIGHT - 1 && w == 0) ||
-          (h == 0 && w == WIDTH - 1) || (h == HEIGHT - 1 && w == WIDTH - 1) ||
-          (h == 3 && w == 3)) {
+      const auto square = Board::bit(h, w);
+      const auto special = ((CORNERS | THRONE) & square) != 0;
+      if (special) {
         out += color::Modifier{color::BG_RED}.dump();
       }
-      if (board_(0, h, w) == 1) {
+      if ((board_.king & square) != 0) {
         out += '@';
-      } else if (board_(1, h, w) == 1) {
+      } else if ((board_.def & square) != 0) {
         out += 'O';
-      } else if (board_(2, h, w) == 1) {
+      } else if ((board_.atk & square) != 0) {
         out += 'X';
       } else {
         out += '.';
       }
-      if ((h == 0 && w == 0) || (h == HEIGHT - 1 && w == 0) ||
-          (h == 0 && w == WIDTH - 1) || (h == HEIGHT - 1 && w == WIDTH - 1) ||
-          (h == 3 && w == 3)) {
+      if (special) {
         out += color::Modifier{color::BG_DEFAULT}.dump();
       }
     }
@@ -507,9 +279,6 @@ void BrandubhGS::play_move(uint32_t move) {
   return out;
 }
 
-void BrandubhGS::minimize_storage() {
-  repetition_counts_ = {};
-  board_intern_ = nullptr;
-}
+void BrandubhGS::minimize_storage() { history_ = {}; }
 
-}  // namespace alphazero::brandubh_gs
\ No newline at end of file
+}  // namespace alphazero::brandubh_gs
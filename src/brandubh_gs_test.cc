@@ -1,6 +1,7 @@
 
 #include "brandubh_gs.h"
 
+#include "game_state_digest.h"
 #include "gtest/gtest.h"
 
 namespace alphazero::brandubh_gs {
@@ -53,5 +54,53 @@ TEST(BrandubhGS, RepetitionCount) {
   EXPECT_EQ(s, expected);
 }
 
+// NOLINTNEXTLINE
+TEST(BrandubhGS, Fingerprint) {
+  const auto atk1 = (3 * WIDTH + 5) * (WIDTH + HEIGHT) + WIDTH + 4;
+  const auto atk2 = (3 * WIDTH + 1) * (WIDTH + HEIGHT) + WIDTH + 4;
+  const auto def_out = (2 * WIDTH + 3) * (WIDTH + HEIGHT) + 2;
+  const auto def_back = (2 * WIDTH + 2) * (WIDTH + HEIGHT) + 3;
+  const auto start = BrandubhGS{};
+
+  // The same position reached in a different order.
+  auto x = start.copy();
+  auto y = start.copy();
+  EXPECT_EQ(x->fingerprint(), start.fingerprint());
+  for (const auto move : {atk1, def_out, atk2, def_back}) {
+    x->play_move(move);
+  }
+  for (const auto move : {atk2, def_out, atk1, def_back}) {
+    y->play_move(move);
+  }
+  EXPECT_EQ(*x, *y);
+  EXPECT_EQ(x->fingerprint(), y->fingerprint());
+  EXPECT_NE(x->fingerprint(), start.fingerprint());
+
+  // Back at the start board, but as a repetition.
+  const auto atk1_back = (4 * WIDTH + 5) * (WIDTH + HEIGHT) + WIDTH + 3;
+  auto z = start.copy();
+  for (const auto move : {atk1, def_out, atk1_back, def_back}) {
+    z->play_move(move);
+  }
+  EXPECT_NE(*z, start);
+  EXPECT_NE(z->fingerprint(), start.fingerprint());
+}
+
+// Golden values were recorded from the tensor based implementation that the
+// bitboards replaced.
+// NOLINTNEXTLINE
+TEST(BrandubhGS, Perft) {
+  const auto gs = BrandubhGS{};
+  EXPECT_EQ(perft(gs, 1), 40);
+  EXPECT_EQ(perft(gs, 2), 960);
+  EXPECT_EQ(perft(gs, 3), 39512);
+  EXPECT_EQ(perft(gs, 4), 1007392);
+}
+
+// NOLINTNEXTLINE
+TEST(BrandubhGS, PlayoutDigest) {
+  EXPECT_EQ(playout_digest(BrandubhGS{}, 200, 42), 0xbb299f8fc65ca4b9);
+}
+
 }  // namespace
 }  // namespace alphazero::brandubh_gs
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <optional>
 #include <queue>
 #include <thread>
+#include <utility>
 
 namespace alphazero {
 
@@ -20,6 +21,13 @@ class ConcurrentQueue {
     cv_.notify_one();
   }
 
+  void push(T&& data) noexcept {
+    std::unique_lock lock(m_);
+    queue_.push(std::move(data));
+    lock.unlock();
+    cv_.notify_one();
+  }
+
   void push_many(const std::vector<T>& data) noexcept {
     std::unique_lock lock(m_);
     for (const auto& d : data) {
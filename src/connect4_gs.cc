@@ -1,144 +1,248 @@
 #include "connect4_gs.h"
 
+#include <algorithm>
+#include <vector>
+
+#include "bitboard.h"
+
 namespace alphazero::connect4_gs {
 
-[[nodiscard]] std::unique_ptr<GameState> Connect4GS::copy() const noexcept {
-  return std::make_unique<Connect4GS>(board_, player_, turn_);
+// Square (h, w) of the board tensor. Row 0 is the top of the board.
+constexpr uint64_t bit(int h, int w) {
+  return uint64_t{1} << (w * COLUMN_BITS + (HEIGHT - 1 - h));
 }
 
-[[nodiscard]] bool Connect4GS::operator==(
-    const GameState& other) const noexcept {
-  const auto* other_cs = dynamic_cast<const Connect4GS*>(&other);
-  if (other_cs == nullptr) {
-    return false;
+constexpr uint64_t bottom(int w) { return bit(HEIGHT - 1, w); }
+
+constexpr uint64_t column(int w) {
+  return ((uint64_t{1} << HEIGHT) - 1) << (w * COLUMN_BITS);
+}
+
+constexpr uint64_t top_row() {
+  auto out = uint64_t{0};
+  for (auto w = 0; w < WIDTH; ++w) {
+    out |= bit(0, w);
+  }
+  return out;
+}
+constexpr const uint64_t TOP_ROW = top_row();
+
+// Whether pieces has four in a row. Each shift steps along a line: 1 is
+// vertical, COLUMN_BITS horizontal, and one less or more the diagonals.
+constexpr bool has_four(uint64_t pieces) {
+  for (const auto step : {1, COLUMN_BITS, COLUMN_BITS - 1, COLUMN_BITS + 1}) {
+    const auto pairs = pieces & (pieces >> step);
+    if ((pairs & (pairs >> (2 * step))) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Lowest empty square of column w, or 0 if the column is full.
+// Adding the bottom bit carries up to the first empty square.
+constexpr uint64_t drop(uint64_t filled, int w) {
+  return (filled + bottom(w)) & column(w) & ~filled;
+}
+
+// Center columns take part in more lines, so they are searched first.
+constexpr const std::array<int, WIDTH> SOLVE_ORDER = {3, 2, 4, 1, 5, 0, 6};
+
+// Transposition table of the solver. Values are from the view of the player to
+// move, so a position is keyed by the filled squares plus its pieces.
+constexpr const size_t SOLVE_TABLE_SIZE = 1 << 18;
+enum Bound : uint8_t { EMPTY, EXACT, LOWER, UPPER };
+struct SolveEntry {
+  uint64_t key = 0;
+  int8_t value = 0;
+  Bound bound = EMPTY;
+};
+
+// Negamax alpha-beta. Returns 1 if the player to move with pieces mine wins,
+// -1 if they lose, and 0 for a draw. Neither player may already have four in a
+// row.
+int negamax(uint64_t mine, uint64_t theirs, int alpha, int beta,
+            std::vector<SolveEntry>& table) {
+  const auto filled = mine | theirs;
+  if ((filled & TOP_ROW) == TOP_ROW) {
+    return 0;
   }
+  for (auto w = 0; w < WIDTH; ++w) {
+    const auto placed = drop(filled, w);
+    if (placed != 0 && has_four(mine | placed)) {
+      return 1;
+    }
+  }
+
+  const auto key = filled + mine;
+  auto& entry = table[key % SOLVE_TABLE_SIZE];
+  if (entry.bound != EMPTY && entry.key == key) {
+    if (entry.bound == EXACT) {
+      return entry.value;
+    }
+    if (entry.bound == LOWER) {
+      alpha = std::max(alpha, static_cast<int>(entry.value));
+    } else {
+      beta = std::min(beta, static_cast<int>(entry.value));
+    }
+    if (alpha >= beta) {
+      return entry.value;
+    }
+  }
+
+  const auto start_alpha = alpha;
+  auto best = -1;
+  for (const auto w : SOLVE_ORDER) {
+    const auto placed = drop(filled, w);
+    if (placed == 0) {
+      continue;
+    }
+    best = std::max(best,
+                    -negamax(theirs, mine | placed, -beta, -alpha, table));
+    alpha = std::max(alpha, best);
+    if (alpha >= beta) {
+      break;
+    }
+  }
+
+  // The recursion may have replaced the entry, so look it up again.
+  auto& out = table[key % SOLVE_TABLE_SIZE];
+  out.key = key;
+  out.value = static_cast<int8_t>(best);
+  if (best <= start_alpha) {
+    out.bound = UPPER;
+  } else if (best >= beta) {
+    out.bound = LOWER;
+  } else {
+    out.bound = EXACT;
+  }
+  return best;
+}
+
+Connect4GS::Connect4GS(const BoardTensor& board, int8_t player, int32_t turn)
+    : player_(player), turn_(turn) {
   for (auto p = 0; p < 2; ++p) {
     for (auto h = 0; h < HEIGHT; ++h) {
       for (auto w = 0; w < WIDTH; ++w) {
-        if (other_cs->board_(p, h, w) != board_(p, h, w)) {
-          return false;
+        if (board(p, h, w) == 1) {
+          pieces_[p] |= bit(h, w);
         }
       }
     }
   }
-  return (other_cs->player_ == player_);
+  if (has_four(pieces_[0])) {
+    winner_ = 0;
+  } else if (has_four(pieces_[1])) {
+    winner_ = 1;
+  }
+}
+
+[[nodiscard]] std::unique_ptr<GameState> Connect4GS::copy() const noexcept {
+  return std::make_unique<Connect4GS>(*this);
+}
+
+[[nodiscard]] bool Connect4GS::operator==(
+    const GameState& other) const noexcept {
+  const auto* other_cs = dynamic_cast<const Connect4GS*>(&other);
+  if (other_cs == nullptr) {
+    return false;
+  }
+  return other_cs->pieces_ == pieces_ && other_cs->player_ == player_;
 }
 
 void Connect4GS::hash(absl::HashState h) const {
-  h = absl::HashState::combine_contiguous(std::move(h), board_.data(),
-                                          board_.size());
-  absl::HashState::combine(std::move(h), player_);
+  absl::HashState::combine(std::move(h), fingerprint());
+}
+
+// Within a column, the filled bits plus player 0's bits is unique for every
+// stack, and stays below the spare bit.
+[[nodiscard]] uint64_t Connect4GS::fingerprint() const noexcept {
+  const auto filled = pieces_[0] | pieces_[1];
+  return (filled + pieces_[0]) | (uint64_t{player_ == 1} << 63);
 }
 
 [[nodiscard]] Vector<uint8_t> Connect4GS::valid_moves() const noexcept {
+  const auto filled = pieces_[0] | pieces_[1];
   auto valids = Vector<uint8_t>{WIDTH};
   for (auto w = 0; w < WIDTH; ++w) {
-    valids(w) =
-        static_cast<uint8_t>(board_(0, 0, w) == 0 && board_(1, 0, w) == 0);
+    valids(w) = static_cast<uint8_t>((filled & bit(0, w)) == 0);
   }
   return valids;
 }
 
 void Connect4GS::play_move(uint32_t move) {
-  for (auto h = HEIGHT - 1; h >= 0; --h) {
-    if (board_(0, h, move) == 0 && board_(1, h, move) == 0) {
-      board_(player_, h, move) = 1;
-      player_ = (player_ + 1) % 2;
-      ++turn_;
-      return;
-    }
+  const auto placed = move < WIDTH ? drop(pieces_[0] | pieces_[1], move) : 0;
+  if (placed == 0) {
+    throw std::runtime_error{"Invalid move: You have a bug in your code."};
+  }
+  pieces_[player_] |= placed;
+  if (winner_ == -1 && has_four(pieces_[player_])) {
+    winner_ = player_;
   }
-  throw std::runtime_error{"Invalid move: You have a bug in your code."};
+  player_ = (player_ + 1) % 2;
+  ++turn_;
 }
 
 [[nodiscard]] std::optional<Vector<float>> Connect4GS::scores() const noexcept {
   auto scores = SizedVector<float, 3>{};
   scores.setZero();
-  for (auto p = 0; p < 2; ++p) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      auto total = 0;
-      for (auto w = 0; w < WIDTH; ++w) {
-        if (board_(p, h, w) == 1) {
-          ++total;
-        } else {
-          total = 0;
-        }
-        if (total == 4) {
-          scores(p) = 1;
-          return scores;
-        }
-      }
-    }
-    for (auto w = 0; w < WIDTH; ++w) {
-      auto total = 0;
-      for (auto h = 0; h < HEIGHT; ++h) {
-        if (board_(p, h, w) == 1) {
-          ++total;
-        } else {
-          total = 0;
-        }
-        if (total == 4) {
-          scores(p) = 1;
-          return scores;
-        }
-      }
-    }
-    for (auto h = 0; h < HEIGHT - 3; ++h) {
-      for (auto w = 0; w < WIDTH - 3; ++w) {
-        auto good = true;
-        for (auto x = 0; x < 4; ++x) {
-          if (board_(p, h + x, w + x) == 0) {
-            good = false;
-            break;
-          }
-        }
-        if (good) {
-          scores(p) = 1;
-          return scores;
-        }
-      }
-      for (auto w = WIDTH - 4; w < WIDTH; ++w) {
-        auto good = true;
-        for (auto x = 0; x < 4; ++x) {
-          if (board_(p, h + x, w - x) == 0) {
-            good = false;
-            break;
-          }
-        }
-        if (good) {
-          scores(p) = 1;
-          return scores;
-        }
-      }
-    }
+  if (winner_ != -1) {
+    scores(winner_) = 1;
+    return scores;
   }
-  auto valids = valid_moves();
-  for (auto w = 0; w < WIDTH; ++w) {
-    if (valids(w) == 1) {
-      return std::nullopt;
-    }
+  if (((pieces_[0] | pieces_[1]) & TOP_ROW) != TOP_ROW) {
+    return std::nullopt;
   }
   scores(2) = 1;
   return scores;
 }
 
-[[nodiscard]] Tensor<float, 3> Connect4GS::canonicalized() const noexcept {
-  auto out = CanonicalTensor{};
-  for (auto p = 0; p < 2; ++p) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(p, h, w) = board_(p, h, w);
-      }
-    }
+[[nodiscard]] std::optional<Vector<float>> Connect4GS::solve(
+    uint32_t max_moves) const noexcept {
+  const auto filled = pieces_[0] | pieces_[1];
+  const auto empty = WIDTH * HEIGHT - bitboard::popcount(filled);
+  if (static_cast<uint32_t>(empty) > max_moves) {
+    return std::nullopt;
   }
-  auto p = player_ + 2;
-  auto op = (player_ + 1) % 2 + 2;
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      out(p, h, w) = 1;
-      out(op, h, w) = 0;
+  auto out = scores();
+  if (out.has_value()) {
+    return out;
+  }
+  // Each search thread keeps its own table. Values never go stale, so it is
+  // shared by every solve on the thread.
+  thread_local auto table = std::vector<SolveEntry>(SOLVE_TABLE_SIZE);
+  const auto opponent = (player_ + 1) % 2;
+  const auto value =
+      negamax(pieces_[player_], pieces_[opponent], -1, 1, table);
+  auto scores = SizedVector<float, 3>{};
+  scores.setZero();
+  if (value > 0) {
+    scores(player_) = 1;
+  } else if (value < 0) {
+    scores(opponent) = 1;
+  } else {
+    scores(2) = 1;
+  }
+  return scores;
+}
+
+void Connect4GS::canonicalize_into(float* data) const noexcept {
+  auto out = sized_tensor_map<CanonicalTensor>(data);
+  out.setZero();
+  for (auto p = 0; p < 2; ++p) {
+    auto pieces = pieces_[p];
+    while (pieces != 0) {
+      const auto i = bitboard::pop_lsb(pieces);
+      out(p, HEIGHT - 1 - i % COLUMN_BITS, i / COLUMN_BITS) = 1;
     }
   }
+  out.chip(player_ + 2, 0).setConstant(1);
+}
+
+[[nodiscard]] Tensor<float, 3> Connect4GS::canonicalized() const noexcept {
+  auto out = Tensor<float, 3>{CANONICAL_SHAPE[0], CANONICAL_SHAPE[1],
+                              CANONICAL_SHAPE[2]};
+  canonicalize_into(out.data());
   return out;
 }
 
@@ -147,6 +251,7 @@ void Connect4GS::play_move(uint32_t move) {
   std::vector<PlayHistory> syms{base};
   PlayHistory mirror;
   mirror.v = base.v;
+  mirror.weight = base.weight;
   mirror.canonical = CanonicalTensor{};
   for (auto f = 0; f < CANONICAL_SHAPE[0]; ++f) {
     for (auto h = 0; h < HEIGHT; ++h) {
@@ -167,9 +272,9 @@ void Connect4GS::play_move(uint32_t move) {
   auto out = "Current Player: " + std::to_string(player_) + '\n';
   for (auto h = 0; h < HEIGHT; ++h) {
     for (auto w = 0; w < WIDTH; ++w) {
-      if (board_(0, h, w) == 1) {
+      if ((pieces_[0] & bit(h, w)) != 0) {
         out += 'X';
-      } else if (board_(1, h, w) == 1) {
+      } else if ((pieces_[1] & bit(h, w)) != 0) {
         out += 'O';
       } else {
         out += '.';
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+
 #include "dll_export.h"
 #include "game_state.h"
 
@@ -21,18 +23,21 @@ using CanonicalTensor =
     SizedTensor<float, Eigen::Sizes<CANONICAL_SHAPE[0], CANONICAL_SHAPE[1],
                                     CANONICAL_SHAPE[2]>>;
 
+// Each column is HEIGHT + 1 bits, bottom row first. The spare bit on top keeps
+// shifts from carrying between columns.
+constexpr const int COLUMN_BITS = HEIGHT + 1;
+
 class DLLEXPORT Connect4GS : public GameState {
  public:
-  Connect4GS() { board_.setZero(); }
-  Connect4GS(BoardTensor board, int8_t player, int32_t turn)
-      : board_(board), player_(player), turn_(turn) {}
-  Connect4GS(BoardTensor&& board, int8_t player, int32_t turn)
-      : board_(std::move(board)), player_(player), turn_(turn) {}
+  Connect4GS() = default;
+  Connect4GS(const BoardTensor& board, int8_t player, int32_t turn);
 
   [[nodiscard]] std::unique_ptr<GameState> copy() const noexcept override;
   [[nodiscard]] bool operator==(const GameState& other) const noexcept override;
 
   void hash(absl::HashState h) const override;
+  // Unique to each board and player, so it is also the position key.
+  [[nodiscard]] uint64_t fingerprint() const noexcept override;
 
   // Returns the current player. Players must be 0 indexed.
   [[nodiscard]] uint8_t current_player() const noexcept override {
@@ -64,8 +69,17 @@ class DLLEXPORT Connect4GS : public GameState {
   // otherwise.
   [[nodiscard]] std::optional<Vector<float>> scores() const noexcept override;
 
+  // Solves the position with an alpha-beta search once it has at most
+  // max_moves empty squares.
+  [[nodiscard]] std::optional<Vector<float>> solve(
+      uint32_t max_moves) const noexcept override;
+
   // Returns the canonicalized form of the board, ready for feeding to a NN.
   [[nodiscard]] Tensor<float, 3> canonicalized() const noexcept override;
+  [[nodiscard]] std::array<int, 3> canonical_shape() const noexcept override {
+    return CANONICAL_SHAPE;
+  }
+  void canonicalize_into(float* data) const noexcept override;
 
   // Returns the number of symmetries the game has.
   [[nodiscard]] uint8_t num_symmetries() const noexcept override {
@@ -84,11 +98,12 @@ class DLLEXPORT Connect4GS : public GameState {
   void minimize_storage() override {}
 
  private:
-  // Board contains a layer for each player.
-  // A 0 means no piece, a 1 means a piece for that player.
-  BoardTensor board_{};
+  // Stones of each player.
+  std::array<uint64_t, 2> pieces_{};
   int8_t player_{0};
   int32_t turn_{0};
+  // The player with four in a row or -1. Updated by play_move.
+  int8_t winner_{-1};
 };
 
 }  // namespace alphazero::connect4_gs
\ No newline at end of file
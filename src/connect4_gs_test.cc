@@ -1,5 +1,8 @@
 #include "connect4_gs.h"
 
+#include <random>
+
+#include "game_state_digest.h"
 #include "gtest/gtest.h"
 
 namespace alphazero::connect4_gs {
@@ -50,6 +53,31 @@ TEST(Connect4GS, Copy) {
   EXPECT_EQ(x, *z);
 }
 
+// NOLINTNEXTLINE
+TEST(Connect4GS, Fingerprint) {
+  auto x = Connect4GS{};
+  auto y = Connect4GS{};
+  x.play_move(0);
+  x.play_move(1);
+  x.play_move(2);
+  y.play_move(2);
+  y.play_move(1);
+  y.play_move(0);
+  EXPECT_EQ(x.fingerprint(), y.fingerprint());
+
+  // The key updated by play_move matches one built from the board.
+  auto board = SizedTensor<int8_t, Eigen::Sizes<2, HEIGHT, WIDTH>>{};
+  board.setZero();
+  board(0, HEIGHT - 1, 0) = 1;
+  board(1, HEIGHT - 1, 1) = 1;
+  board(0, HEIGHT - 1, 2) = 1;
+  EXPECT_EQ(x.fingerprint(), Connect4GS(board, 1, 3).fingerprint());
+  EXPECT_NE(x.fingerprint(), Connect4GS(board, 0, 3).fingerprint());
+
+  y.play_move(3);
+  EXPECT_NE(x.fingerprint(), y.fingerprint());
+}
+
 // NOLINTNEXTLINE
 TEST(Connect4GS, ValidMoves) {
   auto x = Connect4GS{};
@@ -226,5 +254,118 @@ TEST(Connect4GS, Canonicalize) {
   }
 }
 
+// The buffer is reused between positions, so everything must be overwritten.
+// NOLINTNEXTLINE
+TEST(Connect4GS, CanonicalizeInto) {
+  auto x = Connect4GS{};
+  x.play_move(3);
+  x.play_move(3);
+  const auto shape = x.canonical_shape();
+  EXPECT_EQ(shape, CANONICAL_SHAPE);
+  auto buffer = std::vector<float>(shape[0] * shape[1] * shape[2], 7);
+  x.canonicalize_into(buffer.data());
+  const auto canonical = x.canonicalized();
+  EXPECT_EQ(buffer, std::vector<float>(canonical.data(),
+                                       canonical.data() + canonical.size()));
+}
+
+// Plain minimax to check the solver against. Returns 1 if the player to move
+// wins, -1 if they lose, and 0 for a draw.
+int minimax(const GameState& gs) {
+  const auto scores = gs.scores();
+  if (scores.has_value()) {
+    if ((*scores)(2) == 1) {
+      return 0;
+    }
+    return (*scores)(gs.current_player()) == 1 ? 1 : -1;
+  }
+  const auto valids = gs.valid_moves();
+  auto best = -1;
+  for (auto m = 0U; m < gs.num_moves(); ++m) {
+    if (valids(m) == 1) {
+      auto next = gs.copy();
+      next->play_move(m);
+      best = std::max(best, -minimax(*next));
+    }
+  }
+  return best;
+}
+
+// NOLINTNEXTLINE
+TEST(Connect4GS, Solve) {
+  EXPECT_EQ(Connect4GS{}.solve(10), std::nullopt);
+
+  // Player 0 wins by finishing the bottom row.
+  auto board = SizedTensor<int8_t, Eigen::Sizes<2, HEIGHT, WIDTH>>{};
+  board.setZero();
+  for (auto w = 0; w < 3; ++w) {
+    board(0, HEIGHT - 1, w) = 1;
+    board(1, HEIGHT - 2, w) = 1;
+  }
+  const auto win = Connect4GS{board, 0, 6};
+  auto expected = std::optional<SizedVector<float, 3>>{};
+  expected = {1, 0, 0};
+  EXPECT_EQ(win.solve(WIDTH * HEIGHT), expected);
+  EXPECT_EQ(win.solve(WIDTH * HEIGHT - 7), std::nullopt);
+
+  // Player 1 is too late to block, since player 0 has two ways to win.
+  board.setZero();
+  for (auto w = 1; w < 4; ++w) {
+    board(0, HEIGHT - 1, w) = 1;
+  }
+  board(1, HEIGHT - 2, 2) = 1;
+  board(1, HEIGHT - 2, 3) = 1;
+  const auto fork = Connect4GS{board, 1, 5};
+  expected = {1, 0, 0};
+  EXPECT_EQ(fork.solve(WIDTH * HEIGHT), expected);
+
+  // Random late positions match a full minimax.
+  auto re = std::mt19937_64{3};
+  auto checked = 0;
+  while (checked < 20) {
+    auto gs = Connect4GS{};
+    auto empty = WIDTH * HEIGHT;
+    while (empty > 9 && !gs.scores().has_value()) {
+      const auto valids = gs.valid_moves();
+      auto m = re() % WIDTH;
+      while (valids(m) == 0) {
+        m = re() % WIDTH;
+      }
+      gs.play_move(m);
+      --empty;
+    }
+    if (gs.scores().has_value()) {
+      continue;
+    }
+    const auto solved = gs.solve(9);
+    ASSERT_TRUE(solved.has_value());
+    const auto value = minimax(gs);
+    const auto cp = gs.current_player();
+    if (value == 0) {
+      EXPECT_EQ((*solved)(2), 1) << gs.dump();
+    } else if (value == 1) {
+      EXPECT_EQ((*solved)(cp), 1) << gs.dump();
+    } else {
+      EXPECT_EQ((*solved)((cp + 1) % 2), 1) << gs.dump();
+    }
+    ++checked;
+  }
+}
+
+// Golden values were recorded from the tensor based implementation that the
+// bitboards replaced.
+// NOLINTNEXTLINE
+TEST(Connect4GS, Perft) {
+  const auto gs = Connect4GS{};
+  EXPECT_EQ(perft(gs, 1), 7);
+  EXPECT_EQ(perft(gs, 4), 2401);
+  EXPECT_EQ(perft(gs, 7), 823536);
+}
+
+// NOLINTNEXTLINE
+TEST(Connect4GS, PlayoutDigest) {
+  EXPECT_EQ(playout_digest(Connect4GS{}, 500, 42), 0xd729ab0fe5b35c6d);
+}
+
 }  // namespace
 }  // namespace alphazero::connect4_gs
\ No newline at end of file
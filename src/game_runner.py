@@ -2,7 +2,6 @@ import glob
 import os
 from collections import namedtuple
 import math
-import random
 import time
 import torch
 from torch.utils.data import TensorDataset, ConcatDataset, DataLoader
@@ -39,8 +38,29 @@ WINDOW_SIZE_BETA = 0.7  # This decides the rough overall slope.
 WINDOW_SIZE_SCALAR = 6  # This ends up being approximately first time history doesn't grow
 
 RESULT_WORKERS = 2
+# Merges identical self play positions, averaging their targets, before they are saved.
+# This is the max number of unique positions held per iteration. 0 disables it.
+# Merged samples get a w history column with the number of samples they represent.
+HISTORY_DEDUP_CAPACITY = 0
+# Leaves that end within this many moves are solved exactly instead of sent to the network.
+# Only games with a solver (currently Connect4) use it. 0 disables it.
+# Solve time shows up as the solve stage of the play stats.
+SOLVER_MAX_MOVES = 0
 DATA_WORKERS = os.cpu_count() - 1
+# Set to an int to make resampling history reproducible.
+RESAMPLE_SEED = None
+# Set to an int to make game play reproducible.
+# Each game gets its own random streams, so it plays the same regardless of thread scheduling.
+PLAY_SEED = None
 USE_CUDA = torch.cuda.is_available()
+# Print per stage latency histograms after every set of games.
+# Useful to tell if play is bound by MCTS, the queues, or inference.
+PRINT_PLAY_STATS = False
+# Set above 0 to record a timeline of every thread while playing games.
+# It is saved as Chrome trace event json that can be opened in https://ui.perfetto.dev
+# This is the number of events kept per thread. Only the newest are kept.
+TRACE_EVENTS_PER_THREAD = 0
+TRACE_LOCATION = os.path.join('data', 'trace')
 
 # The traditional alphazero parameters.
 EXPECTED_OPENING_LENGTH = 10
@@ -60,6 +80,10 @@ SELF_PLAY_CHUNKS = 4
 
 # This generally should be as big as can fit on your gpu.
 TRAIN_BATCH_SIZE = 1024
+# Training batches are sampled from the history window by native worker threads.
+# This is how many batches can be ready before the network consumes them.
+TRAIN_PREFETCH_DEPTH = 4
+TRAIN_SAMPLE_WORKERS = 2
 # Note: If the game has a high number of symetries generated, this number should likely get lowered.
 TRAIN_SAMPLE_RATE = 1
 
@@ -150,6 +174,9 @@ class GameRunner:
             self.args.data_save_size, self.num_players+1)
         self.hist_pi = torch.zeros(
             self.args.data_save_size, self.args.game.NUM_MOVES())
+        self.hist_w = None
+        if self.pm.params().history_dedup_capacity > 0:
+            self.hist_w = torch.zeros(self.args.data_save_size)
         shape = (self.args.max_batch_size, cs[0], cs[1], cs[2])
         self.batches = []
         self.v = []
@@ -203,6 +230,11 @@ class GameRunner:
         monitor.join()
         if self.pm.params().history_enabled:
             hist_saver.join()
+        if self.pm.params().trace_capacity > 0:
+            os.makedirs(TRACE_LOCATION, exist_ok=True)
+            title = self.args.title.replace(' ', '_')
+            self.pm.dump_trace(os.path.join(
+                TRACE_LOCATION, f'{self.args.iteration:04d}-{title}.json'))
 
     def monitor(self):
         last_completed = 0
@@ -228,9 +260,19 @@ class GameRunner:
                     for i in range(len(scores)):
                         win_rates[i] = scores[i]/completed
                 win_rates = list(map(lambda x: f'{x:0.3f}', win_rates))
-                pbar.set_postfix({
+                stats = self.pm.stats()
+                postfix = {
                     'win rates': win_rates,
-                    'cache rate': hr})
+                    'cache rate': hr,
+                    'sims/s': int(stats['process_result']['per_second']),
+                    'leaf us': f"{stats['find_leaf']['p50_us']:0.1f}",
+                    'infer ms': f"{stats['inference_latency']['p50_us']/1000:0.1f}/{stats['inference_latency']['p99_us']/1000:0.1f}",
+                    'move ms': f"{stats['move_decision']['p50_us']/1000:0.1f}"}
+                solver_calls = self.pm.solver_calls()
+                if solver_calls > 0:
+                    postfix['solve rate'] = f'{self.pm.solver_hits()/solver_calls:0.3f}'
+                    postfix['solve us'] = f"{stats['solve']['p50_us']:0.1f}"
+                pbar.set_postfix(postfix)
                 pbar.update(completed-last_completed)
                 last_completed = completed
                 last_update = time.time()
@@ -250,6 +292,8 @@ class GameRunner:
             'cache hit': hr})
         pbar.update(n - last_completed)
         pbar.close()
+        if PRINT_PLAY_STATS:
+            print_play_stats(self.args.title, self.pm.stats())
 
     def batch_builder(self, player):
         while (self.pm.remaining_games() > 0):
@@ -272,8 +316,10 @@ class GameRunner:
                     timeout=1)
             except queue.Empty:
                 continue
+            start = self.pm.trace_now()
             self.v[batch_index], self.pi[batch_index] = self.players[batch_index %
                                                                      self.num_players].process(batch)
+            self.pm.trace_span('inference', 'process', start)
             self.result_queue.put((batch_index, game_indices))
 
     def result_processor(self):
@@ -299,7 +345,7 @@ class GameRunner:
         os.makedirs(self.args.data_folder, exist_ok=True)
         while (self.pm.remaining_games() > 0 or self.pm.hist_count() > 0):
             size = self.pm.build_history_batch(
-                self.hist_canonical, self.hist_v, self.hist_pi)
+                self.hist_canonical, self.hist_v, self.hist_pi, self.hist_w)
             if size == 0:
                 continue
 
@@ -313,10 +359,76 @@ class GameRunner:
             c_tensor[:] = self.hist_canonical[:size]
             v_tensor[:] = self.hist_v[:size]
             p_tensor[:] = self.hist_pi[:size]
+            if self.hist_w is not None:
+                w_tensor = torch.FloatTensor(torch.FloatStorage.from_file(
+                    os.path.join(f'{self.args.data_folder}', f'{self.args.iteration:04d}-{batch:04d}-w-{size}.pt'), shared=True, size=size))
+                w_tensor[:] = self.hist_w[:size]
             self.saved_samples += size
             batch += 1
 
 
+def print_play_stats(title, stats):
+    # Prints the latency of each stage of play to show what a run was bound by.
+    print(f'{title} stats over {stats["elapsed_seconds"]:0.1f}s:')
+    for name, stage in stats.items():
+        if name == 'elapsed_seconds':
+            continue
+        print(f'  {name:>20}: {stage["count"]:>10} ({stage["per_second"]:>9.1f}/s) '
+              f'mean {stage["mean_us"]:>9.1f}us p50 {stage["p50_us"]:>9.1f}us '
+              f'p90 {stage["p90_us"]:>9.1f}us p99 {stage["p99_us"]:>9.1f}us max {stage["max_us"]:>9.1f}us')
+
+
+def history_columns(Game, weighted=False):
+    # The floats per sample of each history shard file.
+    cs = Game.CANONICAL_SHAPE()
+    columns = [('canonical', cs[0]*cs[1]*cs[2]),
+               ('v', Game.NUM_PLAYERS()+1), ('pi', Game.NUM_MOVES())]
+    if weighted:
+        columns.append(('w', 1))
+    return columns
+
+
+class ReplayBatches:
+    # Endlessly yields sampled (canonical, v, pi) training batches from the history window.
+    # With history dedup, merged positions are sampled in proportion to how many plays they stand for.
+    # The yielded tensors are reused, so they are only valid until the next batch is requested.
+    def __init__(self, Game, batch_size, location=HIST_LOCATION, prefetch_depth=TRAIN_PREFETCH_DEPTH, workers=TRAIN_SAMPLE_WORKERS, cuda=USE_CUDA, weighted=HISTORY_DEDUP_CAPACITY > 0):
+        cs = Game.CANONICAL_SHAPE()
+        self.rb = alphazero.ReplayBuffer(
+            location, history_columns(Game, weighted=weighted), batch_size, prefetch_depth, workers)
+        self.buffers = []
+        for slot in range(prefetch_depth):
+            c = torch.zeros((batch_size, cs[0], cs[1], cs[2]))
+            v = torch.zeros((batch_size, Game.NUM_PLAYERS()+1))
+            pi = torch.zeros((batch_size, Game.NUM_MOVES()))
+            if cuda:
+                c = c.pin_memory()
+                v = v.pin_memory()
+                pi = pi.pin_memory()
+            self.buffers.append((c, v, pi))
+            buffers = [c.numpy(), v.numpy(), pi.numpy()]
+            if weighted:
+                # The weights are already applied by sampling, so they are not yielded.
+                buffers.append(torch.zeros(batch_size).numpy())
+            self.rb.set_buffers(slot, buffers)
+
+    def set_window(self, first_iteration, last_iteration):
+        # Returns the number of samples in the window.
+        return self.rb.set_window(first_iteration, last_iteration)
+
+    def __iter__(self):
+        if self.rb.size() == 0:
+            return
+        while True:
+            slot = self.rb.pop_batch()
+            if slot is None:
+                continue
+            try:
+                yield self.buffers[slot]
+            finally:
+                self.rb.release_batch(slot)
+
+
 class RandPlayer:
     def __init__(self, game, max_batch_size):
         self.v = torch.full(
@@ -343,6 +455,9 @@ def base_params(Game, start_temp, bs, cb):
     params.max_batch_size = bs
     params.concurrent_games = bs * cb
     params.fpu_reduction = FPU_REDUCTION
+    params.solver_max_moves = SOLVER_MAX_MOVES
+    params.trace_capacity = TRACE_EVENTS_PER_THREAD
+    params.seed = PLAY_SEED
     return params
 
 
@@ -380,7 +495,7 @@ if __name__ == '__main__':
     def calc_hist_size(i):
         return int(WINDOW_SIZE_SCALAR*(1 + WINDOW_SIZE_BETA*(((i+1)/WINDOW_SIZE_SCALAR)**WINDOW_SIZE_ALPHA-1)/WINDOW_SIZE_ALPHA))
 
-    def maybe_save(Game, c, v, p, size, batch, iteration, location=HIST_LOCATION, name='', force=False):
+    def maybe_save(Game, c, v, p, size, batch, iteration, location=HIST_LOCATION, name='', force=False, w=None):
         cs = Game.CANONICAL_SHAPE()
         if size == HIST_SIZE or (force and size > 0):
             c_tensor = torch.FloatTensor(torch.FloatStorage.from_file(
@@ -392,6 +507,10 @@ if __name__ == '__main__':
             c_tensor[:] = c[:size]
             v_tensor[:] = v[:size]
             p_tensor[:] = p[:size]
+            if w is not None:
+                w_tensor = torch.FloatTensor(torch.FloatStorage.from_file(
+                    os.path.join(f'{location}', f'{iteration:04d}-{batch:04d}{name}-w-{size}.pt'), shared=True, size=size))
+                w_tensor[:] = w[:size]
             return True
         return False
 
@@ -406,6 +525,9 @@ if __name__ == '__main__':
             glob.glob(os.path.join(f'{TMP_HIST_LOCATION}', f'{iteration:04d}-*-v-*.pt')))
         p_names = sorted(
             glob.glob(os.path.join(f'{TMP_HIST_LOCATION}', f'{iteration:04d}-*-pi-*.pt')))
+        w_names = sorted(
+            glob.glob(os.path.join(f'{TMP_HIST_LOCATION}', f'{iteration:04d}-*-w-*.pt')))
+        weighted = len(w_names) > 0
 
         datasets = []
         for j in range(len(c_names)):
@@ -417,8 +539,14 @@ if __name__ == '__main__':
                 v_names[j], shared=False, size=size*(Game.NUM_PLAYERS()+1))).reshape(size, Game.NUM_PLAYERS()+1)
             p_tensor = torch.FloatTensor(torch.FloatStorage.from_file(
                 p_names[j], shared=False, size=size*(Game.NUM_MOVES()))).reshape(size, Game.NUM_MOVES())
-            datasets.append(TensorDataset(c_tensor, v_tensor, p_tensor))
-            del c_tensor, v_tensor, p_tensor
+            if weighted:
+                w_tensor = torch.FloatTensor(torch.FloatStorage.from_file(
+                    w_names[j], shared=False, size=size))
+            else:
+                w_tensor = torch.ones(size)
+            datasets.append(TensorDataset(
+                c_tensor, v_tensor, p_tensor, w_tensor))
+            del c_tensor, v_tensor, p_tensor, w_tensor
 
         dataset = ConcatDataset(datasets)
         sample_count = len(dataset)
@@ -435,28 +563,31 @@ if __name__ == '__main__':
             HIST_SIZE, Game.NUM_PLAYERS()+1)
         p_out = torch.zeros(
             HIST_SIZE, Game.NUM_MOVES())
+        w_out = torch.zeros(HIST_SIZE) if weighted else None
 
         for i in tqdm.trange(sample_count, desc='Creating Symmetric Samples', leave=False):
-            c, v, pi = dataset[i]
+            c, v, pi, w = dataset[i]
             ph = alphazero.PlayHistory(c, v, pi)
             syms = new_game().symmetries(ph)
             for sym in syms:
                 c_out[i_out] = torch.from_numpy(np.array(sym.canonical()))
                 v_out[i_out] = torch.from_numpy(np.array(sym.v()))
                 p_out[i_out] = torch.from_numpy(np.array(sym.pi()))
+                if weighted:
+                    w_out[i_out] = w
                 i_out += 1
-                if maybe_save(Game, c_out, v_out, p_out, i_out, batch_out, iteration, location=TMP_HIST_LOCATION, name='syms'):
+                if maybe_save(Game, c_out, v_out, p_out, i_out, batch_out, iteration, location=TMP_HIST_LOCATION, name='syms', w=w_out):
                     i_out = 0
                     batch_out += 1
-            del c, v, pi, ph, syms
+            del c, v, pi, w, ph, syms
         maybe_save(Game, c_out, v_out, p_out, i_out,
-                   batch_out, iteration, location=TMP_HIST_LOCATION, name='syms', force=True)
+                   batch_out, iteration, location=TMP_HIST_LOCATION, name='syms', force=True, w=w_out)
 
         del datasets, dataset, dataloader
-        del c_out, v_out, p_out
+        del c_out, v_out, p_out, w_out
 
         gc.collect()
-        for fn in c_names + v_names + p_names:
+        for fn in c_names + v_names + p_names + w_names:
             os.remove(fn)
 
     def resample_by_surprise(Game, iteration):
@@ -472,16 +603,17 @@ if __name__ == '__main__':
         p_names = sorted(
             glob.glob(os.path.join(f'{TMP_HIST_LOCATION}', f'{iteration:04d}-*-pi-*.pt')))
 
+        # Shards are mapped instead of loaded so the iteration never has to fit in RAM.
         datasets = []
         for j in range(len(c_names)):
             size = int(c_names[j].split('-')[-1].split('.')[0])
             cs = Game.CANONICAL_SHAPE()
             c_tensor = torch.FloatTensor(torch.FloatStorage.from_file(
-                c_names[j], shared=False, size=size*cs[0]*cs[1]*cs[2])).reshape(size, cs[0], cs[1], cs[2])
+                c_names[j], shared=True, size=size*cs[0]*cs[1]*cs[2])).reshape(size, cs[0], cs[1], cs[2])
             v_tensor = torch.FloatTensor(torch.FloatStorage.from_file(
-                v_names[j], shared=False, size=size*(Game.NUM_PLAYERS()+1))).reshape(size, Game.NUM_PLAYERS()+1)
+                v_names[j], shared=True, size=size*(Game.NUM_PLAYERS()+1))).reshape(size, Game.NUM_PLAYERS()+1)
             p_tensor = torch.FloatTensor(torch.FloatStorage.from_file(
-                p_names[j], shared=False, size=size*(Game.NUM_MOVES()))).reshape(size, Game.NUM_MOVES())
+                p_names[j], shared=True, size=size*(Game.NUM_MOVES()))).reshape(size, Game.NUM_MOVES())
             datasets.append(TensorDataset(c_tensor, v_tensor, p_tensor))
             del c_tensor, v_tensor, p_tensor
 
@@ -494,54 +626,19 @@ if __name__ == '__main__':
         nn = neural_net.NNWrapper.load_checkpoint(
             Game, CHECKPOINT_LOCATION, f'{iteration:04d}-{run_name}.pt')
         loss = nn.sample_loss(dataloader, sample_count)
-        total_loss = np.sum(loss)
 
-        i_out = 0
-        batch_out = 0
-        cs = Game.CANONICAL_SHAPE()
-        c_out = torch.zeros(
-            HIST_SIZE, cs[0], cs[1], cs[2])
-        v_out = torch.zeros(
-            HIST_SIZE, Game.NUM_PLAYERS()+1)
-        p_out = torch.zeros(
-            HIST_SIZE, Game.NUM_MOVES())
-        os.makedirs(HIST_LOCATION, exist_ok=True)
+        del datasets, dataset, dataloader, nn
+        gc.collect()
 
         # Clear old history for iteration before saving new history.
-        gc.collect()
+        os.makedirs(HIST_LOCATION, exist_ok=True)
         for fn in glob.glob(os.path.join(f'{HIST_LOCATION}', f'{iteration:04d}-*.pt')):
             os.remove(fn)
 
-        for i in tqdm.trange(sample_count, desc='Resampling Data', leave=False):
-            sample_weight = 0.5 + (loss[i]/total_loss) * 0.5 * sample_count
-            for _ in range(math.floor(sample_weight)):
-                c, v, pi = dataset[i]
-                c_out[i_out] = c
-                v_out[i_out] = v
-                p_out[i_out] = pi
-                i_out += 1
-                if maybe_save(Game, c_out, v_out, p_out, i_out, batch_out, iteration):
-                    i_out = 0
-                    batch_out += 1
-                del c, v, pi
-            if random.random() < sample_weight - math.floor(sample_weight):
-                c, v, pi = dataset[i]
-                c_out[i_out] = c
-                v_out[i_out] = v
-                p_out[i_out] = pi
-                i_out += 1
-                if maybe_save(Game, c_out, v_out, p_out, i_out, batch_out, iteration):
-                    i_out = 0
-                    batch_out += 1
-                del c, v, pi
+        # The losses are in the same shard order as the glob above.
+        alphazero.resample_by_surprise(TMP_HIST_LOCATION, HIST_LOCATION, iteration, history_columns(
+            Game, weighted=HISTORY_DEDUP_CAPACITY > 0), loss, HIST_SIZE, DATA_WORKERS, seed=RESAMPLE_SEED)
 
-        maybe_save(Game, c_out, v_out, p_out, i_out,
-                   batch_out, iteration, force=True)
-
-        del datasets, dataset, dataloader, nn
-        del c_out, v_out, p_out
-
-        gc.collect()
         for fn in glob.glob(os.path.join(f'{TMP_HIST_LOCATION}', '*')):
             os.remove(fn)
 
@@ -579,31 +676,9 @@ if __name__ == '__main__':
         return v_loss, pi_loss
 
     def train(Game, iteration, hist_size, run, total_train_steps):
-        total_size = 0
-        datasets = []
-        for i in range(max(0, iteration - hist_size), iteration + 1):
-            c = sorted(glob.glob(os.path.join(
-                f'{HIST_LOCATION}', f'{i:04d}-*-canonical-*.pt')))
-            v = sorted(glob.glob(os.path.join(
-                f'{HIST_LOCATION}', f'{i:04d}-*-v-*.pt')))
-            p = sorted(glob.glob(os.path.join(
-                f'{HIST_LOCATION}', f'{i:04d}-*-pi-*.pt')))
-            for j in range(len(c)):
-                size = int(c[j].split('-')[-1].split('.')[0])
-                total_size += size
-                cs = Game.CANONICAL_SHAPE()
-                c_tensor = torch.FloatTensor(torch.FloatStorage.from_file(
-                    c[j], shared=False, size=size*cs[0]*cs[1]*cs[2])).reshape(size, cs[0], cs[1], cs[2])
-                v_tensor = torch.FloatTensor(torch.FloatStorage.from_file(
-                    v[j], shared=False, size=size*(Game.NUM_PLAYERS()+1))).reshape(size, Game.NUM_PLAYERS()+1)
-                p_tensor = torch.FloatTensor(torch.FloatStorage.from_file(
-                    p[j], shared=False, size=size*(Game.NUM_MOVES()))).reshape(size, Game.NUM_MOVES())
-                datasets.append(TensorDataset(c_tensor, v_tensor, p_tensor))
-                del c_tensor, v_tensor, p_tensor
-
         bs = TRAIN_BATCH_SIZE
-        dataset = ConcatDataset(datasets)
-        dataloader = DataLoader(dataset, batch_size=bs, shuffle=True)
+        total_size = replay_batches.set_window(
+            max(0, iteration - hist_size), iteration)
 
         average_generation = total_size/min(hist_size, iteration+1)
         nn = neural_net.NNWrapper.load_checkpoint(
@@ -611,11 +686,11 @@ if __name__ == '__main__':
         steps_to_train = int(
             math.ceil(average_generation/bs*TRAIN_SAMPLE_RATE))
         v_loss, pi_loss = nn.train(
-            dataloader, steps_to_train, run, iteration, total_train_steps)
+            replay_batches, steps_to_train, run, iteration, total_train_steps)
         total_train_steps += steps_to_train
         nn.save_checkpoint(CHECKPOINT_LOCATION,
                            f'{iteration+1:04d}-{run_name}.pt')
-        del datasets, dataset, dataloader, nn
+        del nn
         return v_loss, pi_loss, total_train_steps
 
     def self_play(Game, best, iteration, depth, fast_depth):
@@ -628,6 +703,7 @@ if __name__ == '__main__':
         params.tree_reuse = False
         params.self_play = True
         params.history_enabled = True
+        params.history_dedup_capacity = HISTORY_DEDUP_CAPACITY
         params.add_noise = True
         params.playout_cap_randomization = True
         params.playout_cap_depth = fast_depth
@@ -674,8 +750,11 @@ if __name__ == '__main__':
         if total > 0:
             hr = hits/total
         agl = pm.avg_game_length()
+        dedup_ratio = 1
+        if pm.dedup_samples_in() > 0:
+            dedup_ratio = pm.dedup_samples_out()/pm.dedup_samples_in()
         del pm, nn
-        return win_rates, hr, agl, resign_win_rates, resign_rate
+        return win_rates, hr, agl, resign_win_rates, resign_rate, dedup_ratio
 
     def play_past(Game, depth, iteration, past_iter):
         nn_rate = 0
@@ -821,6 +900,8 @@ if __name__ == '__main__':
 
     total_agents = iters+1  # + base
 
+    replay_batches = ReplayBatches(Game, TRAIN_BATCH_SIZE)
+
     nnargs = neural_net.NNArgs(
         num_channels=channels, depth=depth, lr_milestone=lr_milestone, dense_net=dense_net, kernel_size=kernel_size)
 
@@ -903,7 +984,7 @@ if __name__ == '__main__':
             pbar.set_postfix(postfix)
             np.savetxt(os.path.join('data', 'elo.csv'), elo, delimiter=',')
 
-            win_rates, hit_rate, game_length, resign_win_rates, resignation_rate = self_play(
+            win_rates, hit_rate, game_length, resign_win_rates, resignation_rate, dedup_ratio = self_play(
                 Game, current_best, i, nn_selfplay_mcts_depth, nn_selfplay_fast_mcts_depth)
             for j in range(len(win_rates)-1):
                 run.track(win_rates[j], name='win_rate',
@@ -921,6 +1002,10 @@ if __name__ == '__main__':
                       epoch=i, step=total_train_steps, context={'vs': f'self'})
             run.track(game_length, name='average_game_length',
                       epoch=i, step=total_train_steps, context={'vs': f'self'})
+            if HISTORY_DEDUP_CAPACITY > 0:
+                run.track(dedup_ratio, name='dedup_ratio',
+                          epoch=i, step=total_train_steps, context={'vs': f'self'})
+                postfix['dedup'] = f'{dedup_ratio:0.3f}'
             postfix['win_rates'] = list(map(lambda x: f'{x:0.3f}', win_rates))
             pbar.set_postfix(postfix)
             gc.collect()
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <optional>
 #include <typeindex>
+#include <vector>
 
 #include "absl/hash/hash.h"
 #include "dll_export.h"
@@ -15,6 +18,8 @@ struct PlayHistory {
   Tensor<float, 3> canonical;
   Vector<float> v;
   Vector<float> pi;
+  // How many samples this represents if identical positions were merged.
+  float weight = 1;
 };
 
 // GameState is the core class to represent games to be played by AlphaZero. It
@@ -41,8 +46,19 @@ class WEAKDLLEXPORT GameState {
 
   void virtual hash(absl::HashState h) const = 0;
 
+  // A 64-bit hash of everything operator== compares, used to key caches.
+  // Games should keep it updated in play_move so this is O(1), and equal
+  // states must have equal fingerprints. By default it is computed from
+  // hash().
+  [[nodiscard]] virtual uint64_t fingerprint() const noexcept;
+
   // Randomize the start state of a game. For most games this does nothing.
   virtual void randomize_start() noexcept {};
+  // Same as above, but the start state is a function of seed.
+  virtual void randomize_start(uint64_t seed) noexcept {
+    (void)seed;
+    randomize_start();
+  };
 
   // Returns the current player. Players must be 0 indexed.
   [[nodiscard]] virtual uint8_t current_player() const noexcept = 0;
@@ -60,6 +76,19 @@ class WEAKDLLEXPORT GameState {
   // from this GameState. All values should be 0 or 1.
   [[nodiscard]] virtual Vector<uint8_t> valid_moves() const noexcept = 0;
 
+  // Replaces out with the playable moves in increasing order. Games where
+  // few of the moves are ever playable can override this to skip building
+  // valid_moves.
+  virtual void legal_moves(std::vector<uint32_t>& out) const {
+    const auto valids = valid_moves();
+    out.clear();
+    for (auto m = 0U; m < valids.size(); ++m) {
+      if (valids(m) == 1) {
+        out.push_back(m);
+      }
+    }
+  }
+
   // Plays a move, modifying the current GameState.
   virtual void play_move(uint32_t move) = 0;
 
@@ -71,9 +100,33 @@ class WEAKDLLEXPORT GameState {
   [[nodiscard]] virtual std::optional<Vector<float>> scores()
       const noexcept = 0;
 
+  // Returns the result of the game with perfect play, encoded like scores.
+  // Returns nullopt if the game could last more than max_moves more moves, or
+  // if the game has no exact solver. For most games this is always nullopt.
+  [[nodiscard]] virtual std::optional<Vector<float>> solve(
+      uint32_t max_moves) const noexcept {
+    (void)max_moves;
+    return std::nullopt;
+  }
+
   // Returns the canonicalized form of the board, ready for feeding to a NN.
   [[nodiscard]] virtual Tensor<float, 3> canonicalized() const noexcept = 0;
 
+  // Returns the dimensions of canonicalized().
+  [[nodiscard]] virtual std::array<int, 3> canonical_shape() const noexcept {
+    const auto dims = canonicalized().dimensions();
+    return {static_cast<int>(dims[0]), static_cast<int>(dims[1]),
+            static_cast<int>(dims[2])};
+  }
+
+  // Writes canonicalized() into out, which must hold canonical_shape() floats
+  // in row major order. Games should override this and canonical_shape() so
+  // callers can reuse their buffers instead of allocating a tensor per call.
+  virtual void canonicalize_into(float* out) const noexcept {
+    const auto canonical = canonicalized();
+    std::copy(canonical.data(), canonical.data() + canonical.size(), out);
+  }
+
   // Returns the number of symmetries the game has.
   [[nodiscard]] virtual uint8_t num_symmetries() const noexcept = 0;
 
@@ -89,20 +142,37 @@ class WEAKDLLEXPORT GameState {
   virtual void minimize_storage() = 0;
 };
 
+// Keys caches by fingerprint. The fingerprint is read once when the key is
+// made, and the full operator== only runs when fingerprints match.
 struct GameStateKeyWrapper {
-  GameStateKeyWrapper(std::shared_ptr<GameState> gs) : gs(gs) {}
+  GameStateKeyWrapper(std::shared_ptr<GameState> gs)
+      : gs(gs), fingerprint(gs->fingerprint()) {}
   std::shared_ptr<GameState> gs;
+  uint64_t fingerprint;
 };
 template <typename H>
 H AbslHashValue(H h, const GameStateKeyWrapper& wrapper) {
-  h = H::combine(std::move(h), std::type_index(typeid(wrapper.gs.get())));
-  wrapper.gs->hash(absl::HashState::Create(&h));
-  return std::move(h);
+  return H::combine(std::move(h), std::type_index(typeid(wrapper.gs.get())),
+                    wrapper.fingerprint);
 }
 
 bool operator==(const GameStateKeyWrapper& lhs,
                 const GameStateKeyWrapper& rhs) {
-  return *lhs.gs == *rhs.gs;
+  return lhs.fingerprint == rhs.fingerprint && *lhs.gs == *rhs.gs;
+}
+
+// Hashes through GameState::hash for games without their own fingerprint.
+struct GameStateHashWrapper {
+  const GameState& gs;
+};
+template <typename H>
+H AbslHashValue(H h, const GameStateHashWrapper& wrapper) {
+  wrapper.gs.hash(absl::HashState::Create(&h));
+  return h;
+}
+
+inline uint64_t GameState::fingerprint() const noexcept {
+  return absl::Hash<GameStateHashWrapper>{}(GameStateHashWrapper{*this});
 }
 
 // A sample evaluation function for testing.
@@ -0,0 +1,261 @@
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <random>
+
+#include "brandubh_gs.h"
+#include "connect4_gs.h"
+#include "nichess_gs.h"
+#include "nichess_wrapper.h"
+#include "onitama_gs.h"
+#include "opentafl_gs.h"
+#include "photosynthesis_gs.h"
+#include "tawlbwrdd_gs.h"
+
+// Times the GameState primitives used by MCTS for every game.
+// Each is run over a fixed set of mid game positions from seeded random
+// playouts so games are compared on realistic boards instead of the start.
+// items_per_second is the ops/sec of the primitive.
+
+namespace alphazero {
+namespace {
+
+constexpr const auto POSITION_COUNT = 64;
+constexpr const auto PLAYOUT_SEED = 42;
+constexpr const auto MIN_PLAYOUT_MOVES = 4;
+constexpr const auto MAX_PLAYOUT_MOVES = 40;
+
+using Clock = std::chrono::steady_clock;
+
+uint32_t random_valid_move(const GameState& gs, std::mt19937& re) {
+  const auto valids = gs.valid_moves();
+  auto moves = std::vector<uint32_t>{};
+  for (auto m = 0U; m < gs.num_moves(); ++m) {
+    if (valids(m) == 1) {
+      moves.push_back(m);
+    }
+  }
+  return moves[std::uniform_int_distribution<size_t>{0, moves.size() - 1}(re)];
+}
+
+// Positions are cached per game so every primitive sees the same boards.
+template <typename GS>
+const std::vector<std::shared_ptr<GameState>>& positions() {
+  static const auto out = [] {
+    auto re = std::mt19937{PLAYOUT_SEED};
+    auto length = std::uniform_int_distribution<int>{MIN_PLAYOUT_MOVES,
+                                                     MAX_PLAYOUT_MOVES};
+    auto out = std::vector<std::shared_ptr<GameState>>{};
+    while (out.size() < POSITION_COUNT) {
+      auto gs = std::shared_ptr<GameState>{std::make_unique<GS>()};
+      const auto moves = length(re);
+      for (auto i = 0; i < moves && !gs->scores().has_value(); ++i) {
+        gs->play_move(random_valid_move(*gs, re));
+      }
+      // Only keep positions that still have moves to search.
+      if (!gs->scores().has_value()) {
+        out.push_back(std::move(gs));
+      }
+    }
+    return out;
+  }();
+  return out;
+}
+
+template <typename GS>
+void BM_Copy(benchmark::State& state) {
+  const auto& pos = positions<GS>();
+  auto i = 0UL;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(pos[i++ % POSITION_COUNT]->copy());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+template <typename GS>
+void BM_ValidMoves(benchmark::State& state) {
+  const auto& pos = positions<GS>();
+  auto i = 0UL;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(pos[i++ % POSITION_COUNT]->valid_moves());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Copies are made outside the timed region so only the move is measured.
+template <typename GS>
+void BM_PlayMove(benchmark::State& state) {
+  const auto& pos = positions<GS>();
+  auto re = std::mt19937{PLAYOUT_SEED};
+  auto moves = std::vector<uint32_t>{};
+  for (const auto& gs : pos) {
+    moves.push_back(random_valid_move(*gs, re));
+  }
+  auto copies = std::vector<std::unique_ptr<GameState>>(POSITION_COUNT);
+  for (auto _ : state) {
+    for (auto i = 0; i < POSITION_COUNT; ++i) {
+      copies[i] = pos[i]->copy();
+    }
+    const auto start = Clock::now();
+    for (auto i = 0; i < POSITION_COUNT; ++i) {
+      copies[i]->play_move(moves[i]);
+    }
+    benchmark::ClobberMemory();
+    state.SetIterationTime(
+        std::chrono::duration<double>(Clock::now() - start).count());
+  }
+  state.SetItemsProcessed(state.iterations() * POSITION_COUNT);
+}
+
+template <typename GS>
+void BM_Scores(benchmark::State& state) {
+  const auto& pos = positions<GS>();
+  auto i = 0UL;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(pos[i++ % POSITION_COUNT]->scores());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+template <typename GS>
+void BM_Canonicalized(benchmark::State& state) {
+  const auto& pos = positions<GS>();
+  auto i = 0UL;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(pos[i++ % POSITION_COUNT]->canonicalized());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Canonicalizes into a reused buffer, like PlayManager does.
+template <typename GS>
+void BM_CanonicalizeInto(benchmark::State& state) {
+  const auto& pos = positions<GS>();
+  const auto shape = pos[0]->canonical_shape();
+  auto out = std::vector<float>(shape[0] * shape[1] * shape[2]);
+  auto i = 0UL;
+  for (auto _ : state) {
+    pos[i++ % POSITION_COUNT]->canonicalize_into(out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// The sparse move list, reusing one vector like a search would.
+template <typename GS>
+void BM_LegalMoves(benchmark::State& state) {
+  const auto& pos = positions<GS>();
+  auto moves = std::vector<uint32_t>{};
+  auto i = 0UL;
+  for (auto _ : state) {
+    pos[i++ % POSITION_COUNT]->legal_moves(moves);
+    benchmark::DoNotOptimize(moves.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Makes the cache key too, since every cache lookup does.
+template <typename GS>
+void BM_Hash(benchmark::State& state) {
+  const auto& pos = positions<GS>();
+  const auto hasher = absl::Hash<GameStateKeyWrapper>{};
+  auto i = 0UL;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        hasher(GameStateKeyWrapper{pos[i++ % POSITION_COUNT]}));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Compares against an equal copy, the slowest case since nothing differs.
+template <typename GS>
+void BM_Equal(benchmark::State& state) {
+  const auto& pos = positions<GS>();
+  auto copies = std::vector<std::unique_ptr<GameState>>{};
+  for (const auto& gs : pos) {
+    copies.push_back(gs->copy());
+  }
+  auto i = 0UL;
+  for (auto _ : state) {
+    const auto j = i++ % POSITION_COUNT;
+    benchmark::DoNotOptimize(*pos[j] == *copies[j]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+template <typename GS>
+void BM_Symmetries(benchmark::State& state) {
+  const auto& pos = positions<GS>();
+  auto bases = std::vector<PlayHistory>{};
+  for (const auto& gs : pos) {
+    auto ph = PlayHistory{};
+    ph.canonical = gs->canonicalized();
+    ph.v = Vector<float>{gs->num_players() + 1};
+    ph.v.setConstant(1.0 / (gs->num_players() + 1));
+    ph.pi = gs->valid_moves().template cast<float>();
+    ph.pi /= ph.pi.sum();
+    bases.push_back(std::move(ph));
+  }
+  auto i = 0UL;
+  for (auto _ : state) {
+    const auto j = i++ % POSITION_COUNT;
+    benchmark::DoNotOptimize(pos[j]->symmetries(bases[j]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Heap held by a table of per piece type, per square lists.
+template <typename T>
+size_t table_bytes(const std::vector<std::vector<std::vector<T>>>& table) {
+  auto bytes = table.capacity() * sizeof(table[0]);
+  for (const auto& squares : table) {
+    bytes += squares.capacity() * sizeof(squares[0]);
+    for (const auto& list : squares) {
+      bytes += list.capacity() * sizeof(T);
+    }
+  }
+  return bytes;
+}
+
+// Builds the Nichess GameCache and AgentCache. Loading the module used to
+// build them once for every translation unit including nichess_gs.h, so this
+// is what each of those cost at import. Now they are built on first use.
+// table_bytes is the heap of the GameCache move and ability lists.
+void BM_NichessTables(benchmark::State& state) {
+  auto bytes = size_t{0};
+  for (auto _ : state) {
+    auto game_cache = nichess::GameCache();
+    const auto agent_cache = nichess_wrapper::AgentCache(game_cache);
+    benchmark::DoNotOptimize(&agent_cache);
+    bytes = table_bytes(game_cache.pieceTypeToSquareIndexToLegalMoves) +
+            table_bytes(game_cache.pieceTypeToSquareIndexToLegalAbilities);
+  }
+  state.counters["table_bytes"] = static_cast<double>(bytes);
+  state.SetItemsProcessed(state.iterations());
+}
+
+#define GAME_STATE_BENCHMARKS(GS)                       \
+  BENCHMARK_TEMPLATE(BM_Copy, GS);                      \
+  BENCHMARK_TEMPLATE(BM_ValidMoves, GS);                \
+  BENCHMARK_TEMPLATE(BM_LegalMoves, GS);                \
+  BENCHMARK_TEMPLATE(BM_PlayMove, GS)->UseManualTime(); \
+  BENCHMARK_TEMPLATE(BM_Scores, GS);                    \
+  BENCHMARK_TEMPLATE(BM_Canonicalized, GS);             \
+  BENCHMARK_TEMPLATE(BM_CanonicalizeInto, GS);          \
+  BENCHMARK_TEMPLATE(BM_Hash, GS);                      \
+  BENCHMARK_TEMPLATE(BM_Equal, GS);                     \
+  BENCHMARK_TEMPLATE(BM_Symmetries, GS)
+
+GAME_STATE_BENCHMARKS(connect4_gs::Connect4GS);
+GAME_STATE_BENCHMARKS(brandubh_gs::BrandubhGS);
+GAME_STATE_BENCHMARKS(opentafl_gs::OpenTaflGS);
+GAME_STATE_BENCHMARKS(tawlbwrdd_gs::TawlbwrddGS);
+GAME_STATE_BENCHMARKS(onitama_gs::OnitamaGS);
+GAME_STATE_BENCHMARKS(nichess_gs::NichessGS);
+BENCHMARK(BM_NichessTables);
+GAME_STATE_BENCHMARKS(photosynthesis_gs::PhotosynthesisGS<2>);
+GAME_STATE_BENCHMARKS(photosynthesis_gs::PhotosynthesisGS<3>);
+GAME_STATE_BENCHMARKS(photosynthesis_gs::PhotosynthesisGS<4>);
+
+}  // namespace
+}  // namespace alphazero
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "game_state.h"
+
+// Helpers to check that a game implementation behaves identically to an
+// older one. Record the outputs of the old code once, and compare the new
+// code against those golden values in tests.
+
+namespace alphazero {
+
+// Counts the positions reachable in exactly depth moves. Finished games are
+// counted but not expanded.
+inline uint64_t perft(const GameState& gs, uint32_t depth) {
+  if (depth == 0 || gs.scores().has_value()) {
+    return 1;
+  }
+  const auto valids = gs.valid_moves();
+  auto count = uint64_t{0};
+  for (auto m = 0U; m < gs.num_moves(); ++m) {
+    if (valids(m) == 1) {
+      auto next = gs.copy();
+      next->play_move(m);
+      count += perft(*next, depth - 1);
+    }
+  }
+  return count;
+}
+
+// FNV-1a over raw bytes.
+class Digest {
+ public:
+  void add(const void* data, size_t size) noexcept {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    for (auto i = 0UL; i < size; ++i) {
+      value_ = (value_ ^ bytes[i]) * 0x100000001B3ULL;
+    }
+  }
+  template <typename T>
+  void add(const T& x) noexcept {
+    add(&x, sizeof(T));
+  }
+  [[nodiscard]] uint64_t value() const noexcept { return value_; }
+
+ private:
+  uint64_t value_ = 0xCBF29CE484222325ULL;
+};
+
+// Plays seeded random games from gs and digests everything MCTS observes at
+// every position: valid moves, scores, the canonical tensor, the player, and
+// the turn. Games are copied before every move, like a search would.
+inline uint64_t playout_digest(const GameState& gs, uint32_t games,
+                               uint64_t seed) {
+  auto re = std::mt19937_64{seed};
+  auto digest = Digest{};
+  for (auto g = 0U; g < games; ++g) {
+    auto cur = gs.copy();
+    while (true) {
+      digest.add(cur->current_player());
+      digest.add(cur->current_turn());
+      const auto canonical = cur->canonicalized();
+      digest.add(canonical.data(), canonical.size() * sizeof(float));
+      const auto scores = cur->scores();
+      if (scores.has_value()) {
+        digest.add(scores->data(), scores->size() * sizeof(float));
+        break;
+      }
+      const auto valids = cur->valid_moves();
+      digest.add(valids.data(), valids.size());
+      auto moves = std::vector<uint32_t>{};
+      for (auto m = 0U; m < cur->num_moves(); ++m) {
+        if (valids(m) == 1) {
+          moves.push_back(m);
+        }
+      }
+      // Modulo instead of a distribution keeps this portable across
+      // standard libraries.
+      const auto move = moves[re() % moves.size()];
+      cur = cur->copy();
+      cur->play_move(move);
+    }
+  }
+  return digest.value();
+}
+
+}  // namespace alphazero
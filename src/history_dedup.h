@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "game_state.h"
+
+namespace alphazero {
+
+// Merges identical positions in self-play history.
+// Positions are keyed by their GameState fingerprint alone, so only the 8 byte
+// key is kept for each. Two positions merge if their 64 bit fingerprints
+// collide, which is rare enough to not matter for training.
+// A merged sample averages v and pi, and its weight is the total weight of the
+// samples merged into it.
+// Memory is bounded by capacity. Once the table is full, positions that are
+// not already in it pass through unmerged.
+class HistoryDedup {
+ public:
+  explicit HistoryDedup(size_t capacity) : capacity_(capacity) {}
+
+  // fingerprint is GameState::fingerprint of the sample's position.
+  // Returns the sample if it could not be merged and should be kept as is.
+  [[nodiscard]] std::optional<PlayHistory> add(uint64_t fingerprint,
+                                               PlayHistory ph) {
+    std::unique_lock l{m_};
+    ++samples_in_;
+    auto it = table_.find(fingerprint);
+    if (it != table_.end()) {
+      auto& sum = it->second;
+      sum.v += ph.v * ph.weight;
+      sum.pi += ph.pi * ph.weight;
+      sum.weight += ph.weight;
+      return std::nullopt;
+    }
+    if (table_.size() >= capacity_) {
+      ++samples_out_;
+      return ph;
+    }
+    ph.v *= ph.weight;
+    ph.pi *= ph.weight;
+    table_.emplace(fingerprint, std::move(ph));
+    return std::nullopt;
+  }
+
+  // Returns all merged samples and empties the table.
+  [[nodiscard]] std::vector<PlayHistory> flush() {
+    std::unique_lock l{m_};
+    auto out = std::vector<PlayHistory>{};
+    out.reserve(table_.size());
+    for (auto& [_, sum] : table_) {
+      sum.v /= sum.weight;
+      sum.pi /= sum.weight;
+      out.push_back(std::move(sum));
+    }
+    samples_out_ += out.size();
+    table_.clear();
+    return out;
+  }
+
+  [[nodiscard]] size_t size() {
+    std::unique_lock l{m_};
+    return table_.size();
+  }
+  [[nodiscard]] uint64_t samples_in() const noexcept { return samples_in_; }
+  [[nodiscard]] uint64_t samples_out() const noexcept { return samples_out_; }
+
+ private:
+  const size_t capacity_;
+  std::mutex m_;
+  absl::flat_hash_map<uint64_t, PlayHistory> table_;
+  std::atomic<uint64_t> samples_in_ = 0;
+  std::atomic<uint64_t> samples_out_ = 0;
+};
+
+}  // namespace alphazero
@@ -0,0 +1,86 @@
+#include "history_dedup.h"
+
+#include "connect4_gs.h"
+#include "gtest/gtest.h"
+
+namespace alphazero {
+namespace {
+
+using connect4_gs::Connect4GS;
+
+PlayHistory sample(const GameState& gs, float v0, uint32_t move) {
+  auto ph = PlayHistory{gs.canonicalized(), Vector<float>{3},
+                        Vector<float>{gs.num_moves()}};
+  ph.v.setZero();
+  ph.v(0) = v0;
+  ph.v(1) = 1 - v0;
+  ph.pi.setZero();
+  ph.pi(move) = 1;
+  return ph;
+}
+
+// NOLINTNEXTLINE
+TEST(HistoryDedup, MergesIdenticalPositions) {
+  auto dedup = HistoryDedup{10};
+  auto start = Connect4GS{};
+  auto moved = Connect4GS{};
+  moved.play_move(3);
+
+  EXPECT_EQ(dedup.add(start.fingerprint(), sample(start, 1, 3)), std::nullopt);
+  EXPECT_EQ(dedup.add(moved.fingerprint(), sample(moved, 0, 2)), std::nullopt);
+  EXPECT_EQ(dedup.add(start.fingerprint(), sample(start, 0, 4)), std::nullopt);
+  EXPECT_EQ(dedup.add(start.fingerprint(), sample(start, 1, 3)), std::nullopt);
+  EXPECT_EQ(dedup.size(), 2);
+
+  auto merged = dedup.flush();
+  EXPECT_EQ(dedup.size(), 0);
+  EXPECT_EQ(dedup.samples_in(), 4);
+  EXPECT_EQ(dedup.samples_out(), 2);
+  ASSERT_EQ(merged.size(), 2);
+  auto& s = merged[0].weight == 3 ? merged[0] : merged[1];
+  auto& m = merged[0].weight == 3 ? merged[1] : merged[0];
+
+  EXPECT_FLOAT_EQ(s.weight, 3);
+  EXPECT_FLOAT_EQ(s.v(0), 2.0 / 3.0);
+  EXPECT_FLOAT_EQ(s.v(1), 1.0 / 3.0);
+  EXPECT_FLOAT_EQ(s.pi(3), 2.0 / 3.0);
+  EXPECT_FLOAT_EQ(s.pi(4), 1.0 / 3.0);
+  EXPECT_FLOAT_EQ(s.pi.sum(), 1);
+  auto canonical_eq = Tensor<bool, 0>{
+      (s.canonical == start.canonicalized()).all()};
+  EXPECT_TRUE(canonical_eq(0));
+
+  EXPECT_FLOAT_EQ(m.weight, 1);
+  EXPECT_FLOAT_EQ(m.v(0), 0);
+  EXPECT_FLOAT_EQ(m.pi(2), 1);
+}
+
+// NOLINTNEXTLINE
+TEST(HistoryDedup, PassesThroughWhenFull) {
+  auto dedup = HistoryDedup{1};
+  auto start = Connect4GS{};
+  auto moved = Connect4GS{};
+  moved.play_move(3);
+
+  EXPECT_EQ(dedup.add(start.fingerprint(), sample(start, 1, 3)), std::nullopt);
+  // Known positions still merge.
+  EXPECT_EQ(dedup.add(start.fingerprint(), sample(start, 1, 3)), std::nullopt);
+  auto kept = dedup.add(moved.fingerprint(), sample(moved, 0, 2));
+  ASSERT_TRUE(kept.has_value());
+  EXPECT_FLOAT_EQ(kept->weight, 1);
+  EXPECT_FLOAT_EQ(kept->pi(2), 1);
+
+  // Weighted samples stay weighted.
+  auto heavy = sample(start, 0, 3);
+  heavy.weight = 2;
+  EXPECT_EQ(dedup.add(start.fingerprint(), heavy), std::nullopt);
+  auto merged = dedup.flush();
+  ASSERT_EQ(merged.size(), 1);
+  EXPECT_FLOAT_EQ(merged[0].weight, 4);
+  EXPECT_FLOAT_EQ(merged[0].v(0), 0.5);
+  EXPECT_EQ(dedup.samples_in(), 4);
+  EXPECT_EQ(dedup.samples_out(), 2);
+}
+
+}  // namespace
+}  // namespace alphazero
@@ -12,13 +12,25 @@ constexpr const float NOISE_ALPHA_RATIO = 10.83;
 thread_local pcg32 re{pcg_extras::seed_seq_from<std::random_device>{}};
 
 void Node::add_children(const Vector<uint8_t>& valids) noexcept {
+  add_children(valids, re);
+}
+
+void Node::add_children(const Vector<uint8_t>& valids, pcg32& rng) noexcept {
   children.reserve(valids.sum());
   for (auto w = 0; w < valids.size(); ++w) {
     if (valids(w) == 1) {
       children.emplace_back(w);
     }
   }
-  std::shuffle(children.begin(), children.end(), re);
+  std::shuffle(children.begin(), children.end(), rng);
+}
+
+void Node::add_children(const std::vector<uint32_t>& moves, pcg32& rng) {
+  children.reserve(moves.size());
+  for (const auto move : moves) {
+    children.emplace_back(move);
+  }
+  std::shuffle(children.begin(), children.end(), rng);
 }
 
 void Node::update_policy(const Vector<float>& pi) noexcept {
@@ -57,7 +69,8 @@ Node* Node::best_child(float cpuct, float fpu_reduction) noexcept {
 void MCTS::update_root(const GameState& gs, uint32_t move) {
   depth_ = 0;
   if (root_.children.empty()) {
-    root_.add_children(gs.valid_moves());
+    gs.legal_moves(legal_);
+    root_.add_children(legal_, rng_);
   }
   auto x = std::find_if(root_.children.begin(), root_.children.end(),
                         [move](const Node& n) { return n.move == move; });
@@ -67,6 +80,11 @@ void MCTS::update_root(const GameState& gs, uint32_t move) {
   }
   Node tmp = *x;
   root_ = tmp;
+  // A solved root has no policy or visits below it. Search it like a new
+  // position.
+  if (root_.solved) {
+    root_ = Node{move};
+  }
 }
 
 void MCTS::add_root_noise() {
@@ -76,7 +94,7 @@ void MCTS::add_root_noise() {
   auto noise = Vector<float>{num_moves_};
   auto sum = 0.0;
   for (auto& c : root_.children) {
-    noise(c.move) = dist(re);
+    noise(c.move) = dist(rng_);
     sum += noise(c.move);
   }
   for (auto& c : root_.children) {
@@ -95,7 +113,8 @@ std::unique_ptr<GameState> MCTS::find_leaf(const GameState& gs) {
   if (current_->n == 0) {
     current_->player = leaf->current_player();
     current_->scores = leaf->scores();
-    current_->add_children(leaf->valid_moves());
+    leaf->legal_moves(legal_);
+    current_->add_children(legal_, rng_);
   }
   return leaf;
 }
@@ -187,9 +206,13 @@ Vector<float> MCTS::probs(const float temp) const noexcept {
   return probs;
 }
 
-uint32_t MCTS::pick_move(const Vector<float>& p) {
+pcg32 MCTS::random_rng() { return pcg32{re(), re()}; }
+
+uint32_t MCTS::pick_move(const Vector<float>& p) { return pick_move(p, re); }
+
+uint32_t MCTS::pick_move(const Vector<float>& p, pcg32& rng) {
   std::uniform_real_distribution<float> dist{0.0F, 1.0F};
-  auto choice = dist(re);
+  auto choice = dist(rng);
   auto sum = 0.0F;
   for (auto m = 0U; m < p.size(); ++m) {
     sum += p(m);
@@ -7,6 +7,7 @@
 
 #include "dll_export.h"
 #include "game_state.h"
+#include "pcg/pcg_random.hpp"
 #include "shapes.h"
 
 namespace alphazero {
@@ -23,9 +24,15 @@ struct DLLEXPORT Node {
   uint32_t n = 0;
   int8_t player = 0;
   std::optional<Vector<float>> scores = std::nullopt;
+  // The scores came from an exact solver instead of the game ending.
+  bool solved = false;
   std::vector<Node> children{};
 
+  // Children are added in a random order so ties are broken randomly.
   void add_children(const Vector<uint8_t>& valids) noexcept;
+  void add_children(const Vector<uint8_t>& valids, pcg32& rng) noexcept;
+  // Takes the moves in increasing order, like GameState::legal_moves.
+  void add_children(const std::vector<uint32_t>& moves, pcg32& rng);
   void update_policy(const Vector<float>& pi) noexcept;
   [[nodiscard]] float uct(float sqrt_parent_n, float cpuct,
                           float fpu_value) const noexcept;
@@ -34,20 +41,40 @@ struct DLLEXPORT Node {
 
 class DLLEXPORT MCTS {
  public:
+  // rng is the random stream for move ordering and noise. Without one, the
+  // search is randomly seeded.
   MCTS(float cpuct, uint32_t num_players, uint32_t num_moves, float epsilon = 0,
-       float root_policy_temp = 1.4, float fpu_reduction = 0)
+       float root_policy_temp = 1.4, float fpu_reduction = 0,
+       std::optional<pcg32> rng = std::nullopt)
       : cpuct_(cpuct),
         num_players_(num_players),
         num_moves_(num_moves),
         current_(&root_),
         epsilon_(epsilon),
         root_policy_temp_(root_policy_temp),
-        fpu_reduction_(fpu_reduction) {}
+        fpu_reduction_(fpu_reduction),
+        rng_(rng.has_value() ? rng.value() : random_rng()) {}
   void update_root(const GameState& gs, uint32_t move);
   [[nodiscard]] std::unique_ptr<GameState> find_leaf(const GameState& gs);
   void process_result(const GameState& gs, Vector<float>& value,
                       Vector<float>& pi, bool root_noise_enabled = false);
   void add_root_noise();
+  // Whether the last leaf found is a new, unfinished position below the root.
+  // Only these are worth solving.
+  [[nodiscard]] bool leaf_solvable() const noexcept {
+    return current_ != &root_ && current_->n == 0 &&
+           !current_->scores.has_value();
+  }
+  // Sets the exact result of the last leaf found. It is then treated as a
+  // terminal position.
+  void solve_leaf(Vector<float> scores) noexcept {
+    current_->scores = std::move(scores);
+    current_->solved = true;
+  }
+  // Whether the last leaf found already has scores, so it needs no inference.
+  [[nodiscard]] bool leaf_scored() const noexcept {
+    return current_->scores.has_value();
+  }
   [[nodiscard]] Vector<float> root_value() const {
     float q = 0;
     float d = 0;
@@ -68,8 +95,10 @@ class DLLEXPORT MCTS {
   [[nodiscard]] Vector<uint32_t> counts() const noexcept;
   [[nodiscard]] Vector<float> probs(float temp) const noexcept;
   [[nodiscard]] uint32_t depth() const noexcept { return depth_; };
+  [[nodiscard]] const pcg32& rng() const noexcept { return rng_; }
 
   [[nodiscard]] static uint32_t pick_move(const Vector<float>& p);
+  [[nodiscard]] static uint32_t pick_move(const Vector<float>& p, pcg32& rng);
 
  private:
   float cpuct_;
@@ -80,9 +109,14 @@ class DLLEXPORT MCTS {
   Node root_ = Node{};
   Node* current_;
   std::vector<Node*> path_{};
+  // Reused for the legal moves of each expanded node.
+  std::vector<uint32_t> legal_{};
   float epsilon_;
   float root_policy_temp_;
   float fpu_reduction_;
+  pcg32 rng_;
+
+  [[nodiscard]] static pcg32 random_rng();
 };
 
 }  // namespace alphazero
\ No newline at end of file
@@ -0,0 +1,312 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <random>
+
+#if defined __GLIBC__
+#include <malloc.h>
+#include <unistd.h>
+#endif
+
+#include "brandubh_gs.h"
+#include "connect4_gs.h"
+#include "mcts.h"
+#include "nichess_gs.h"
+#include "onitama_gs.h"
+#include "opentafl_gs.h"
+#include "photosynthesis_gs.h"
+#include "tawlbwrdd_gs.h"
+
+// Benchmarks MCTS in isolation from the play manager queues and Python.
+// Every search evaluates leaves with dumb_eval.
+//
+// Allocations are counted by replacing malloc and friends for this binary, so
+// tree memory and allocations per simulation can be reported. Counting below
+// operator new also sees Eigen, whose aligned_malloc calls std::malloc
+// directly, and allocations made inside the mcts and game libraries.
+// Replacing malloc this way needs glibc. Elsewhere the counters stay at 0.
+
+namespace {
+
+std::atomic<uint64_t> allocated_bytes = 0;
+std::atomic<uint64_t> allocation_count = 0;
+std::atomic<int64_t> live_bytes = 0;
+std::atomic<int64_t> peak_live_bytes = 0;
+
+}  // namespace
+
+#if defined __GLIBC__
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* p);
+
+}  // extern "C"
+
+namespace {
+
+// Sizes are read back with malloc_usable_size, so frees can be counted
+// without a header.
+void* count_alloc(void* p) noexcept {
+  if (p == nullptr) {
+    return nullptr;
+  }
+  const auto size = static_cast<int64_t>(malloc_usable_size(p));
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  const auto live =
+      live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+  auto peak = peak_live_bytes.load(std::memory_order_relaxed);
+  while (live > peak && !peak_live_bytes.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed)) {
+  }
+  return p;
+}
+
+void count_free(void* p) noexcept {
+  if (p != nullptr) {
+    live_bytes.fetch_sub(static_cast<int64_t>(malloc_usable_size(p)),
+                         std::memory_order_relaxed);
+  }
+}
+
+}  // namespace
+
+extern "C" {
+
+void* malloc(size_t size) noexcept {
+  return count_alloc(__libc_malloc(size));
+}
+void* calloc(size_t count, size_t size) noexcept {
+  return count_alloc(__libc_calloc(count, size));
+}
+void* realloc(void* p, size_t size) noexcept {
+  count_free(p);
+  auto* out = __libc_realloc(p, size);
+  if (out == nullptr && p != nullptr && size != 0) {
+    // A failed realloc leaves p allocated.
+    count_alloc(p);
+    return nullptr;
+  }
+  return count_alloc(out);
+}
+void* memalign(size_t alignment, size_t size) noexcept {
+  return count_alloc(__libc_memalign(alignment, size));
+}
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+  return memalign(alignment, size);
+}
+int posix_memalign(void** out, size_t alignment, size_t size) noexcept {
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  auto* p = memalign(alignment, size);
+  if (p == nullptr) {
+    return ENOMEM;
+  }
+  *out = p;
+  return 0;
+}
+void* valloc(size_t size) noexcept {
+  return memalign(sysconf(_SC_PAGESIZE), size);
+}
+void* pvalloc(size_t size) noexcept {
+  const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return memalign(page, (size + page - 1) / page * page);
+}
+void free(void* p) noexcept {
+  count_free(p);
+  __libc_free(p);
+}
+
+}  // extern "C"
+
+#endif
+
+namespace alphazero {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A game where every position has the same number of moves and every game
+// lasts the same number of turns. Results are a pseudo random function of
+// the moves played, so trees have realistic value noise.
+class SyntheticGS : public GameState {
+ public:
+  SyntheticGS(uint32_t branching, uint32_t length)
+      : branching_(branching), length_(length) {}
+
+  [[nodiscard]] std::unique_ptr<GameState> copy() const noexcept override {
+    return std::make_unique<SyntheticGS>(*this);
+  }
+  [[nodiscard]] bool operator==(
+      const GameState& other) const noexcept override {
+    const auto* o = dynamic_cast<const SyntheticGS*>(&other);
+    return o != nullptr && o->id_ == id_ && o->turn_ == turn_;
+  }
+  void hash(absl::HashState h) const override {
+    absl::HashState::combine(std::move(h), id_, turn_);
+  }
+  [[nodiscard]] uint8_t current_player() const noexcept override {
+    return turn_ % 2;
+  }
+  [[nodiscard]] uint32_t current_turn() const noexcept override {
+    return turn_;
+  }
+  [[nodiscard]] uint32_t num_moves() const noexcept override {
+    return branching_;
+  }
+  [[nodiscard]] uint8_t num_players() const noexcept override { return 2; }
+  [[nodiscard]] Vector<uint8_t> valid_moves() const noexcept override {
+    auto valids = Vector<uint8_t>{branching_};
+    valids.setOnes();
+    return valids;
+  }
+  void play_move(uint32_t move) override {
+    // splitmix64 of the path so far.
+    id_ += 0x9E3779B97F4A7C15ULL * (move + 1);
+    id_ = (id_ ^ (id_ >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    id_ = (id_ ^ (id_ >> 27)) * 0x94D049BB133111EBULL;
+    id_ ^= id_ >> 31;
+    ++turn_;
+  }
+  [[nodiscard]] std::optional<Vector<float>> scores() const noexcept override {
+    if (turn_ < length_) {
+      return std::nullopt;
+    }
+    auto s = Vector<float>{3};
+    s.setZero();
+    s(id_ % 3) = 1;
+    return s;
+  }
+  [[nodiscard]] Tensor<float, 3> canonicalized() const noexcept override {
+    auto out = Tensor<float, 3>{1, 1, 1};
+    out.setConstant(current_player());
+    return out;
+  }
+  [[nodiscard]] uint8_t num_symmetries() const noexcept override { return 1; }
+  [[nodiscard]] std::vector<PlayHistory> symmetries(
+      const PlayHistory& base) const noexcept override {
+    return {base};
+  }
+  [[nodiscard]] std::string dump() const noexcept override {
+    return std::to_string(id_) + "@" + std::to_string(turn_);
+  }
+  void minimize_storage() override {}
+
+ private:
+  uint32_t branching_;
+  uint32_t length_;
+  uint64_t id_ = 0;
+  uint32_t turn_ = 0;
+};
+
+void search(MCTS& mcts, const GameState& gs, uint32_t sims) {
+  for (auto i = 0U; i < sims; ++i) {
+    auto leaf = mcts.find_leaf(gs);
+    auto [v, pi] = dumb_eval(*leaf);
+    mcts.process_result(gs, v, pi);
+  }
+}
+
+// Runs full searches from gs. Reports simulations/sec and the allocations
+// made per simulation, in bytes as malloc sized them. peak_tree_bytes is the
+// most memory live during a search, which is dominated by the tree.
+void run_search(benchmark::State& state, const GameState& gs, uint32_t sims) {
+  auto bytes = 0UL;
+  auto allocs = 0UL;
+  auto peak = 0L;
+  for (auto _ : state) {
+    state.PauseTiming();
+    const auto start_bytes = allocated_bytes.load();
+    const auto start_allocs = allocation_count.load();
+    const auto start_live = live_bytes.load();
+    peak_live_bytes.store(start_live);
+    state.ResumeTiming();
+    {
+      auto mcts = MCTS{2, gs.num_players(), gs.num_moves()};
+      search(mcts, gs, sims);
+      state.PauseTiming();
+      bytes += allocated_bytes.load() - start_bytes;
+      allocs += allocation_count.load() - start_allocs;
+      peak = std::max(peak, peak_live_bytes.load() - start_live);
+    }
+    state.ResumeTiming();
+  }
+  const auto total_sims = static_cast<double>(state.iterations()) * sims;
+  state.counters["sims_per_second"] =
+      benchmark::Counter(total_sims, benchmark::Counter::kIsRate);
+  state.counters["bytes_per_sim"] = bytes / total_sims;
+  state.counters["allocs_per_sim"] = allocs / total_sims;
+  state.counters["peak_tree_bytes"] = peak;
+}
+
+// Times moving the root to the most visited child of a searched tree.
+void run_update_root(benchmark::State& state, const GameState& gs,
+                     uint32_t sims) {
+  for (auto _ : state) {
+    auto mcts = MCTS{2, gs.num_players(), gs.num_moves()};
+    search(mcts, gs, sims);
+    const auto move = MCTS::pick_move(mcts.probs(0));
+    const auto start = Clock::now();
+    mcts.update_root(gs, move);
+    benchmark::ClobberMemory();
+    state.SetIterationTime(
+        std::chrono::duration<double>(Clock::now() - start).count());
+  }
+}
+
+template <typename GS>
+void BM_Search(benchmark::State& state) {
+  run_search(state, GS{}, state.range(0));
+}
+
+template <typename GS>
+void BM_UpdateRoot(benchmark::State& state) {
+  run_update_root(state, GS{}, state.range(0));
+}
+
+// Args are branching factor, game length, and simulations.
+void BM_SyntheticSearch(benchmark::State& state) {
+  run_search(state, SyntheticGS(state.range(0), state.range(1)),
+             state.range(2));
+}
+
+void BM_SyntheticUpdateRoot(benchmark::State& state) {
+  run_update_root(state, SyntheticGS(state.range(0), state.range(1)),
+                  state.range(2));
+}
+
+#define MCTS_BENCHMARKS(GS)                              \
+  BENCHMARK_TEMPLATE(BM_Search, GS)->Arg(100)->Arg(800); \
+  BENCHMARK_TEMPLATE(BM_UpdateRoot, GS)                  \
+      ->Arg(100)                                         \
+      ->Arg(800)                                         \
+      ->UseManualTime()
+
+MCTS_BENCHMARKS(connect4_gs::Connect4GS);
+MCTS_BENCHMARKS(brandubh_gs::BrandubhGS);
+MCTS_BENCHMARKS(opentafl_gs::OpenTaflGS);
+MCTS_BENCHMARKS(tawlbwrdd_gs::TawlbwrddGS);
+MCTS_BENCHMARKS(onitama_gs::OnitamaGS);
+MCTS_BENCHMARKS(nichess_gs::NichessGS);
+MCTS_BENCHMARKS(photosynthesis_gs::PhotosynthesisGS<2>);
+MCTS_BENCHMARKS(photosynthesis_gs::PhotosynthesisGS<3>);
+MCTS_BENCHMARKS(photosynthesis_gs::PhotosynthesisGS<4>);
+
+BENCHMARK(BM_SyntheticSearch)
+    ->ArgNames({"branching", "length", "sims"})
+    ->ArgsProduct({{2, 8, 32, 256}, {8, 64}, {800}});
+BENCHMARK(BM_SyntheticUpdateRoot)
+    ->ArgNames({"branching", "length", "sims"})
+    ->ArgsProduct({{2, 8, 32, 256}, {64}, {100, 800}})
+    ->UseManualTime();
+
+}  // namespace
+}  // namespace alphazero
@@ -1,11 +1,45 @@
 #include "nichess_gs.h"
 
+#include <algorithm>
+#include <array>
+
 namespace alphazero::nichess_gs {
 
+namespace {
+
+// Lookup tables shared by every NichessGS in the process. They are built on
+// first use rather than when the module loads. The GameCache can't be const
+// because nichess::Game takes it by non-const reference.
+struct alignas(64) Tables {
+  nichess::GameCache gameCache{};
+  const nichess_wrapper::AgentCache agentCache{gameCache};
+};
+
+Tables& tables() {
+  static auto t = Tables{};
+  return t;
+}
+
+}  // namespace
+
+NichessGS::NichessGS()
+    : gameWrapper_(tables().gameCache, tables().agentCache) {
+  sync_from_game();
+}
+
+NichessGS::NichessGS(const std::string encodedBoard)
+    : gameWrapper_(tables().gameCache, tables().agentCache, encodedBoard) {
+  sync_from_game();
+}
+
+// The flat game is copied as is and the library's game is cloned once.
 [[nodiscard]] std::unique_ptr<GameState> NichessGS::copy() const noexcept {
-  auto up = std::make_unique<NichessGS>();
-  up->gameWrapper = std::make_unique<nichess_wrapper::GameWrapper>(gameWrapper);
-  return up;
+  return std::make_unique<NichessGS>(*this);
+}
+
+void NichessGS::sync_from_game() {
+  flat_ = nichess_wrapper::FlatGame::fromGame(gameWrapper_.game);
+  key_ = board_key();
 }
 
 [[nodiscard]] bool NichessGS::operator==(
@@ -14,45 +48,73 @@ namespace alphazero::nichess_gs {
   if (other_cs == nullptr) {
     return false;
   }
-  for(int i = 0; i < WIDTH*HEIGHT; i++) {
-    if(*gameWrapper->game->board[i] != *other_cs->gameWrapper->game->board[i]) {
-      return false;
-    }
-  }
-  return (other_cs->gameWrapper->game->currentPlayer == gameWrapper->game->currentPlayer) &&
-    (other_cs->gameWrapper->game->moveNumber == gameWrapper->game->moveNumber);
+  return flat_.board == other_cs->flat_.board &&
+         flat_.currentPlayer == other_cs->flat_.currentPlayer &&
+         flat_.moveNumber == other_cs->flat_.moveNumber;
 }
 
 void NichessGS::hash(absl::HashState h) const {
-  // TODO: combine_contiguous?
-  nichess::Piece* p;
+  absl::HashState::combine(std::move(h), key_);
+}
+
+// The nichess library applies moves itself, so rather than tracking what a
+// move changed, the key is rebuilt from the board after every move. Each
+// piece gets a Zobrist style key from its square, type, and health.
+[[nodiscard]] uint64_t NichessGS::board_key() const noexcept {
+  uint64_t key = zobrist::mix(static_cast<uint64_t>(flat_.currentPlayer));
   for(int i = 0; i < WIDTH*HEIGHT; i++) {
-    p = gameWrapper->game->board[i];
-    h = absl::HashState::combine(std::move(h), p->type, p->healthPoints, p->squareIndex);
+    const auto& square = flat_.board[i];
+    key ^= zobrist::mix((static_cast<uint64_t>(i) << 48) ^
+                        (static_cast<uint64_t>(square.type) << 32) ^
+                        static_cast<uint32_t>(square.healthPoints));
   }
-  absl::HashState::combine(std::move(h), gameWrapper->game->currentPlayer);
+  return key;
 }
 
 [[nodiscard]] Vector<uint8_t> NichessGS::valid_moves() const noexcept {
-  auto valids = gameWrapper->computeValids();
+  auto valids = Vector<uint8_t>{NUM_MOVES};
+  flat_.computeValids(tables().agentCache, valids.data());
   return valids;
 }
 
+// Picking an ability tries every one of them, and MCTS plays the same move
+// from the same position on every descent through that edge. The ability only
+// depends on the board and player, so it is cached by key_ and move in a
+// direct mapped table per thread. A clash just overwrites the slot.
+constexpr const size_t ABILITY_CACHE_SIZE = 1 << 16;
+
+struct AbilityCacheEntry {
+  uint64_t key = 0;
+  uint32_t move = 0;
+  bool valid = false;
+  std::tuple<int, int> ability;
+};
+
+[[nodiscard]] std::tuple<int, int> NichessGS::ability_for(
+    uint32_t move) const {
+  thread_local auto cache = std::vector<AbilityCacheEntry>(ABILITY_CACHE_SIZE);
+  auto& entry = cache[zobrist::mix(key_ ^ move) % ABILITY_CACHE_SIZE];
+  if (!entry.valid || entry.key != key_ || entry.move != move) {
+    entry = AbilityCacheEntry{key_, move, true, gameWrapper_.bestAbility(move)};
+  }
+  return entry.ability;
+}
+
 void NichessGS::play_move(uint32_t move) {
-  gameWrapper->makeAction(move);
+  gameWrapper_.makeAction(move, ability_for(move));
+  sync_from_game();
 }
 
 [[nodiscard]] std::optional<Vector<float>> NichessGS::scores() const noexcept {
-  std::optional<nichess::Player> winner = gameWrapper->game->winner();
   auto scores = SizedVector<float, 3>{};
   scores.setZero();
-  if(winner) {
-    if(*winner == nichess::PLAYER_1) {
+  if(flat_.winner >= 0) {
+    if(flat_.winner == nichess::PLAYER_1) {
       scores(0) = 1;
     } else {
       scores(1) = 1;
     }
-  } else if(gameWrapper->game->moveNumber == 200) {
+  } else if(flat_.moveNumber == 200) {
     // TODO: Not part of the game, but might help with training
     scores(2) = 1;
   } else {
@@ -61,100 +123,91 @@ void NichessGS::play_move(uint32_t move) {
   return scores;
 }
 
-int pieceTypeToCanonicalIndex(nichess::PieceType pt) {
-  switch(pt) {
-    case P1_KING:
-      return 0;
-    case P1_MAGE:
-      return 1;
-    case P1_PAWN:
-      return 2;
-    case P1_WARRIOR:
-      return 3;
-    case P1_ASSASSIN:
-      return 4;
-    case P2_KING:
-      return 5;
-    case P2_MAGE:
-      return 6;
-    case P2_PAWN:
-      return 7;
-    case P2_WARRIOR:
-      return 8;
-    case P2_ASSASSIN:
-      return 9;
-    default:
-      return 1000;
-  }
-}
+// Piece types are numbered up to NO_PIECE, which comes last.
+constexpr const int NUM_PIECE_TYPES = nichess::NO_PIECE + 1;
 
-float pieceTypeToMaxHealthPoints(nichess::PieceType pt) {
-  switch(pt) {
-    case P1_KING:
-      return 200;
-    case P1_MAGE:
-      return 230;
-    case P1_PAWN:
-      return 300;
-    case P1_WARRIOR:
-      return 500;
-    case P1_ASSASSIN:
-      return 110;
-    case P2_KING:
-      return 200;
-    case P2_MAGE:
-      return 230;
-    case P2_PAWN:
-      return 300;
-    case P2_WARRIOR:
-      return 500;
-    case P2_ASSASSIN:
-      return 110;
-    default:
-      return 0;
+struct CanonicalPiece {
+  // Plane that marks the piece. Its health is 10 planes later.
+  int plane = -1;
+  float maxHealthPoints = 0;
+};
+
+constexpr const auto CANONICAL_PIECES = [] {
+  auto out = std::array<CanonicalPiece, NUM_PIECE_TYPES>{};
+  out[nichess::P1_KING] = {0, 200};
+  out[nichess::P1_MAGE] = {1, 230};
+  out[nichess::P1_PAWN] = {2, 300};
+  out[nichess::P1_WARRIOR] = {3, 500};
+  out[nichess::P1_ASSASSIN] = {4, 110};
+  out[nichess::P2_KING] = {5, 200};
+  out[nichess::P2_MAGE] = {6, 230};
+  out[nichess::P2_PAWN] = {7, 300};
+  out[nichess::P2_WARRIOR] = {8, 500};
+  out[nichess::P2_ASSASSIN] = {9, 110};
+  return out;
+}();
+
+constexpr const int PLANE_SIZE = WIDTH * HEIGHT;
+
+void NichessGS::canonicalize_into(float* out) const noexcept {
+  std::fill_n(out, CANONICAL_SHAPE[0] * PLANE_SIZE, 0.0F);
+  // indicates whose turn it is
+  std::fill_n(out + (19 + flat_.currentPlayer) * PLANE_SIZE, PLANE_SIZE,
+              1.0F);
+  // Board squares are numbered h * WIDTH + w, the same as within a plane.
+  for(int i = 0; i < PLANE_SIZE; i++) {
+    const auto& square = flat_.board[i];
+    if(square.type == nichess::PieceType::NO_PIECE) continue;
+    // each piece has 2 layers
+    // first indicates whether piece exists there or not
+    // second (10 planes later) is used for piece's health points
+    const auto& canonical = CANONICAL_PIECES[square.type];
+    out[canonical.plane * PLANE_SIZE + i] = 1;
+    out[(canonical.plane + 10) * PLANE_SIZE + i] =
+        square.healthPoints / canonical.maxHealthPoints;
   }
 }
 
 [[nodiscard]] Tensor<float, 3> NichessGS::canonicalized() const noexcept {
-  auto out = CanonicalTensor{};
-  out.setZero();
-  auto currentPlayerIdx = 19 + gameWrapper->game->currentPlayer;
-  auto otherPlayerIdx = 19 + 1 - gameWrapper->game->currentPlayer;
-  int currentBoardIdx, currentCanonicalIdx;
-  for(auto h = 0; h < HEIGHT; h++) {
-    for(auto w = 0; w < WIDTH; w++) {
-      // indicates whose turn it is
-      out(currentPlayerIdx, h, w) = 1; 
-
-      // each piece has 2 layers
-      // first (currentCanonicalIdx) indicates whether piece exists there or not
-      // second (currentCanonicalIdx + 10) is used for piece's health points
-      currentBoardIdx = nichess::coordinatesToBoardIndex(w, h);
-      nichess::Piece* currentPiece = gameWrapper->game->board[currentBoardIdx];
-      if(currentPiece->type == nichess::PieceType::NO_PIECE) continue;
-      currentCanonicalIdx = pieceTypeToCanonicalIndex(currentPiece->type);
-      out(currentCanonicalIdx, h, w) = 1;
-      float maxHP = pieceTypeToMaxHealthPoints(currentPiece->type);
-      out(currentCanonicalIdx + 10, h, w) = currentPiece->healthPoints / maxHP;
-    }
-  }
+  auto out = Tensor<float, 3>{CANONICAL_SHAPE[0], CANONICAL_SHAPE[1],
+                              CANONICAL_SHAPE[2]};
+  canonicalize_into(out.data());
   return out;
 }
 
+// Pieces move and use abilities the same way mirrored left to right, so the
+// mirrored sample has mirrored planes and each move's policy moved to the
+// mirrored move. bestAbility breaks ties with abilityOrder, so the mirrored
+// move also picks the mirrored ability and leads to the mirrored successor.
 [[nodiscard]] std::vector<PlayHistory> NichessGS::symmetries(
     const PlayHistory& base) const noexcept {
   std::vector<PlayHistory> syms{base};
+  PlayHistory mirror;
+  mirror.v = base.v;
+  mirror.weight = base.weight;
+  mirror.canonical = CanonicalTensor{};
+  for (auto f = 0; f < CANONICAL_SHAPE[0]; ++f) {
+    for (auto h = 0; h < HEIGHT; ++h) {
+      for (auto w = 0; w < WIDTH; ++w) {
+        mirror.canonical(f, h, w) = base.canonical(f, h, (WIDTH - 1) - w);
+      }
+    }
+  }
+  mirror.pi = Vector<float>{NUM_MOVES};
+  for (auto m = 0; m < NUM_MOVES; ++m) {
+    mirror.pi(nichess_wrapper::MOVE_TABLES.mirroredMove[m]) = base.pi(m);
+  }
+  syms.push_back(mirror);
   return syms;
 }
 
 [[nodiscard]] std::string NichessGS::dump() const noexcept {
-  return gameWrapper->game->dump();
+  return gameWrapper_.game.dump();
 }
 
 
 [[nodiscard]] std::string NichessGS::move_to_player_action(uint32_t move) const {
-    return gameWrapper->moveToPlayerAction(move);
- 
+    return gameWrapper_.moveToPlayerAction(move, ability_for(move));
 };
 
 }
@@ -4,39 +4,33 @@
 #include "game_state.h"
 #include "nichess_wrapper.h"
 #include "nichess_constants.h"
+#include "zobrist.h"
 
 namespace alphazero::nichess_gs {
 
-auto gameCache = nichess::GameCache();
-auto agentCache = nichess_wrapper::AgentCache();
-
 using CanonicalTensor =
     SizedTensor<float, Eigen::Sizes<CANONICAL_SHAPE[0], CANONICAL_SHAPE[1],
                                     CANONICAL_SHAPE[2]>>;
 
 class DLLEXPORT NichessGS : public GameState {
  public:
-  NichessGS() {
-    gameWrapper = std::make_unique<nichess_wrapper::GameWrapper>(gameCache, agentCache);
-  }
-
-  NichessGS(const std::string encodedBoard) {
-    gameWrapper = std::make_unique<nichess_wrapper::GameWrapper>(gameCache, agentCache, encodedBoard);
-  }
+  NichessGS();
+  NichessGS(const std::string encodedBoard);
 
   [[nodiscard]] std::unique_ptr<GameState> copy() const noexcept override;
   [[nodiscard]] bool operator==(const GameState& other) const noexcept override;
 
   void hash(absl::HashState h) const override;
+  [[nodiscard]] uint64_t fingerprint() const noexcept override { return key_; }
 
   // Returns the current player. Players must be 0 indexed.
   [[nodiscard]] uint8_t current_player() const noexcept override {
-    return gameWrapper->game->currentPlayer;
+    return flat_.currentPlayer;
   };
 
   // Returns the current turn.
   [[nodiscard]] uint32_t current_turn() const noexcept override {
-    return gameWrapper->game->moveNumber;
+    return flat_.moveNumber;
   }
 
   // Returns the number of possible moves.
@@ -61,6 +55,10 @@ class DLLEXPORT NichessGS : public GameState {
 
   // Returns the canonicalized form of the board, ready for feeding to a NN.
   [[nodiscard]] Tensor<float, 3> canonicalized() const noexcept override;
+  [[nodiscard]] std::array<int, 3> canonical_shape() const noexcept override {
+    return CANONICAL_SHAPE;
+  }
+  void canonicalize_into(float* out) const noexcept override;
 
   // Returns the number of symmetries the game has.
   [[nodiscard]] uint8_t num_symmetries() const noexcept override {
@@ -86,7 +84,20 @@ class DLLEXPORT NichessGS : public GameState {
   [[nodiscard]] std::string move_to_player_action(uint32_t move) const;
 
  private:
-  std::unique_ptr<nichess_wrapper::GameWrapper> gameWrapper;
+  // Everything but playing moves reads the flat copy of the game.
+  nichess_wrapper::FlatGame flat_;
+  // The library's game applies moves and picks abilities. Each state owns
+  // its own, so copy() clones it once. Mutable because the nichess library
+  // isn't const correct, and picking an ability plays and undoes moves.
+  mutable nichess_wrapper::GameWrapper gameWrapper_;
+  // Hash of the board and player, rebuilt by play_move.
+  uint64_t key_ = 0;
+
+  // Rebuilds flat_ and key_ after gameWrapper_ changed.
+  void sync_from_game();
+  [[nodiscard]] uint64_t board_key() const noexcept;
+  // The ability bestAbility picks for move in this position, cached by key_.
+  [[nodiscard]] std::tuple<int, int> ability_for(uint32_t move) const;
 };
 
 }  // namespace alphazero::nichess_gs
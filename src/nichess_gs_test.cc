@@ -0,0 +1,370 @@
+#include <array>
+#include <limits>
+#include <random>
+#include <utility>
+
+#include "gtest/gtest.h"
+#include "nichess/util.hpp"
+#include "nichess_gs.h"
+#include "nichess_wrapper.h"
+
+namespace alphazero::nichess_gs {
+namespace {
+
+// Move index of each source and destination, built square by square with
+// the library's coordinates like AgentCache used to be.
+std::vector<std::vector<int>> reference_move_indices() {
+  auto out = std::vector<std::vector<int>>(NUM_SQUARES,
+                                           std::vector<int>(NUM_SQUARES, -1));
+  for (auto src_y = 0; src_y < nichess::NUM_ROWS; ++src_y) {
+    for (auto src_x = 0; src_x < nichess::NUM_COLUMNS; ++src_x) {
+      const auto src = nichess::coordinatesToBoardIndex(src_x, src_y);
+      auto n = 0;
+      const auto add = [&](int dx, int dy) {
+        const auto x = src_x + dx;
+        const auto y = src_y + dy;
+        if (!nichess::isOffBoard(x, y)) {
+          out[src][nichess::coordinatesToBoardIndex(x, y)] =
+              src * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + n;
+        }
+        ++n;
+      };
+      for (auto dy = -2; dy < 3; ++dy) {
+        for (auto dx = -2; dx < 3; ++dx) {
+          if (dx != 0 || dy != 0) {
+            add(dx, dy);
+          }
+        }
+      }
+      add(3, 3);
+      add(3, -3);
+      add(-3, 3);
+      add(-3, -3);
+    }
+  }
+  return out;
+}
+
+// Valid moves from the library's per piece move lists.
+Vector<uint8_t> reference_valids(nichess_wrapper::GameWrapper& wrapper) {
+  static const auto move_indices = reference_move_indices();
+  auto valids = Vector<uint8_t>{NUM_MOVES};
+  valids.setZero();
+  auto found = false;
+  for (auto* piece : wrapper.game.playerToPieces[wrapper.game.currentPlayer]) {
+    if (piece->healthPoints <= 0) {
+      continue;
+    }
+    for (const auto& move : wrapper.legalMovesByPiece(piece)) {
+      valids(move_indices[move.moveSrcIdx][move.moveDstIdx]) = 1;
+      found = true;
+    }
+  }
+  if (!found) {
+    valids(MOVE_SKIP_IDX) = 1;
+  }
+  return valids;
+}
+
+// The ability with the best full position value after move, with ties
+// broken by abilityOrder.
+std::tuple<int, int> reference_ability(const nichess_wrapper::GameWrapper& wrapper,
+                                       uint32_t move) {
+  auto game = wrapper.game;
+  if (move != MOVE_SKIP_IDX) {
+    game.makeMove(move / NUM_MAX_POSSIBLE_MOVES_FOR_PIECE,
+                  nichess_wrapper::MOVE_TABLES.moveToDst[move]);
+  }
+  auto best = std::tuple<int, int>{nichess::ABILITY_SKIP, nichess::ABILITY_SKIP};
+  const auto player = game.currentPlayer;
+  if (game.playerToPieces[player][nichess::KING_PIECE_INDEX]->healthPoints <=
+      0) {
+    return best;
+  }
+  const auto m = player == nichess::PLAYER_1 ? 1.0F : -1.0F;
+  const auto king_square =
+      game.playerToPieces[player][nichess::KING_PIECE_INDEX]->squareIndex;
+  auto best_value = -std::numeric_limits<float>::max();
+  auto best_order = std::array<int, 6>{};
+  for (const auto* piece : game.playerToPieces[player]) {
+    if (piece->healthPoints <= 0) {
+      continue;
+    }
+    for (const auto& ability :
+         game.gameCache->pieceTypeToSquareIndexToLegalAbilities
+             [piece->type][piece->squareIndex]) {
+      if (!nichess_wrapper::isUsefulAbility(
+              piece->type, game.board[ability.abilityDstIdx]->type)) {
+        continue;
+      }
+      const auto undo = game.makeAction(nichess::MOVE_SKIP, nichess::MOVE_SKIP,
+                                        ability.abilitySrcIdx,
+                                        ability.abilityDstIdx);
+      const auto value = m * nichess_wrapper::positionValue(game);
+      game.undoAction(undo);
+      const auto order = nichess_wrapper::abilityOrder(
+          king_square, ability.abilitySrcIdx, ability.abilityDstIdx);
+      if (value > best_value || (value == best_value && order < best_order)) {
+        best_value = value;
+        best_order = order;
+        best = {ability.abilitySrcIdx, ability.abilityDstIdx};
+      }
+    }
+  }
+  return best;
+}
+
+// NOLINTNEXTLINE
+TEST(NichessGS, MoveTables) {
+  const auto move_indices = reference_move_indices();
+  for (auto src = 0; src < NUM_SQUARES; ++src) {
+    for (auto dst = 0; dst < NUM_SQUARES; ++dst) {
+      const auto move = nichess_wrapper::MOVE_TABLES.srcDstToMove[src][dst];
+      ASSERT_EQ(move, move_indices[src][dst]) << src << " -> " << dst;
+      if (move >= 0) {
+        EXPECT_EQ(nichess_wrapper::MOVE_TABLES.moveToDst[move], dst);
+      }
+    }
+  }
+}
+
+// NOLINTNEXTLINE
+TEST(NichessGS, ValidMovesMatchReference) {
+  auto game_cache = nichess::GameCache();
+  auto agent_cache = nichess_wrapper::AgentCache(game_cache);
+  auto re = std::mt19937{7};
+  for (auto game = 0; game < 20; ++game) {
+    auto wrapper = nichess_wrapper::GameWrapper(game_cache, agent_cache);
+    for (auto turn = 0; turn < 200 && !wrapper.game.winner().has_value();
+         ++turn) {
+      const auto valids = wrapper.computeValids();
+      ASSERT_EQ(valids, reference_valids(wrapper))
+          << "game " << game << " turn " << turn;
+      auto moves = std::vector<uint32_t>{};
+      for (auto m = 0; m < NUM_MOVES; ++m) {
+        if (valids(m) == 1) {
+          moves.push_back(m);
+        }
+      }
+      wrapper.makeAction(moves[std::uniform_int_distribution<size_t>{
+          0, moves.size() - 1}(re)]);
+    }
+  }
+}
+
+// NOLINTNEXTLINE
+TEST(NichessGS, BestAbilityMatchesFullScoring) {
+  auto game_cache = nichess::GameCache();
+  auto agent_cache = nichess_wrapper::AgentCache(game_cache);
+  auto re = std::mt19937{5};
+  for (auto game = 0; game < 5; ++game) {
+    auto wrapper = nichess_wrapper::GameWrapper(game_cache, agent_cache);
+    for (auto turn = 0; turn < 200 && !wrapper.game.winner().has_value();
+         ++turn) {
+      const auto valids = wrapper.computeValids();
+      auto moves = std::vector<uint32_t>{};
+      for (auto m = 0; m < NUM_MOVES; ++m) {
+        if (valids(m) == 1) {
+          moves.push_back(m);
+          ASSERT_EQ(wrapper.bestAbility(m), reference_ability(wrapper, m))
+              << "game " << game << " turn " << turn << " move " << m;
+        }
+      }
+      wrapper.makeAction(moves[std::uniform_int_distribution<size_t>{
+          0, moves.size() - 1}(re)]);
+    }
+  }
+}
+
+// NOLINTNEXTLINE
+TEST(NichessGS, MirroredMoves) {
+  const auto& tables = nichess_wrapper::MOVE_TABLES;
+  EXPECT_EQ(tables.mirroredMove[MOVE_SKIP_IDX], MOVE_SKIP_IDX);
+  for (auto m = 0; m < MOVE_SKIP_IDX; ++m) {
+    const auto mirrored = tables.mirroredMove[m];
+    ASSERT_EQ(tables.mirroredMove[mirrored], m);
+    const auto src = m / NUM_MAX_POSSIBLE_MOVES_FOR_PIECE;
+    const auto mirrored_src = mirrored / NUM_MAX_POSSIBLE_MOVES_FOR_PIECE;
+    EXPECT_EQ(mirrored_src / WIDTH, src / WIDTH);
+    EXPECT_EQ(mirrored_src % WIDTH, WIDTH - 1 - src % WIDTH);
+    const auto dst = tables.moveToDst[m];
+    if (dst < 0) {
+      EXPECT_LT(tables.moveToDst[mirrored], 0);
+      continue;
+    }
+    const auto mirrored_dst = tables.moveToDst[mirrored];
+    EXPECT_EQ(mirrored_dst / WIDTH, dst / WIDTH);
+    EXPECT_EQ(mirrored_dst % WIDTH, WIDTH - 1 - dst % WIDTH);
+  }
+}
+
+int mirror_square(int square) {
+  return square - square % WIDTH + (WIDTH - 1 - square % WIDTH);
+}
+
+// A copy of wrapper's game mirrored left to right. Pieces are moved with the
+// library's makeMove, first out of the way and then onto their mirrored
+// squares.
+nichess_wrapper::GameWrapper mirrored(
+    const nichess_wrapper::GameWrapper& wrapper) {
+  auto out = wrapper;
+  auto& game = out.game;
+  auto pieces = std::vector<std::pair<int, int>>{};
+  auto busy = std::array<bool, NUM_SQUARES>{};
+  for (auto square = 0; square < NUM_SQUARES; ++square) {
+    if (game.board[square]->type != nichess::NO_PIECE) {
+      pieces.emplace_back(square, mirror_square(square));
+      busy[square] = true;
+      busy[mirror_square(square)] = true;
+    }
+  }
+  auto spare = 0;
+  for (auto& [square, target] : pieces) {
+    while (busy[spare]) {
+      ++spare;
+    }
+    game.makeMove(square, spare);
+    busy[spare] = true;
+    square = spare;
+  }
+  for (const auto& [square, target] : pieces) {
+    game.makeMove(square, target);
+  }
+  return out;
+}
+
+// Mirrored positions have mirrored valid moves, bestAbility picks the
+// mirrored ability for the mirrored move, and playing it gives the mirrored
+// successor. Otherwise the mirrored policy target would be for a different
+// game.
+// NOLINTNEXTLINE
+TEST(NichessGS, MirroredPlayGivesMirroredSuccessor) {
+  auto game_cache = nichess::GameCache();
+  auto agent_cache = nichess_wrapper::AgentCache(game_cache);
+  const auto& mirrored_move = nichess_wrapper::MOVE_TABLES.mirroredMove;
+  auto re = std::mt19937{17};
+  for (auto game = 0; game < 5; ++game) {
+    auto wrapper = nichess_wrapper::GameWrapper(game_cache, agent_cache);
+    auto mirror = mirrored(wrapper);
+    for (auto turn = 0; turn < 200 && !wrapper.game.winner().has_value();
+         ++turn) {
+      const auto flat = nichess_wrapper::FlatGame::fromGame(wrapper.game);
+      const auto mirror_flat = nichess_wrapper::FlatGame::fromGame(mirror.game);
+      for (auto square = 0; square < NUM_SQUARES; ++square) {
+        ASSERT_EQ(mirror_flat.board[mirror_square(square)], flat.board[square])
+            << "game " << game << " turn " << turn << " square " << square;
+      }
+      ASSERT_EQ(mirror_flat.currentPlayer, flat.currentPlayer);
+
+      const auto valids = wrapper.computeValids();
+      const auto mirror_valids = mirror.computeValids();
+      auto moves = std::vector<uint32_t>{};
+      for (auto m = 0; m < NUM_MOVES; ++m) {
+        ASSERT_EQ(mirror_valids(mirrored_move[m]), valids(m))
+            << "game " << game << " turn " << turn << " move " << m;
+        if (valids(m) == 0) {
+          continue;
+        }
+        moves.push_back(m);
+        const auto [src, dst] = wrapper.bestAbility(m);
+        const auto expected =
+            src == nichess::ABILITY_SKIP
+                ? std::tuple<int, int>{nichess::ABILITY_SKIP,
+                                       nichess::ABILITY_SKIP}
+                : std::tuple<int, int>{mirror_square(src), mirror_square(dst)};
+        ASSERT_EQ(mirror.bestAbility(mirrored_move[m]), expected)
+            << "game " << game << " turn " << turn << " move " << m;
+      }
+      const auto move =
+          moves[std::uniform_int_distribution<size_t>{0, moves.size() - 1}(re)];
+      wrapper.makeAction(move);
+      mirror.makeAction(mirrored_move[move]);
+    }
+  }
+}
+
+// Mirroring twice gives back the sample, and mirrored moves start on the
+// mirrored planes' pieces of the player to move.
+// NOLINTNEXTLINE
+TEST(NichessGS, SymmetriesRoundTrip) {
+  auto re = std::mt19937{11};
+  auto gs = NichessGS{};
+  for (auto turn = 0; turn < 60 && !gs.scores().has_value(); ++turn) {
+    const auto valids = gs.valid_moves();
+    auto base = PlayHistory{};
+    base.canonical = gs.canonicalized();
+    base.v = Vector<float>{NUM_PLAYERS + 1};
+    base.v.setConstant(1.0 / (NUM_PLAYERS + 1));
+    base.pi = valids.cast<float>();
+    base.pi /= base.pi.sum();
+
+    const auto syms = gs.symmetries(base);
+    ASSERT_EQ(syms.size(), NUM_SYMMETRIES);
+    const auto& mirror = syms[1];
+    const auto back = gs.symmetries(mirror)[1];
+    const auto same =
+        Tensor<bool, 0>{(back.canonical == base.canonical).all()};
+    EXPECT_TRUE(same());
+    EXPECT_EQ(back.pi, base.pi);
+    EXPECT_EQ(mirror.v, base.v);
+
+    const auto first_plane = 5 * gs.current_player();
+    for (auto m = 0; m < MOVE_SKIP_IDX; ++m) {
+      if (mirror.pi(m) == 0) {
+        continue;
+      }
+      const auto src = m / NUM_MAX_POSSIBLE_MOVES_FOR_PIECE;
+      auto pieces = 0.0F;
+      for (auto p = first_plane; p < first_plane + 5; ++p) {
+        pieces += mirror.canonical(p, src / WIDTH, src % WIDTH);
+      }
+      EXPECT_EQ(pieces, 1) << "move " << m;
+    }
+
+    auto moves = std::vector<uint32_t>{};
+    for (auto m = 0; m < NUM_MOVES; ++m) {
+      if (valids(m) == 1) {
+        moves.push_back(m);
+      }
+    }
+    gs.play_move(
+        moves[std::uniform_int_distribution<size_t>{0, moves.size() - 1}(re)]);
+  }
+}
+
+// Playing a move on a copy must not change the original.
+// NOLINTNEXTLINE
+TEST(NichessGS, CopiesAreIndependent) {
+  auto re = std::mt19937{13};
+  auto gs = NichessGS{};
+  for (auto turn = 0; turn < 60 && !gs.scores().has_value(); ++turn) {
+    const auto before = gs.copy();
+    const auto canonical = gs.canonicalized();
+    const auto valids = gs.valid_moves();
+    auto moves = std::vector<uint32_t>{};
+    for (auto m = 0; m < NUM_MOVES; ++m) {
+      if (valids(m) == 1) {
+        moves.push_back(m);
+      }
+    }
+    const auto move =
+        moves[std::uniform_int_distribution<size_t>{0, moves.size() - 1}(re)];
+    auto child = gs.copy();
+    child->play_move(move);
+
+    EXPECT_TRUE(gs == *before);
+    EXPECT_EQ(gs.fingerprint(), before->fingerprint());
+    EXPECT_EQ(gs.valid_moves(), valids);
+    const auto same = Tensor<bool, 0>{(gs.canonicalized() == canonical).all()};
+    EXPECT_TRUE(same());
+    EXPECT_NE(child->current_player(), gs.current_player());
+
+    gs.play_move(move);
+    EXPECT_TRUE(gs == *child);
+    EXPECT_EQ(gs.fingerprint(), child->fingerprint());
+    EXPECT_EQ(gs.dump(), child->dump());
+  }
+}
+
+}  // namespace
+}  // namespace alphazero::nichess_gs
@@ -1,483 +1,57 @@
 #include "nichess_wrapper.h"
 #include "nichess/nichess.hpp"
 #include "nichess/util.hpp"
+#include "bitboard.h"
 #include "nichess_constants.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <limits>
+#include <optional>
+#include <stdexcept>
 
 using namespace nichess;
 using namespace alphazero::nichess_gs;
 
-std::vector<std::tuple<int, int>> generateMoveIndexToSrcSquareAndDstSquare() {
-  // -1 because the last index is reserved for MOVE_SKIP which doesn't have source and destination
-  std::vector<std::tuple<int, int>> moveIndexToSrcSquareAndDstSquare(NUM_MOVES - 1);
-  int newX, newY, srcSquareIndex, dstSquareIndex, moveIndex;
-  for(int srcY = 0; srcY < NUM_ROWS; srcY++) {
-    for(int srcX = 0; srcX < NUM_COLUMNS; srcX++) {
-      srcSquareIndex = coordinatesToBoardIndex(srcX, srcY);
-      int n = 0;
-      for(int dy = -2; dy < 3; dy++) {
-        for(int dx = -2; dx < 3; dx++) {
-          if(dx == 0 && dy == 0) {
-            continue; 
-          }
-          newX = srcX + dx;
-          newY = srcY + dy;
-          // newX or newY might be off board, but it doesn't matter.
-          // Move legality should be checked elsewhere.
-          dstSquareIndex = coordinatesToBoardIndex(newX, newY);
-          moveIndexToSrcSquareAndDstSquare[srcSquareIndex * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + n] = std::tuple<int, int>(srcSquareIndex, dstSquareIndex);
-          n++;
-        }
-      }
-      // 4 extra moves:
-      newX = srcX + 3;
-      newY = srcY + 3;
-      if(!isOffBoard(newX, newY)) {
-        dstSquareIndex = coordinatesToBoardIndex(newX, newY);
-        moveIndexToSrcSquareAndDstSquare[srcSquareIndex * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + n] = std::tuple<int, int>(srcSquareIndex, dstSquareIndex);
-      }
-      n++;
-
-      newX = srcX + 3;
-      newY = srcY - 3;
-      if(!isOffBoard(newX, newY)) {
-        dstSquareIndex = coordinatesToBoardIndex(newX, newY);
-        moveIndexToSrcSquareAndDstSquare[srcSquareIndex * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + n] = std::tuple<int, int>(srcSquareIndex, dstSquareIndex);
-      }
-      n++;
-
-      newX = srcX - 3;
-      newY = srcY + 3;
-      if(!isOffBoard(newX, newY)) {
-        dstSquareIndex = coordinatesToBoardIndex(newX, newY);
-        moveIndexToSrcSquareAndDstSquare[srcSquareIndex * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + n] = std::tuple<int, int>(srcSquareIndex, dstSquareIndex);
-      }
-      n++;
-
-      newX = srcX - 3;
-      newY = srcY - 3;
-      if(!isOffBoard(newX, newY)) {
-        dstSquareIndex = coordinatesToBoardIndex(newX, newY);
-        moveIndexToSrcSquareAndDstSquare[srcSquareIndex * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + n] = std::tuple<int, int>(srcSquareIndex, dstSquareIndex);
-      }
-      n++;
-    }
-  }
-  return moveIndexToSrcSquareAndDstSquare;
-}
-
-std::vector<std::vector<int>> generateSrcSquareToDstSquareToMoveIndex() {
-  std::vector<std::vector<int>> srcSquareToDstSquareToMoveIndex(NUM_SQUARES);
-  int newX, newY, srcSquareIndex, dstSquareIndex, moveIndex;
-  for(int srcY = 0; srcY < NUM_ROWS; srcY++) {
-    for(int srcX = 0; srcX < NUM_COLUMNS; srcX++) {
-      srcSquareIndex = coordinatesToBoardIndex(srcX, srcY);
-      std::vector<int> dstSquareToMoveIndex(NUM_SQUARES);
-      int n = 0;
-      for(int dy = -2; dy < 3; dy++) {
-        for(int dx = -2; dx < 3; dx++) {
-          newX = srcX + dx;
-          newY = srcY + dy;
-          if(isOffBoard(newX, newY)) {
-            n++;
-            continue; 
-          }
-          if(dx == 0 && dy == 0) continue;
-
-          dstSquareIndex = coordinatesToBoardIndex(newX, newY);
-          dstSquareToMoveIndex[dstSquareIndex] = srcSquareIndex * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + n;
-          n++;
+nichess_wrapper::AgentCache::AgentCache(const nichess::GameCache& gameCache)
+  : pieceTypeToSquareIndexToMoveSlots(gameCache.pieceTypeToSquareIndexToLegalMoves.size()) {
+  for(size_t pt = 0; pt < gameCache.pieceTypeToSquareIndexToLegalMoves.size(); pt++) {
+    const auto& squareIndexToLegalMoves = gameCache.pieceTypeToSquareIndexToLegalMoves[pt];
+    for(size_t square = 0; square < squareIndexToLegalMoves.size(); square++) {
+      uint32_t slots = 0;
+      for(const PlayerMove& move : squareIndexToLegalMoves[square]) {
+        const int moveIndex = MOVE_TABLES.srcDstToMove[move.moveSrcIdx][move.moveDstIdx];
+        if(moveIndex < 0) {
+          throw std::runtime_error{"Nichess move has no move index."};
         }
+        slots |= uint32_t{1} << (moveIndex - move.moveSrcIdx * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE);
       }
-      // 4 extra moves:
-      newX = srcX + 3;
-      newY = srcY + 3;
-      if(!isOffBoard(newX, newY)) {
-        dstSquareIndex = coordinatesToBoardIndex(newX, newY);
-        dstSquareToMoveIndex[dstSquareIndex] = srcSquareIndex * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + n;
-      }
-      n++;
-
-      newX = srcX + 3;
-      newY = srcY - 3;
-      if(!isOffBoard(newX, newY)) {
-        dstSquareIndex = coordinatesToBoardIndex(newX, newY);
-        dstSquareToMoveIndex[dstSquareIndex] = srcSquareIndex * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + n;
-      }
-      n++;
-
-      newX = srcX - 3;
-      newY = srcY + 3;
-      if(!isOffBoard(newX, newY)) {
-        dstSquareIndex = coordinatesToBoardIndex(newX, newY);
-        dstSquareToMoveIndex[dstSquareIndex] = srcSquareIndex * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + n;
-      }
-      n++;
-
-      newX = srcX - 3;
-      newY = srcY - 3;
-      if(!isOffBoard(newX, newY)) {
-        dstSquareIndex = coordinatesToBoardIndex(newX, newY);
-        dstSquareToMoveIndex[dstSquareIndex] = srcSquareIndex * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + n;
-      }
-      n++;
-      
-      srcSquareToDstSquareToMoveIndex[srcSquareIndex] = dstSquareToMoveIndex;
+      pieceTypeToSquareIndexToMoveSlots[pt][square] = slots;
     }
   }
-  return srcSquareToDstSquareToMoveIndex;
 }
 
-nichess_wrapper::AgentCache::AgentCache() {
-  moveIndexToSrcSquareAndDstSquare = generateMoveIndexToSrcSquareAndDstSquare();
-  srcSquareToDstSquareToMoveIndex = generateSrcSquareToDstSquareToMoveIndex();
-}
+nichess_wrapper::GameWrapper::GameWrapper(nichess::GameCache& gameCache, const AgentCache& agentCache)
+  : game(gameCache), agentCache(&agentCache) {}
 
-nichess_wrapper::GameWrapper::GameWrapper(nichess::GameCache& gameCache, AgentCache& agentCache) {
-  this->agentCache = &agentCache;
-  game = new Game(gameCache);
-}
+nichess_wrapper::GameWrapper::GameWrapper(nichess::GameCache& gameCache, const AgentCache& agentCache, const std::string encodedBoard)
+  : game(gameCache, encodedBoard), agentCache(&agentCache) {}
 
-nichess_wrapper::GameWrapper::GameWrapper(nichess::GameCache& gameCache, AgentCache& agentCache, const std::string encodedBoard) {
-  this->agentCache = &agentCache;
-  game = new Game(gameCache, encodedBoard);
+bool nichess_wrapper::isPlayer1Piece(PieceType pt) {
+  return pt == P1_KING || pt == P1_MAGE || pt == P1_PAWN || pt == P1_WARRIOR || pt == P1_ASSASSIN;
 }
 
-nichess_wrapper::GameWrapper::GameWrapper(const nichess_wrapper::GameWrapper& other) {
-  this->agentCache = other.agentCache;
-  game = new Game(*other.game);
-}
-
-nichess_wrapper::GameWrapper::GameWrapper(const std::unique_ptr<nichess_wrapper::GameWrapper>& other) {
-  this->agentCache = other->agentCache;
-  game = new Game(*other->game);
-}
-
-nichess_wrapper::GameWrapper::~GameWrapper() {
-  delete game;
+bool nichess_wrapper::isPlayer2Piece(PieceType pt) {
+  return pt == P2_KING || pt == P2_MAGE || pt == P2_PAWN || pt == P2_WARRIOR || pt == P2_ASSASSIN;
 }
 
 /*
- * Useful actions are those whose abilities change the game state.
+ * Useful abilities are those that change the game state, which are only abilities used on enemy pieces.
  * For example, warrior attacking an empty square is legal but doesn't change the game state.
- * Returns the vector of PlayerActions, excluding actions where:
- * 1) Move is different from MOVE_SKIP
- * 2) Ability is ABILITY_SKIP
  */
-std::vector<PlayerAction> nichess_wrapper::GameWrapper::usefulLegalActionsWithoutMoves() {
-  std::vector<PlayerAction> retval;
-  // If King is dead, game is over and there are no legal actions
-  if(game->playerToPieces[game->currentPlayer][KING_PIECE_INDEX]->healthPoints <= 0) {
-    return retval;
-  }
-
-  for(int k = 0; k < NUM_STARTING_PIECES; k++) {
-    Piece* cp2 = game->playerToPieces[game->currentPlayer][k];
-    if(cp2->healthPoints <= 0) continue; // no abilities for dead pieces
-    auto legalAbilities = game->gameCache->pieceTypeToSquareIndexToLegalAbilities[cp2->type][cp2->squareIndex];
-    for(int l = 0; l < legalAbilities.size(); l++) {
-      Piece* destinationSquarePiece = game->board[legalAbilities[l].abilityDstIdx];
-      // exclude useless abilities
-      switch(cp2->type) {
-        // king can only use abilities on enemy pieces
-        case P1_KING:
-          switch(destinationSquarePiece->type) {
-            case P1_KING:
-              continue;
-            case P1_MAGE:
-              continue;
-            case P1_PAWN:
-              continue;
-            case P1_WARRIOR:
-              continue;
-            case P1_ASSASSIN:
-              continue;
-            case P2_KING:
-              break;
-            case P2_MAGE:
-              break;
-            case P2_PAWN:
-              break;
-            case P2_WARRIOR:
-              break;
-            case P2_ASSASSIN:
-              break;
-            case NO_PIECE:
-              continue;
-            default:
-              break;
-          }
-        // mage can only use abilities on enemy pieces
-        case P1_MAGE:
-          switch(destinationSquarePiece->type) {
-            case P1_KING:
-              continue;
-            case P1_MAGE:
-              continue;
-            case P1_PAWN:
-              continue;
-            case P1_WARRIOR:
-              continue;
-            case P1_ASSASSIN:
-              continue;
-            case P2_KING:
-              break;
-            case P2_MAGE:
-              break;
-            case P2_PAWN:
-              break;
-            case P2_WARRIOR:
-              break;
-            case P2_ASSASSIN:
-              break;
-            case NO_PIECE:
-              continue;
-            default:
-              break;
-          }
-          break;
-        // pawn can use abilities on enemy pieces
-        case P1_PAWN:
-          switch(destinationSquarePiece->type) {
-            case P1_KING:
-              continue;
-            case P1_MAGE:
-              continue;
-            case P1_PAWN:
-              continue;
-            case P1_WARRIOR:
-              continue;
-            case P1_ASSASSIN:
-              continue;
-            case P2_KING:
-              break;
-            case P2_MAGE:
-              break;
-            case P2_PAWN:
-              break;
-            case P2_WARRIOR:
-              break;
-            case P2_ASSASSIN:
-              break;
-            case NO_PIECE:
-              continue;
-            default:
-              break;
-          }
-          break;
-        // warrior can only use abilities on enemy pieces
-        case P1_WARRIOR:
-          switch(destinationSquarePiece->type) {
-            case P1_KING:
-              continue;
-            case P1_MAGE:
-              continue;
-            case P1_PAWN:
-              continue;
-            case P1_WARRIOR:
-              continue;
-            case P1_ASSASSIN:
-              continue;
-            case P2_KING:
-              break;
-            case P2_MAGE:
-              break;
-            case P2_PAWN:
-              break;
-            case P2_WARRIOR:
-              break;
-            case P2_ASSASSIN:
-              break;
-            case NO_PIECE:
-              continue;
-            default:
-              break;
-          }
-          break;
-        // assassin can only use abilities on enemy pieces
-        case P1_ASSASSIN:
-          switch(destinationSquarePiece->type) {
-            case P1_KING:
-              continue;
-            case P1_MAGE:
-              continue;
-            case P1_PAWN:
-              continue;
-            case P1_WARRIOR:
-              continue;
-            case P1_ASSASSIN:
-              continue;
-            case P2_KING:
-              break;
-            case P2_MAGE:
-              break;
-            case P2_PAWN:
-              break;
-            case P2_WARRIOR:
-              break;
-            case P2_ASSASSIN:
-              break;
-            case NO_PIECE:
-              continue;
-            default:
-              break;
-          }
-          break;
-
-        // king can only use abilities on enemy pieces
-        case P2_KING:
-          switch(destinationSquarePiece->type) {
-            case P1_KING:
-              break;
-            case P1_MAGE:
-              break;
-            case P1_PAWN:
-              break;
-            case P1_WARRIOR:
-              break;
-            case P1_ASSASSIN:
-              break;
-            case P2_KING:
-              continue;
-            case P2_MAGE:
-              continue;
-            case P2_PAWN:
-              continue;
-            case P2_WARRIOR:
-              continue;
-            case P2_ASSASSIN:
-              continue;
-            case NO_PIECE:
-              continue;
-            default:
-              break;
-          }
-        // mage can only use abilities on enemy pieces
-        case P2_MAGE:
-          switch(destinationSquarePiece->type) {
-            case P1_KING:
-              break;
-            case P1_MAGE:
-              break;
-            case P1_PAWN:
-              break;
-            case P1_WARRIOR:
-              break;
-            case P1_ASSASSIN:
-              break;
-            case P2_KING:
-              continue;
-            case P2_MAGE:
-              continue;
-            case P2_PAWN:
-              continue;
-            case P2_WARRIOR:
-              continue;
-            case P2_ASSASSIN:
-              continue;
-            case NO_PIECE:
-              continue;
-            default:
-              break;
-          }
-          break;
-        // pawn can use abilities on enemy pieces
-        case P2_PAWN:
-          switch(destinationSquarePiece->type) {
-            case P1_KING:
-              break;
-            case P1_MAGE:
-              break;
-            case P1_PAWN:
-              break;
-            case P1_WARRIOR:
-              break;
-            case P1_ASSASSIN:
-              break;
-            case P2_KING:
-              continue;
-            case P2_MAGE:
-              continue;
-            case P2_PAWN:
-              continue;
-            case P2_WARRIOR:
-              continue;
-            case P2_ASSASSIN:
-              continue;
-            case NO_PIECE:
-              continue;
-            default:
-              break;
-          }
-          break;
-        // warrior can only use abilities on enemy pieces
-        case P2_WARRIOR:
-          switch(destinationSquarePiece->type) {
-            case P1_KING:
-              break;
-            case P1_MAGE:
-              break;
-            case P1_PAWN:
-              break;
-            case P1_WARRIOR:
-              break;
-            case P1_ASSASSIN:
-              break;
-            case P2_KING:
-              continue;
-            case P2_MAGE:
-              continue;
-            case P2_PAWN:
-              continue;
-            case P2_WARRIOR:
-              continue;
-            case P2_ASSASSIN:
-              continue;
-            case NO_PIECE:
-              continue;
-            default:
-              break;
-          }
-          break;
-        // assassin can only use abilities on enemy pieces
-        case P2_ASSASSIN:
-          switch(destinationSquarePiece->type) {
-            case P1_KING:
-              break;
-            case P1_MAGE:
-              break;
-            case P1_PAWN:
-              break;
-            case P1_WARRIOR:
-              break;
-            case P1_ASSASSIN:
-              break;
-            case P2_KING:
-              continue;
-            case P2_MAGE:
-              continue;
-            case P2_PAWN:
-              continue;
-            case P2_WARRIOR:
-              continue;
-            case P2_ASSASSIN:
-              continue;
-            case NO_PIECE:
-              continue;
-            default:
-              break;
-          }
-          break;
-        case NO_PIECE:
-          break;
-        default:
-          break;
-      }
-
-      PlayerAction p = PlayerAction(MOVE_SKIP, MOVE_SKIP, legalAbilities[l].abilitySrcIdx, legalAbilities[l].abilityDstIdx);
-      retval.push_back(p);
-    }
-  }
-  return retval;
+bool nichess_wrapper::isUsefulAbility(PieceType srcType, PieceType dstType) {
+  return (isPlayer1Piece(srcType) && isPlayer2Piece(dstType)) ||
+         (isPlayer2Piece(srcType) && isPlayer1Piece(dstType));
 }
 
 /*
@@ -485,24 +59,24 @@ std::vector<PlayerAction> nichess_wrapper::GameWrapper::usefulLegalActionsWithou
  */
 std::vector<PlayerMove> nichess_wrapper::GameWrapper::legalMovesByPiece(Piece* piece) const {
   std::vector<PlayerMove> retval;
-  auto legalMovesOnEmptyBoard = game->gameCache->pieceTypeToSquareIndexToLegalMoves[piece->type][piece->squareIndex];
+  auto legalMovesOnEmptyBoard = game.gameCache->pieceTypeToSquareIndexToLegalMoves[piece->type][piece->squareIndex];
   for(int i = 0; i < legalMovesOnEmptyBoard.size(); i++) {
     PlayerMove currentMove = legalMovesOnEmptyBoard[i];
     // Is destination square empty?
-    if(game->board[currentMove.moveDstIdx]->type != NO_PIECE) continue;
+    if(game.board[currentMove.moveDstIdx]->type != NO_PIECE) continue;
     // Is p1 pawn trying to jump over another piece?
     if(piece->type == P1_PAWN &&
         piece->squareIndex - currentMove.moveDstIdx == -2 * NUM_COLUMNS 
         ) {
       // checks whether square in front of the p1 pawn is empty
-      if(game->board[piece->squareIndex + NUM_COLUMNS]->type != NO_PIECE) continue;
+      if(game.board[piece->squareIndex + NUM_COLUMNS]->type != NO_PIECE) continue;
     }
     // Is p2 pawn trying to jump over another piece?
     if(piece->type == P2_PAWN &&
         piece->squareIndex - currentMove.moveDstIdx == 2 * NUM_COLUMNS 
         ) {
       // checks whether square in front of the p2 pawn is empty
-      if(game->board[piece->squareIndex - NUM_COLUMNS]->type != NO_PIECE) continue;
+      if(game.board[piece->squareIndex - NUM_COLUMNS]->type != NO_PIECE) continue;
     }
 
     retval.push_back(currentMove);
@@ -510,17 +84,53 @@ std::vector<PlayerMove> nichess_wrapper::GameWrapper::legalMovesByPiece(Piece* p
   return retval;
 }
 
-Vector<uint8_t> nichess_wrapper::GameWrapper::computeValids() const {
-  auto valids = Vector<uint8_t>{NUM_MOVES};
-  valids.setZero();
-  int currentIndex;
+nichess_wrapper::FlatGame nichess_wrapper::FlatGame::fromGame(Game& game) {
+  FlatGame flat;
+  for(int i = 0; i < NUM_SQUARES; i++) {
+    flat.board[i].healthPoints = game.board[i]->healthPoints;
+    flat.board[i].type = game.board[i]->type;
+  }
+  for(int player : {PLAYER_1, PLAYER_2}) {
+    if(game.playerToPieces[player].size() != NUM_STARTING_PIECES) {
+      throw std::runtime_error{"Nichess player does not have every piece."};
+    }
+    for(int k = 0; k < NUM_STARTING_PIECES; k++) {
+      const Piece* p = game.playerToPieces[player][k];
+      flat.playerToPieces[player][k] = {static_cast<int16_t>(p->healthPoints),
+                                        static_cast<int8_t>(p->type),
+                                        static_cast<int8_t>(p->squareIndex)};
+    }
+  }
+  flat.moveNumber = game.moveNumber;
+  flat.currentPlayer = game.currentPlayer;
+  const std::optional<Player> winner = game.winner();
+  flat.winner = winner ? *winner : -1;
+  return flat;
+}
+
+/*
+ * Same moves as legalMovesByPiece, but read from the move slot bitsets so nothing is allocated.
+ */
+void nichess_wrapper::FlatGame::computeValids(const AgentCache& agentCache, uint8_t* valids) const {
+  std::fill(valids, valids + NUM_MOVES, 0);
   bool foundLegalMove = false;
-  for(Piece* currentPiece : game->playerToPieces[game->currentPlayer]) {
-    if(currentPiece->healthPoints <= 0) continue; // dead pieces don't move
-    std::vector<PlayerMove> legalMoves = legalMovesByPiece(currentPiece);
-    for(PlayerMove move : legalMoves) {
-      currentIndex = agentCache->srcSquareToDstSquareToMoveIndex[move.moveSrcIdx][move.moveDstIdx];
-      valids[currentIndex] = 1;
+  for(const FlatPiece& currentPiece : playerToPieces[currentPlayer]) {
+    if(currentPiece.healthPoints <= 0) continue; // dead pieces don't move
+    const int src = currentPiece.squareIndex;
+    const int firstMove = src * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE;
+    uint32_t slots = agentCache.pieceTypeToSquareIndexToMoveSlots[currentPiece.type][src];
+    while(slots != 0) {
+      const int move = firstMove + alphazero::bitboard::pop_lsb(slots);
+      const int dst = MOVE_TABLES.moveToDst[move];
+      // Is destination square empty?
+      if(board[dst].type != NO_PIECE) continue;
+      // Is p1 pawn trying to jump over another piece?
+      if(currentPiece.type == P1_PAWN && dst - src == 2 * NUM_COLUMNS &&
+          board[src + NUM_COLUMNS].type != NO_PIECE) continue;
+      // Is p2 pawn trying to jump over another piece?
+      if(currentPiece.type == P2_PAWN && src - dst == 2 * NUM_COLUMNS &&
+          board[src - NUM_COLUMNS].type != NO_PIECE) continue;
+      valids[move] = 1;
       foundLegalMove = true;
     }
   }
@@ -531,12 +141,20 @@ Vector<uint8_t> nichess_wrapper::GameWrapper::computeValids() const {
   if(!foundLegalMove) {
     valids[MOVE_SKIP_IDX] = 1;
   }
+}
 
+void nichess_wrapper::GameWrapper::computeValids(uint8_t* valids) {
+  FlatGame::fromGame(game).computeValids(*agentCache, valids);
+}
+
+Vector<uint8_t> nichess_wrapper::GameWrapper::computeValids() {
+  auto valids = Vector<uint8_t>{NUM_MOVES};
+  computeValids(valids.data());
   return valids;
 }
 
 
-float pieceTypeToValueMultiplier(PieceType pt) {
+float nichess_wrapper::pieceTypeToValueMultiplier(PieceType pt) {
   switch(pt) {
     case P1_KING:
       return 1000;
@@ -565,106 +183,121 @@ float pieceTypeToValueMultiplier(PieceType pt) {
   }
 }
 
-float positionValue(Game* game, Player player) {
+float nichess_wrapper::pieceValue(PieceType pt, int healthPoints) {
+  float value = healthPoints <= 0 ? -100 * pieceTypeToValueMultiplier(pt)
+                                  : healthPoints * pieceTypeToValueMultiplier(pt);
+  return isPlayer1Piece(pt) ? value : -value;
+}
+
+float nichess_wrapper::positionValue(const Game& game) {
   float retval = 0;
-  std::vector<Piece*> p1Pieces = game->getAllPiecesByPlayer(PLAYER_1);
-  for(Piece* p : p1Pieces) {
-    if(p->healthPoints <= 0) {
-      retval -= pieceTypeToValueMultiplier(p->type) * 100;
-      continue;
+  for(int player : {PLAYER_1, PLAYER_2}) {
+    for(const Piece* p : game.playerToPieces[player]) {
+      retval += pieceValue(p->type, p->healthPoints);
     }
-    retval += pieceTypeToValueMultiplier(p->type) * p->healthPoints;
   }
-  std::vector<Piece*> p2Pieces = game->getAllPiecesByPlayer(PLAYER_2);
-  for(Piece* p : p2Pieces) {
-    if(p->healthPoints <= 0) {
-      retval += pieceTypeToValueMultiplier(p->type) * 100;
-      continue;
-    }
-    retval -= pieceTypeToValueMultiplier(p->type) * p->healthPoints;
+  return retval;
+}
+
+std::array<int, 6> nichess_wrapper::abilityOrder(int kingSquare, int abilitySrcIdx, int abilityDstIdx) {
+  const int kingColumn = kingSquare % NUM_COLUMNS;
+  std::array<int, 6> order{};
+  int i = 0;
+  for(int square : {abilitySrcIdx, abilityDstIdx}) {
+    const int column = square % NUM_COLUMNS;
+    order[i++] = square / NUM_COLUMNS;
+    order[i++] = std::abs(column - kingColumn);
+    order[i++] = std::abs(2 * column - (NUM_COLUMNS - 1));
   }
-  float m = 1;
-  if(player == PLAYER_2) m = -1;
-  return m * retval;
+  return order;
 }
 
-/*
- * Move is decided by the neural net beforehand and ability is decided by trying out every possible ability and
- * selecting greedily based on the value function.
- */
-void nichess_wrapper::GameWrapper::makeAction(uint32_t move) {
-  int moveSrcIdx, moveDstIdx;
+std::tuple<int, int> nichess_wrapper::GameWrapper::moveSrcAndDst(uint32_t move) const {
   if(move == MOVE_SKIP_IDX) {
-    moveSrcIdx = MOVE_SKIP;
-    moveDstIdx = MOVE_SKIP;
-  } else {
-    std::tuple<int, int> srcAndDst = agentCache->moveIndexToSrcSquareAndDstSquare[move];
-    moveSrcIdx = std::get<0>(srcAndDst);
-    moveDstIdx = std::get<1>(srcAndDst);
-  }
-  int abilitySrcIdx = ABILITY_SKIP;
-  int abilityDstIdx = ABILITY_SKIP;
-  if(moveSrcIdx != MOVE_SKIP) {
-    game->makeMove(moveSrcIdx, moveDstIdx);
+    return {MOVE_SKIP, MOVE_SKIP};
   }
-  // find best ability
-  std::vector<PlayerAction> actions = usefulLegalActionsWithoutMoves();
-  float bestValue = -std::numeric_limits<float>::max();
-  float currentValue;
-  Player player = game->currentPlayer;
-  for(PlayerAction pa : actions) {
-    UndoInfo undoInfo = game->makeAction(MOVE_SKIP, MOVE_SKIP, pa.abilitySrcIdx, pa.abilityDstIdx);
-    currentValue = positionValue(game, ~game->currentPlayer);
-    if(currentValue > bestValue) {
-      bestValue = currentValue;
-      abilitySrcIdx = pa.abilitySrcIdx;
-      abilityDstIdx = pa.abilityDstIdx;
-    }
-    game->undoAction(undoInfo);
-  }
-  if(moveSrcIdx != MOVE_SKIP) {
-    game->undoMove(moveSrcIdx, moveDstIdx);
-  }
-  game->makeAction(moveSrcIdx, moveDstIdx, abilitySrcIdx, abilityDstIdx);
+  return {move / NUM_MAX_POSSIBLE_MOVES_FOR_PIECE, MOVE_TABLES.moveToDst[move]};
 }
 
 /*
  * Move is decided by the neural net beforehand and ability is decided by trying out every possible ability and
  * selecting greedily based on the value function.
+ * Only the pieces an ability hit change value, so each ability is scored by the change in health of those pieces
+ * against the value before any ability, rather than by summing the whole position again.
+ * All values are whole numbers well below 2^24, so the sums are exact and this picks the same ability as a full
+ * positionValue would.
+ * Abilities with the same value are picked by abilityOrder rather than by the order pieces are stored in, so the
+ * mirrored position picks the mirrored ability.
  */
-std::string nichess_wrapper::GameWrapper::moveToPlayerAction(uint32_t move) {
-  int moveSrcIdx, moveDstIdx;
-  if(move == MOVE_SKIP_IDX) {
-    moveSrcIdx = MOVE_SKIP;
-    moveDstIdx = MOVE_SKIP;
-  } else {
-    std::tuple<int, int> srcAndDst = agentCache->moveIndexToSrcSquareAndDstSquare[move];
-    moveSrcIdx = std::get<0>(srcAndDst);
-    moveDstIdx = std::get<1>(srcAndDst);
+std::tuple<int, int> nichess_wrapper::GameWrapper::bestAbility(uint32_t move) {
+  auto [moveSrcIdx, moveDstIdx] = moveSrcAndDst(move);
+  if(moveSrcIdx != MOVE_SKIP) {
+    game.makeMove(moveSrcIdx, moveDstIdx);
   }
   int abilitySrcIdx = ABILITY_SKIP;
   int abilityDstIdx = ABILITY_SKIP;
-  if(moveSrcIdx != MOVE_SKIP) {
-    game->makeMove(moveSrcIdx, moveDstIdx);
-  }
-  // find best ability
-  std::vector<PlayerAction> actions = usefulLegalActionsWithoutMoves();
-  float bestValue = -std::numeric_limits<float>::max();
-  float currentValue;
-  Player player = game->currentPlayer;
-  for(PlayerAction pa : actions) {
-    UndoInfo undoInfo = game->makeAction(MOVE_SKIP, MOVE_SKIP, pa.abilitySrcIdx, pa.abilityDstIdx);
-    currentValue = positionValue(game, ~game->currentPlayer);
-    if(currentValue > bestValue) {
-      bestValue = currentValue;
-      abilitySrcIdx = pa.abilitySrcIdx;
-      abilityDstIdx = pa.abilityDstIdx;
+  const Player player = game.currentPlayer;
+  // If King is dead, game is over and there are no legal actions
+  if(game.playerToPieces[player][KING_PIECE_INDEX]->healthPoints > 0) {
+    // Health of every piece before the ability, to find the ones it changed.
+    std::array<std::array<int, NUM_STARTING_PIECES>, 2> health;
+    for(int pl : {PLAYER_1, PLAYER_2}) {
+      for(int k = 0; k < NUM_STARTING_PIECES; k++) {
+        health[pl][k] = game.playerToPieces[pl][k]->healthPoints;
+      }
+    }
+    const float m = player == PLAYER_1 ? 1 : -1;
+    const float baseValue = positionValue(game);
+    float bestValue = -std::numeric_limits<float>::max();
+    const int kingSquare = game.playerToPieces[player][KING_PIECE_INDEX]->squareIndex;
+    std::array<int, 6> bestOrder{};
+    for(int k = 0; k < NUM_STARTING_PIECES; k++) {
+      const Piece* cp2 = game.playerToPieces[player][k];
+      if(cp2->healthPoints <= 0) continue; // no abilities for dead pieces
+      const auto& legalAbilities = game.gameCache->pieceTypeToSquareIndexToLegalAbilities[cp2->type][cp2->squareIndex];
+      for(const auto& ability : legalAbilities) {
+        if(!isUsefulAbility(cp2->type, game.board[ability.abilityDstIdx]->type)) continue;
+        UndoInfo undoInfo = game.makeAction(MOVE_SKIP, MOVE_SKIP, ability.abilitySrcIdx, ability.abilityDstIdx);
+        float value = baseValue;
+        for(int pl : {PLAYER_1, PLAYER_2}) {
+          for(int i = 0; i < NUM_STARTING_PIECES; i++) {
+            const Piece* p = game.playerToPieces[pl][i];
+            if(p->healthPoints != health[pl][i]) {
+              value += pieceValue(p->type, p->healthPoints) - pieceValue(p->type, health[pl][i]);
+            }
+          }
+        }
+        game.undoAction(undoInfo);
+        if(m * value < bestValue) continue;
+        const auto order = abilityOrder(kingSquare, ability.abilitySrcIdx, ability.abilityDstIdx);
+        if(m * value > bestValue || order < bestOrder) {
+          bestValue = m * value;
+          bestOrder = order;
+          abilitySrcIdx = ability.abilitySrcIdx;
+          abilityDstIdx = ability.abilityDstIdx;
+        }
+      }
     }
-    game->undoAction(undoInfo);
   }
   if(moveSrcIdx != MOVE_SKIP) {
-    game->undoMove(moveSrcIdx, moveDstIdx);
+    game.undoMove(moveSrcIdx, moveDstIdx);
   }
+  return {abilitySrcIdx, abilityDstIdx};
+}
+
+void nichess_wrapper::GameWrapper::makeAction(uint32_t move, std::tuple<int, int> ability) {
+  auto [moveSrcIdx, moveDstIdx] = moveSrcAndDst(move);
+  auto [abilitySrcIdx, abilityDstIdx] = ability;
+  game.makeAction(moveSrcIdx, moveDstIdx, abilitySrcIdx, abilityDstIdx);
+}
+
+void nichess_wrapper::GameWrapper::makeAction(uint32_t move) {
+  makeAction(move, bestAbility(move));
+}
+
+std::string nichess_wrapper::GameWrapper::moveToPlayerAction(uint32_t move, std::tuple<int, int> ability) const {
+  auto [moveSrcIdx, moveDstIdx] = moveSrcAndDst(move);
+  auto [abilitySrcIdx, abilityDstIdx] = ability;
   std::string retval = "";
   retval += std::to_string(moveSrcIdx) + ".";
   retval += std::to_string(moveDstIdx) + ".";
@@ -672,3 +305,7 @@ std::string nichess_wrapper::GameWrapper::moveToPlayerAction(uint32_t move) {
   retval += std::to_string(abilityDstIdx);
   return retval;
 }
+
+std::string nichess_wrapper::GameWrapper::moveToPlayerAction(uint32_t move) {
+  return moveToPlayerAction(move, bestAbility(move));
+}
@@ -1,37 +1,178 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
 #include "shapes.h"
 #include "nichess/nichess.hpp"
-#include <vector>
+#include "nichess_constants.h"
 
 using namespace nichess;
 using namespace alphazero;
 
 namespace nichess_wrapper {
 
+using alphazero::nichess_gs::NUM_SQUARES;
+using alphazero::nichess_gs::NUM_MAX_POSSIBLE_MOVES_FOR_PIECE;
+using alphazero::nichess_gs::MOVE_SKIP_IDX;
+using alphazero::nichess_gs::NUM_MOVES;
+
+// A move index is srcSquareIndex * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + slot.
+// The first 24 slots step up to 2 squares in any direction, rows first, and
+// the last 4 jump 3 squares diagonally. Squares use the same layout as
+// nichess::coordinatesToBoardIndex.
+struct MoveTables {
+  // Destination square of each move, or -1 if it leaves the board.
+  std::array<int8_t, MOVE_SKIP_IDX> moveToDst{};
+  // Move index from each source to each destination, or -1 if there is none.
+  std::array<std::array<int16_t, NUM_SQUARES>, NUM_SQUARES> srcDstToMove{};
+  // Each move mirrored left to right. MOVE_SKIP_IDX maps to itself.
+  std::array<int16_t, NUM_MOVES> mirroredMove{};
+};
+
+constexpr MoveTables makeMoveTables() {
+  std::array<std::array<int, 2>, NUM_MAX_POSSIBLE_MOVES_FOR_PIECE> offsets{};
+  int n = 0;
+  for(int dy = -2; dy < 3; dy++) {
+    for(int dx = -2; dx < 3; dx++) {
+      if(dx == 0 && dy == 0) continue;
+      offsets[n++] = {dx, dy};
+    }
+  }
+  offsets[n++] = {3, 3};
+  offsets[n++] = {3, -3};
+  offsets[n++] = {-3, 3};
+  offsets[n++] = {-3, -3};
+
+  MoveTables tables{};
+  for(auto& dsts : tables.srcDstToMove) {
+    for(auto& move : dsts) move = -1;
+  }
+  for(int src = 0; src < NUM_SQUARES; src++) {
+    for(int slot = 0; slot < NUM_MAX_POSSIBLE_MOVES_FOR_PIECE; slot++) {
+      const int move = src * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + slot;
+      const int x = src % nichess::NUM_COLUMNS + offsets[slot][0];
+      const int y = src / nichess::NUM_COLUMNS + offsets[slot][1];
+      if(x < 0 || x >= nichess::NUM_COLUMNS || y < 0 || y >= nichess::NUM_ROWS) {
+        tables.moveToDst[move] = -1;
+        continue;
+      }
+      const int dst = y * nichess::NUM_COLUMNS + x;
+      tables.moveToDst[move] = dst;
+      tables.srcDstToMove[src][dst] = move;
+    }
+  }
+
+  // Mirroring negates dx, which swaps the slots of (dx, dy) and (-dx, dy).
+  std::array<int, NUM_MAX_POSSIBLE_MOVES_FOR_PIECE> mirroredSlot{};
+  for(int slot = 0; slot < NUM_MAX_POSSIBLE_MOVES_FOR_PIECE; slot++) {
+    for(int other = 0; other < NUM_MAX_POSSIBLE_MOVES_FOR_PIECE; other++) {
+      if(offsets[other][0] == -offsets[slot][0] && offsets[other][1] == offsets[slot][1]) {
+        mirroredSlot[slot] = other;
+      }
+    }
+  }
+  for(int src = 0; src < NUM_SQUARES; src++) {
+    const int mirroredSrc = src - src % nichess::NUM_COLUMNS + (nichess::NUM_COLUMNS - 1 - src % nichess::NUM_COLUMNS);
+    for(int slot = 0; slot < NUM_MAX_POSSIBLE_MOVES_FOR_PIECE; slot++) {
+      tables.mirroredMove[src * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + slot] =
+          mirroredSrc * NUM_MAX_POSSIBLE_MOVES_FOR_PIECE + mirroredSlot[slot];
+    }
+  }
+  tables.mirroredMove[MOVE_SKIP_IDX] = MOVE_SKIP_IDX;
+  return tables;
+}
+
+inline constexpr MoveTables MOVE_TABLES = makeMoveTables();
+
+bool isPlayer1Piece(PieceType pt);
+bool isPlayer2Piece(PieceType pt);
+// Whether an ability from srcType on dstType can change the game, which is
+// only the case on an enemy piece.
+bool isUsefulAbility(PieceType srcType, PieceType dstType);
+float pieceTypeToValueMultiplier(PieceType pt);
+// Value of a piece with the given health, from player 1's point of view.
+float pieceValue(PieceType pt, int healthPoints);
+// Sum of pieceValue over both players' pieces, from player 1's point of view.
+float positionValue(const Game& game);
+// Orders abilities by their squares in a way that mirroring the board left to
+// right keeps, given the square of the current player's king. Each square is
+// ordered by its row, its distance from the king's column, and its distance
+// from the middle. No column is in the middle, so no two squares tie.
+std::array<int, 6> abilityOrder(int kingSquare, int abilitySrcIdx, int abilityDstIdx);
+
 class AgentCache {
   public:
-      std::vector<std::tuple<int,int>> moveIndexToSrcSquareAndDstSquare;
-      std::vector<std::vector<int>> srcSquareToDstSquareToMoveIndex;
+      // Bit n is set if slot n is a legal move for the piece type from the
+      // square on an empty board. Built once from the library's GameCache.
+      std::vector<std::array<uint32_t, NUM_SQUARES>> pieceTypeToSquareIndexToMoveSlots;
+
+      AgentCache(const nichess::GameCache& gameCache);
+};
+
+struct FlatSquare {
+  int16_t healthPoints = 0;
+  int8_t type = NO_PIECE;
+
+  bool operator==(const FlatSquare& other) const {
+    return healthPoints == other.healthPoints && type == other.type;
+  }
+  bool operator!=(const FlatSquare& other) const { return !(*this == other); }
+};
 
-      AgentCache();
+struct FlatPiece {
+  int16_t healthPoints = 0;
+  int8_t type = NO_PIECE;
+  int8_t squareIndex = 0;
 };
 
+// A trivially copyable image of a Game: what is on each square, and each
+// player's pieces in the library's order. Positions are read from it without
+// chasing the Game's Piece pointers, and copying it never allocates.
+// Abilities are still applied and scored by the library on a Game.
+struct FlatGame {
+  std::array<FlatSquare, NUM_SQUARES> board{};
+  std::array<std::array<FlatPiece, NUM_STARTING_PIECES>, 2> playerToPieces{};
+  int16_t moveNumber = 0;
+  int8_t currentPlayer = PLAYER_1;
+  // The player that won, or -1 while the game is on.
+  int8_t winner = -1;
+
+  static FlatGame fromGame(Game& game);
+  // Writes the valid moves into valids, which must hold NUM_MOVES values.
+  void computeValids(const AgentCache& agentCache, uint8_t* valids) const;
+};
+
+static_assert(std::is_trivially_copyable_v<FlatGame>);
+
+// Holds the game by value, so copying a wrapper is a single Game copy with
+// no extra heap allocations.
 class GameWrapper {
   public:
-    Game* game;
-    AgentCache* agentCache;
+    Game game;
+    const AgentCache* agentCache;
 
-    GameWrapper(nichess::GameCache& gameCache, AgentCache& agentCache);
-    GameWrapper(nichess::GameCache& gameCache, AgentCache& agentCache, const std::string encodedBoard);
-    GameWrapper(const GameWrapper& other);
-    GameWrapper(const std::unique_ptr<nichess_wrapper::GameWrapper>& other);
-    ~GameWrapper();
+    GameWrapper(nichess::GameCache& gameCache, const AgentCache& agentCache);
+    GameWrapper(nichess::GameCache& gameCache, const AgentCache& agentCache, const std::string encodedBoard);
+    GameWrapper(const GameWrapper& other) = default;
+    // Game fixes up its piece pointers when copy constructed. Assigning could
+    // leave them pointing into the other game.
+    GameWrapper& operator=(const GameWrapper& other) = delete;
 
-    std::vector<PlayerAction> usefulLegalActionsWithoutMoves();
     std::vector<PlayerMove> legalMovesByPiece(Piece* piece) const;
-    Vector<uint8_t> computeValids() const;
+    // Writes the valid moves into valids, which must hold NUM_MOVES values.
+    void computeValids(uint8_t* valids);
+    Vector<uint8_t> computeValids();
+    // Source and destination squares of a move index.
+    std::tuple<int, int> moveSrcAndDst(uint32_t move) const;
+    // The ability to use after move, as abilitySrcIdx, abilityDstIdx.
+    std::tuple<int, int> bestAbility(uint32_t move);
+    void makeAction(uint32_t move, std::tuple<int, int> ability);
     void makeAction(uint32_t move);
+    std::string moveToPlayerAction(uint32_t move, std::tuple<int, int> ability) const;
     std::string moveToPlayerAction(uint32_t move);
 };
 
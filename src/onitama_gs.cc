@@ -1,29 +1,122 @@
 #include "onitama_gs.h"
 
+#include "bitboard.h"
+#include "zobrist.h"
+
 namespace alphazero::onitama_gs {
 
-[[nodiscard]] std::unique_ptr<GameState> OnitamaGS::copy() const noexcept {
-  return std::make_unique<OnitamaGS>(board_, player_, p0_card0_, p0_card1_,
-                                     p1_card0_, p1_card1_, waiting_card_, turn_,
-                                     num_cards_, max_turns_);
-}
+constexpr const int SQUARES = WIDTH * HEIGHT;
+// Moves are indexed card * CARD_MOVES + from * SQUARES + to.
+constexpr const int CARD_MOVES = SQUARES * SQUARES;
 
-[[nodiscard]] bool OnitamaGS::operator==(
-    const GameState& other) const noexcept {
-  const auto* other_cs = dynamic_cast<const OnitamaGS*>(&other);
-  if (other_cs == nullptr) {
-    return false;
+// The square each master must reach, where the other master starts.
+constexpr const Mask P0_GOAL = square_bit(HEIGHT - 1, WIDTH / 2);
+constexpr const Mask P1_GOAL = square_bit(0, WIDTH / 2);
+
+using MoveTable =
+    std::array<std::array<std::array<Mask, SQUARES>, NUM_PLAYERS>, NUM_CARDS>;
+
+// Squares a piece on each square can reach with each card, for each player.
+// Card images are drawn for player 1 at the bottom of the board. Player 0
+// uses them rotated.
+constexpr MoveTable make_move_table() {
+  auto table = MoveTable{};
+  for (auto c = 0; c < NUM_CARDS; ++c) {
+    const auto& image = CARD_SPECS[c].image;
+    for (auto player = 0; player < NUM_PLAYERS; ++player) {
+      const auto dir = player == 0 ? -1 : 1;
+      for (auto s = 0; s < SQUARES; ++s) {
+        auto targets = Mask{0};
+        for (auto h = 0; h < HEIGHT; ++h) {
+          for (auto w = 0; w < WIDTH; ++w) {
+            if (image[h][w] != 1) {
+              continue;
+            }
+            const auto to_h = s / WIDTH + dir * (h - HEIGHT / 2);
+            const auto to_w = s % WIDTH + dir * (w - WIDTH / 2);
+            if (to_h >= 0 && to_h < HEIGHT && to_w >= 0 && to_w < WIDTH) {
+              targets |= square_bit(to_h, to_w);
+            }
+          }
+        }
+        table[c][player][s] = targets;
+      }
+    }
   }
+  return table;
+}
+constexpr const MoveTable MOVE_TABLE = make_move_table();
+
+// Card slots in key order: each player's two cards, then the waiting card.
+constexpr const int WAITING_SLOT = 4;
+constexpr const int PIECE_KEYS = PIECE_TYPES * HEIGHT * WIDTH;
+constexpr const int CARD_KEYS = (WAITING_SLOT + 1) * NUM_CARDS;
+
+// A key for each piece type on each square, then for each card in each slot,
+// then one for player 1 to move.
+constexpr const auto ZOBRIST_KEYS =
+    zobrist::make_keys<PIECE_KEYS + CARD_KEYS + 1>(0x0a1);
+constexpr const auto P1_TO_MOVE_KEY = ZOBRIST_KEYS[PIECE_KEYS + CARD_KEYS];
+
+constexpr uint64_t piece_key(int p, int square) {
+  return ZOBRIST_KEYS[p * SQUARES + square];
+}
+
+constexpr uint64_t card_key(int slot, int card) {
+  return ZOBRIST_KEYS[PIECE_KEYS + slot * NUM_CARDS + card];
+}
+
+OnitamaGS::OnitamaGS(const BoardTensor& board, int8_t player,
+                     int8_t p0_card1, int8_t p0_card2, int8_t p1_card1,
+                     int8_t p1_card2, int8_t waiting_card, uint16_t turn,
+                     uint8_t num_cards, uint16_t max_turns)
+    : turn_(turn),
+      num_cards_(num_cards),
+      max_turns_(max_turns),
+      player_(player),
+      p0_card0_(p0_card1),
+      p0_card1_(p0_card2),
+      p1_card0_(p1_card1),
+      p1_card1_(p1_card2),
+      waiting_card_(waiting_card) {
   for (auto p = 0; p < PIECE_TYPES; ++p) {
     for (auto h = 0; h < HEIGHT; ++h) {
       for (auto w = 0; w < WIDTH; ++w) {
-        if (other_cs->board_(p, h, w) != board_(p, h, w)) {
-          return false;
+        if (board(p, h, w) == 1) {
+          pieces_[p] |= square_bit(h, w);
         }
       }
     }
   }
-  return (other_cs->player_ == player_ && other_cs->p0_card0_ == p0_card0_ &&
+  key_ = state_key();
+}
+
+[[nodiscard]] uint64_t OnitamaGS::state_key() const noexcept {
+  auto key = player_ == 1 ? P1_TO_MOVE_KEY : 0;
+  for (auto p = 0; p < PIECE_TYPES; ++p) {
+    auto pieces = pieces_[p];
+    while (pieces != 0) {
+      key ^= piece_key(p, bitboard::pop_lsb(pieces));
+    }
+  }
+  key ^= card_key(0, p0_card0_) ^ card_key(1, p0_card1_) ^
+         card_key(2, p1_card0_) ^ card_key(3, p1_card1_) ^
+         card_key(WAITING_SLOT, waiting_card_);
+  return key;
+}
+
+[[nodiscard]] std::unique_ptr<GameState> OnitamaGS::copy() const noexcept {
+  return std::make_unique<OnitamaGS>(*this);
+}
+
+[[nodiscard]] bool OnitamaGS::operator==(
+    const GameState& other) const noexcept {
+  const auto* other_cs = dynamic_cast<const OnitamaGS*>(&other);
+  if (other_cs == nullptr || other_cs->key_ != key_) {
+    return false;
+  }
+  return (other_cs->pieces_ == pieces_ && other_cs->player_ == player_ &&
+          other_cs->p0_card0_ == p0_card0_ &&
           other_cs->p0_card1_ == p0_card1_ &&
           other_cs->p1_card0_ == p1_card0_ &&
           other_cs->p1_card1_ == p1_card1_ &&
@@ -31,10 +124,7 @@ namespace alphazero::onitama_gs {
 }
 
 void OnitamaGS::hash(absl::HashState h) const {
-  h = absl::HashState::combine_contiguous(std::move(h), board_.data(),
-                                          board_.size());
-  absl::HashState::combine(std::move(h), player_, p0_card0_, p0_card1_,
-                           p1_card0_, p1_card1_, waiting_card_);
+  absl::HashState::combine(std::move(h), key_);
 }
 
 [[nodiscard]] std::pair<const int8_t*, const int8_t*> OnitamaGS::player_cards(
@@ -61,35 +151,19 @@ void OnitamaGS::hash(absl::HashState h) const {
 
   bool has_move = false;
   auto [card0, card1] = player_cards(player_);
-  int8_t master_layer = (player_ == 0) ? P0_MASTER_LAYER : P1_MASTER_LAYER;
-  int8_t pawn_layer = (player_ == 0) ? P0_PAWN_LAYER : P1_PAWN_LAYER;
-  int move_mult = (player_ == 0) ? 1 : -1;
+  const auto own = (player_ == 0)
+                       ? pieces_[P0_MASTER_LAYER] | pieces_[P0_PAWN_LAYER]
+                       : pieces_[P1_MASTER_LAYER] | pieces_[P1_PAWN_LAYER];
   for (int ci = 0; ci < 2; ++ci) {
-    const auto& card = (ci == 0) ? CARDS[*card0] : CARDS[*card1];
-    for (int from_h = 0; from_h < HEIGHT; ++from_h) {
-      for (int from_w = 0; from_w < WIDTH; ++from_w) {
-        if (board_(master_layer, from_h, from_w) == 1 ||
-            board_(pawn_layer, from_h, from_w) == 1) {
-          for (const auto& move : card.movements) {
-            int to_h = from_h + move.first * move_mult;
-            int to_w = from_w + move.second * move_mult;
-            if (to_h < 0 || to_h >= HEIGHT) {
-              continue;
-            }
-            if (to_w < 0 || to_w >= WIDTH) {
-              continue;
-            }
-            if (board_(master_layer, to_h, to_w) == 1 ||
-                board_(pawn_layer, to_h, to_w) == 1) {
-              continue;
-            }
-            has_move = true;
-            int index = ci * (WIDTH * HEIGHT * WIDTH * HEIGHT) +
-                        from_h * (WIDTH * HEIGHT * WIDTH) +
-                        from_w * (WIDTH * HEIGHT) + to_h * WIDTH + to_w;
-            valids(index) = 1;
-          }
-        }
+    const auto& targets = MOVE_TABLE[(ci == 0) ? *card0 : *card1][player_];
+    auto from = own;
+    while (from != 0) {
+      const auto from_square = bitboard::pop_lsb(from);
+      auto to = targets[from_square] & ~own;
+      has_move |= to != 0;
+      while (to != 0) {
+        const auto to_square = bitboard::pop_lsb(to);
+        valids(ci * CARD_MOVES + from_square * SQUARES + to_square) = 1;
       }
     }
   }
@@ -107,10 +181,16 @@ void OnitamaGS::play_move(uint32_t move) {
   }
   auto [card0, card1] = player_cards(player_);
   auto* swap_card = card1;
-  if (move < WIDTH * HEIGHT * WIDTH * HEIGHT || move == NUM_MOVES - 2) {
+  auto swap_slot = 2 * player_ + 1;
+  if (move < CARD_MOVES || move == NUM_MOVES - 2) {
     swap_card = card0;
+    swap_slot = 2 * player_;
   }
+  key_ ^= card_key(swap_slot, *swap_card) ^
+          card_key(WAITING_SLOT, waiting_card_);
   std::swap(waiting_card_, *swap_card);
+  key_ ^= card_key(swap_slot, *swap_card) ^
+          card_key(WAITING_SLOT, waiting_card_) ^ P1_TO_MOVE_KEY;
   player_ = (player_ + 1) % 2;
   ++turn_;
   if (move >= NUM_MOVES - 2) {
@@ -118,17 +198,24 @@ void OnitamaGS::play_move(uint32_t move) {
     return;
   }
 
-  uint32_t actual_move = move % (WIDTH * HEIGHT * WIDTH * HEIGHT);
-  int8_t to_w = actual_move % WIDTH;
-  actual_move /= WIDTH;
-  int8_t to_h = actual_move % HEIGHT;
-  actual_move /= HEIGHT;
-  int8_t from_w = actual_move % WIDTH;
-  int8_t from_h = actual_move / WIDTH;
+  const auto actual_move = move % CARD_MOVES;
+  const auto from_square = actual_move / SQUARES;
+  const auto to_square = actual_move % SQUARES;
+  const auto from = Mask{1} << from_square;
+  const auto to = Mask{1} << to_square;
 
   for (int p = 0; p < PIECE_TYPES; ++p) {
-    board_(p, to_h, to_w) = board_(p, from_h, from_w);
-    board_(p, from_h, from_w) = 0;
+    // Captures.
+    if ((pieces_[p] & to) != 0) {
+      key_ ^= piece_key(p, to_square);
+      pieces_[p] &= ~to;
+    }
+  }
+  for (int p = 0; p < PIECE_TYPES; ++p) {
+    if ((pieces_[p] & from) != 0) {
+      key_ ^= piece_key(p, from_square) ^ piece_key(p, to_square);
+      pieces_[p] ^= from | to;
+    }
   }
 }
 
@@ -136,29 +223,21 @@ void OnitamaGS::play_move(uint32_t move) {
   auto scores = SizedVector<float, 3>{};
   scores.setZero();
   // P0 has lower thrown.
-  if (board_(P0_MASTER_LAYER, 4, 2) == 1) {
+  if ((pieces_[P0_MASTER_LAYER] & P0_GOAL) != 0) {
     scores(0) = 1;
     return scores;
   }
   // P1 has upper thrown.
-  if (board_(P1_MASTER_LAYER, 0, 2) == 1) {
+  if ((pieces_[P1_MASTER_LAYER] & P1_GOAL) != 0) {
     scores(1) = 1;
     return scores;
   }
 
-  int8_t p0_has_master = 0;
-  int8_t p1_has_master = 0;
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      p0_has_master += board_(P0_MASTER_LAYER, h, w);
-      p1_has_master += board_(P1_MASTER_LAYER, h, w);
-    }
-  }
-  if (p0_has_master == 0) {
+  if (pieces_[P0_MASTER_LAYER] == 0) {
     scores(1) = 1;
     return scores;
   }
-  if (p1_has_master == 0) {
+  if (pieces_[P1_MASTER_LAYER] == 0) {
     scores(0) = 1;
     return scores;
   }
@@ -170,36 +249,21 @@ void OnitamaGS::play_move(uint32_t move) {
   return std::nullopt;
 }
 
-[[nodiscard]] Tensor<float, 3> OnitamaGS::canonicalized() const noexcept {
-  auto out = CanonicalTensor{};
+void OnitamaGS::canonicalize_into(float* data) const noexcept {
+  auto out = sized_tensor_map<CanonicalTensor>(data);
+  out.setZero();
   for (auto p = 0; p < PIECE_TYPES; ++p) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(p, h, w) = board_(p, h, w);
-      }
+    auto pieces = pieces_[p];
+    while (pieces != 0) {
+      const auto s = bitboard::pop_lsb(pieces);
+      out(p, s / WIDTH, s % WIDTH) = 1;
     }
   }
 
   int offset = PIECE_TYPES;
-  auto p = player_ + offset;
-  auto op = (player_ + 1) % 2 + offset;
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      out(p, h, w) = 1;
-      out(op, h, w) = 0;
-    }
-  }
+  out.chip(player_ + offset, 0).setConstant(1);
   offset += 2;
 
-  // Zero card planes before setting specific indices.
-  for (auto i = 0; i < 10; ++i) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(offset + i, h, w) = 0;
-      }
-    }
-  }
-
   for (const auto& card_index :
        {p0_card0_, p0_card1_, waiting_card_, p1_card0_, p1_card1_}) {
     const auto& card = CARDS[card_index];
@@ -210,7 +274,12 @@ void OnitamaGS::play_move(uint32_t move) {
     }
     ++offset;
   }
+}
 
+[[nodiscard]] Tensor<float, 3> OnitamaGS::canonicalized() const noexcept {
+  auto out = Tensor<float, 3>{CANONICAL_SHAPE[0], CANONICAL_SHAPE[1],
+                              CANONICAL_SHAPE[2]};
+  canonicalize_into(out.data());
   return out;
 }
 
@@ -220,6 +289,7 @@ void OnitamaGS::play_move(uint32_t move) {
                 "this function must be updated when dimensions change");
   PlayHistory mirror;
   mirror.v = base.v;
+  mirror.weight = base.weight;
   mirror.canonical = CanonicalTensor{};
   for (auto p = 0; p < PIECE_TYPES; ++p) {
     for (auto h = 0; h < HEIGHT; ++h) {
@@ -325,13 +395,14 @@ void OnitamaGS::play_move(uint32_t move) {
   // TODO: add option to display cards here.
   for (auto h = 0; h < HEIGHT; ++h) {
     for (auto w = 0; w < WIDTH; ++w) {
-      if (board_(P0_MASTER_LAYER, h, w) == 1) {
+      const auto square = square_bit(h, w);
+      if ((pieces_[P0_MASTER_LAYER] & square) != 0) {
         out += 'X';
-      } else if (board_(P0_PAWN_LAYER, h, w) == 1) {
+      } else if ((pieces_[P0_PAWN_LAYER] & square) != 0) {
         out += 'x';
-      } else if (board_(P1_MASTER_LAYER, h, w) == 1) {
+      } else if ((pieces_[P1_MASTER_LAYER] & square) != 0) {
         out += 'O';
-      } else if (board_(P1_PAWN_LAYER, h, w) == 1) {
+      } else if ((pieces_[P1_PAWN_LAYER] & square) != 0) {
         out += 'o';
       } else {
         out += '.';
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <random>
 #include <string_view>
 
 #include "dll_export.h"
@@ -306,6 +307,13 @@ using CanonicalTensor =
     SizedTensor<float, Eigen::Sizes<CANONICAL_SHAPE[0], CANONICAL_SHAPE[1],
                                     CANONICAL_SHAPE[2]>>;
 
+// One bit per square, indexed by h * WIDTH + w.
+using Mask = uint32_t;
+
+[[nodiscard]] constexpr Mask square_bit(int h, int w) noexcept {
+  return Mask{1} << (h * WIDTH + w);
+}
+
 class DLLEXPORT OnitamaGS : public GameState {
  public:
   OnitamaGS(uint8_t num_cards = 16, uint16_t max_turns = DEFAULT_MAX_TURNS)
@@ -313,52 +321,27 @@ class DLLEXPORT OnitamaGS : public GameState {
     assert((num_cards == 8 || num_cards == 16 || num_cards == 24 ||
             num_cards == 32) &&
            "onitama must be played with 8 (simplified) or 16 (full) cards");
-    board_.setZero();
-
     // Masters
-    board_(P0_MASTER_LAYER, 0, 2) = 1;
-    board_(P1_MASTER_LAYER, 4, 2) = 1;
+    pieces_[P0_MASTER_LAYER] = square_bit(0, 2);
+    pieces_[P1_MASTER_LAYER] = square_bit(4, 2);
     // Pawns
-    board_(P0_PAWN_LAYER, 0, 0) = 1;
-    board_(P0_PAWN_LAYER, 0, 1) = 1;
-    board_(P0_PAWN_LAYER, 0, 3) = 1;
-    board_(P0_PAWN_LAYER, 0, 4) = 1;
-    board_(P1_PAWN_LAYER, 4, 0) = 1;
-    board_(P1_PAWN_LAYER, 4, 1) = 1;
-    board_(P1_PAWN_LAYER, 4, 3) = 1;
-    board_(P1_PAWN_LAYER, 4, 4) = 1;
+    pieces_[P0_PAWN_LAYER] = square_bit(0, 0) | square_bit(0, 1) |
+                             square_bit(0, 3) | square_bit(0, 4);
+    pieces_[P1_PAWN_LAYER] = square_bit(4, 0) | square_bit(4, 1) |
+                             square_bit(4, 3) | square_bit(4, 4);
 
     randomize_start();
   }
-  OnitamaGS(BoardTensor board, int8_t player, int8_t p0_card1, int8_t p0_card2,
-            int8_t p1_card1, int8_t p1_card2, int8_t waiting_card,
-            uint16_t turn, uint8_t num_cards, uint16_t max_turns)
-      : board_(board),
-        turn_(turn),
-        num_cards_(num_cards),
-        max_turns_(max_turns),
-        player_(player),
-        p0_card0_(p0_card1),
-        p0_card1_(p0_card2),
-        p1_card0_(p1_card1),
-        p1_card1_(p1_card2),
-        waiting_card_(waiting_card) {}
-  OnitamaGS(BoardTensor&& board, int8_t player, int8_t p0_card1,
+  OnitamaGS(const BoardTensor& board, int8_t player, int8_t p0_card1,
             int8_t p0_card2, int8_t p1_card1, int8_t p1_card2,
             int8_t waiting_card, uint16_t turn, uint8_t num_cards,
-            uint16_t max_turns)
-      : board_(std::move(board)),
-        turn_(turn),
-        num_cards_(num_cards),
-        max_turns_(max_turns),
-        player_(player),
-        p0_card0_(p0_card1),
-        p0_card1_(p0_card2),
-        p1_card0_(p1_card1),
-        p1_card1_(p1_card2),
-        waiting_card_(waiting_card) {}
+            uint16_t max_turns);
 
   void randomize_start() noexcept override {
+    randomize_start(std::random_device{}());
+  }
+
+  void randomize_start(uint64_t seed) noexcept override {
     // Randomly select 5 cards to play with.
     std::vector<int8_t> permutation;
     permutation.reserve(num_cards_);
@@ -366,8 +349,7 @@ class DLLEXPORT OnitamaGS : public GameState {
       permutation.push_back(i);
     }
 
-    std::random_device rd;
-    std::mt19937 g(rd());
+    std::mt19937_64 g(seed);
 
     std::shuffle(permutation.begin(), permutation.end(), g);
 
@@ -378,12 +360,16 @@ class DLLEXPORT OnitamaGS : public GameState {
     waiting_card_ = permutation[4];
 
     player_ = CARDS[waiting_card_].starting_player;
+    key_ = state_key();
   }
 
   [[nodiscard]] std::unique_ptr<GameState> copy() const noexcept override;
   [[nodiscard]] bool operator==(const GameState& other) const noexcept override;
 
   void hash(absl::HashState h) const override;
+  [[nodiscard]] uint64_t fingerprint() const noexcept override {
+    return key_;
+  }
 
   // Returns the current player. Players must be 0 indexed.
   [[nodiscard]] uint8_t current_player() const noexcept override {
@@ -421,6 +407,10 @@ class DLLEXPORT OnitamaGS : public GameState {
 
   // Returns the canonicalized form of the board, ready for feeding to a NN.
   [[nodiscard]] Tensor<float, 3> canonicalized() const noexcept override;
+  [[nodiscard]] std::array<int, 3> canonical_shape() const noexcept override {
+    return CANONICAL_SHAPE;
+  }
+  void canonicalize_into(float* data) const noexcept override;
 
   // Returns the number of symmetries the game has.
   [[nodiscard]] uint8_t num_symmetries() const noexcept override {
@@ -451,9 +441,8 @@ class DLLEXPORT OnitamaGS : public GameState {
   [[nodiscard]] Card waiting_card() { return CARDS[waiting_card_]; }
 
  private:
-  // Board contains a layer for each player.
-  // A 0 means no piece, a 1 means a piece for that player.
-  BoardTensor board_{};
+  // The squares holding each piece type, indexed by layer.
+  std::array<Mask, PIECE_TYPES> pieces_{};
   uint16_t turn_{0};
   uint8_t num_cards_;
   uint16_t max_turns_;
@@ -463,6 +452,10 @@ class DLLEXPORT OnitamaGS : public GameState {
   int8_t p1_card0_;
   int8_t p1_card1_;
   int8_t waiting_card_;
+  // Zobrist key of the board, cards, and player, updated by play_move.
+  uint64_t key_{0};
+
+  [[nodiscard]] uint64_t state_key() const noexcept;
 };
 
 }  // namespace alphazero::onitama_gs
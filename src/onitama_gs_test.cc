@@ -0,0 +1,76 @@
+#include "onitama_gs.h"
+
+#include "game_state_digest.h"
+#include "gtest/gtest.h"
+
+namespace alphazero::onitama_gs {
+namespace {
+
+OnitamaGS seeded_start(uint8_t num_cards, uint64_t seed) {
+  auto gs = OnitamaGS{num_cards};
+  gs.randomize_start(seed);
+  return gs;
+}
+
+// NOLINTNEXTLINE
+TEST(OnitamaGS, MasterCaptured) {
+  auto board = BoardTensor{};
+  board.setZero();
+  board(P0_MASTER_LAYER, 1, 2) = 1;
+  board(P1_MASTER_LAYER, 3, 2) = 1;
+  board(P1_PAWN_LAYER, 2, 2) = 1;
+  const auto gs = OnitamaGS{board, 1, 1, 2, 0, 3, 4, 10, 16, DEFAULT_MAX_TURNS};
+  EXPECT_FALSE(gs.scores().has_value());
+
+  const auto from = 3 * WIDTH + 2;
+  const auto to = 1 * WIDTH + 2;
+  // TIGER is the first card of player 1.
+  const auto capture = from * WIDTH * HEIGHT + to;
+  const auto valids = gs.valid_moves();
+  ASSERT_EQ(valids(capture), 1);
+  auto next = gs.copy();
+  next->play_move(capture);
+  auto expected = std::optional<SizedVector<float, 3>>{};
+  expected = {0, 1, 0};
+  EXPECT_EQ(next->scores(), expected);
+}
+
+// NOLINTNEXTLINE
+TEST(OnitamaGS, MasterOnGoal) {
+  auto board = BoardTensor{};
+  board.setZero();
+  board(P0_MASTER_LAYER, HEIGHT - 1, WIDTH / 2) = 1;
+  board(P1_MASTER_LAYER, 2, 0) = 1;
+  const auto gs = OnitamaGS{board, 1, 0, 1, 2, 3, 4, 10, 16, DEFAULT_MAX_TURNS};
+  auto expected = std::optional<SizedVector<float, 3>>{};
+  expected = {1, 0, 0};
+  EXPECT_EQ(gs.scores(), expected);
+}
+
+// Golden values were recorded from the tensor based implementation that the
+// bitboards replaced.
+// NOLINTNEXTLINE
+TEST(OnitamaGS, Perft) {
+  auto gs = seeded_start(16, 1);
+  EXPECT_EQ(perft(gs, 1), 14);
+  EXPECT_EQ(perft(gs, 2), 112);
+  EXPECT_EQ(perft(gs, 3), 1232);
+  EXPECT_EQ(perft(gs, 4), 17488);
+
+  gs = seeded_start(32, 2);
+  EXPECT_EQ(perft(gs, 1), 10);
+  EXPECT_EQ(perft(gs, 2), 60);
+  EXPECT_EQ(perft(gs, 3), 888);
+  EXPECT_EQ(perft(gs, 4), 8100);
+}
+
+// NOLINTNEXTLINE
+TEST(OnitamaGS, PlayoutDigest) {
+  EXPECT_EQ(playout_digest(seeded_start(16, 1), 200, 1), 0x9e7f03942a917957);
+  EXPECT_EQ(playout_digest(seeded_start(32, 1), 200, 1), 0x401799b2bea5209e);
+  EXPECT_EQ(playout_digest(seeded_start(16, 2), 200, 2), 0xc5588d3b2219b1df);
+  EXPECT_EQ(playout_digest(seeded_start(32, 3), 200, 3), 0x472127ec754bcac3);
+}
+
+}  // namespace
+}  // namespace alphazero::onitama_gs
@@ -1,16 +1,47 @@
 #include "opentafl_gs.h"
 
-#include <deque>
-
+#include "bitboard.h"
 #include "color.h"
 #include "tafl_helper.h"
+#include "zobrist.h"
 
 namespace alphazero::opentafl_gs {
 
+using Board = bitboard::Board<bitboard::Mask128, WIDTH, HEIGHT>;
+using bitboard::Mask128;
+using bitboard::NUM_DIRECTIONS;
+
+const auto THRONE = Board::bit(5, 5);
+const auto CORNERS = Board::TABLES.corners;
+const auto EDGES = Board::TABLES.edges;
+
+OpenTaflGS::OpenTaflGS(uint16_t max_turns) : max_turns_(max_turns) {
+  // King
+  board_.king = Board::bit(5, 5);
+
+  // Defenders
+  board_.def = Board::bit(3, 5) | Board::bit(4, 5) | Board::bit(5, 4) |
+               Board::bit(5, 3) | Board::bit(6, 5) | Board::bit(7, 5) |
+               Board::bit(5, 6) | Board::bit(5, 7);
+
+  board_.def |= Board::bit(4, 4) | Board::bit(4, 6) | Board::bit(6, 4) |
+                Board::bit(6, 6);
+
+  // Attackers
+  board_.atk = Board::bit(0, 3) | Board::bit(0, 4) | Board::bit(0, 5) |
+               Board::bit(0, 6) | Board::bit(0, 7) | Board::bit(1, 5) |
+               Board::bit(10, 3) | Board::bit(10, 4) | Board::bit(10, 5) |
+               Board::bit(10, 6) | Board::bit(10, 7) | Board::bit(9, 5) |
+               Board::bit(3, 0) | Board::bit(4, 0) | Board::bit(5, 0) |
+               Board::bit(6, 0) | Board::bit(7, 0) | Board::bit(5, 1) |
+               Board::bit(3, 10) | Board::bit(4, 10) | Board::bit(5, 10) |
+               Board::bit(6, 10) | Board::bit(7, 10) | Board::bit(5, 9);
+
+  key_ = tafl_bitboard::position_key(board_, player_);
+}
+
 [[nodiscard]] std::unique_ptr<GameState> OpenTaflGS::copy() const noexcept {
-  return std::make_unique<OpenTaflGS>(board_, player_, turn_, max_turns_,
-                                      current_repetition_count_,
-                                      repetition_counts_, board_intern_);
+  return std::make_unique<OpenTaflGS>(*this);
 }
 
 [[nodiscard]] bool OpenTaflGS::operator==(const GameState& other) const
@@ -19,125 +50,40 @@ namespace alphazero::opentafl_gs {
   if (other_cs == nullptr) {
     return false;
   }
-  for (auto p = 0; p < 3; ++p) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        if (other_cs->board_(p, h, w) != board_(p, h, w)) {
-          return false;
-        }
-      }
-    }
-  }
-  return (other_cs->player_ == player_ &&
+  return (other_cs->key_ == key_ && other_cs->board_ == board_ &&
+          other_cs->player_ == player_ &&
           other_cs->current_repetition_count_ == current_repetition_count_ &&
           other_cs->turn_ == turn_);
 }
 
 void OpenTaflGS::hash(absl::HashState h) const {
-  h = absl::HashState::combine_contiguous(std::move(h), board_.data(),
-                                          board_.size());
-  absl::HashState::combine(std::move(h), player_, turn_,
-                           current_repetition_count_);
-}
-
-uint8_t piece_to_player(const BoardTensor& bt, uint8_t target_h,
-                        uint8_t target_w) {
-  if (bt(ATK_LAYER, target_h, target_w) == 1) {
-    return ATK_PLAYER;
-  } else if (bt(KING_LAYER, target_h, target_w) == 1 ||
-             bt(DEF_LAYER, target_h, target_w) == 1) {
-    return DEF_PLAYER;
-  }
-
-  throw std::runtime_error{
-      "piece to player called on a square without pieces...rip"};
+  absl::HashState::combine(std::move(h), fingerprint());
 }
 
-bool is_players_piece(const BoardTensor& bt, uint8_t player, int target_h,
-                      int target_w) {
-  return (player == DEF_PLAYER && (bt(KING_LAYER, target_h, target_w) == 1 ||
-                                   bt(DEF_LAYER, target_h, target_w) == 1)) ||
-         (player == ATK_PLAYER && bt(ATK_LAYER, target_h, target_w) == 1);
+[[nodiscard]] uint64_t OpenTaflGS::fingerprint() const noexcept {
+  return key_ ^
+         zobrist::mix(uint64_t{turn_} << 8 | current_repetition_count_);
 }
 
-bool is_opponent_piece(const BoardTensor& bt, uint8_t player, int target_h,
-                       int target_w) {
-  return (player == ATK_PLAYER && (bt(KING_LAYER, target_h, target_w) == 1 ||
-                                   bt(DEF_LAYER, target_h, target_w) == 1)) ||
-         (player == DEF_PLAYER && bt(ATK_LAYER, target_h, target_w) == 1);
-}
-
-bool is_valid_square(const BoardTensor& bt, bool is_king, int target_h,
-                     int target_w) {
-  // Positions off the edge of the board are never valid.
-  if (target_w < 0 || target_w >= WIDTH || target_h < 0 || target_h >= HEIGHT) {
-    return false;
+// Squares a piece on square can move to in direction d.
+// Pieces slide until blocked. Only the king may use the corners or stop on
+// the throne. Other pieces may pass over the empty throne.
+Mask128 move_targets(const Bitboards& b, int square, int d,
+                     bool is_king) noexcept {
+  if (is_king) {
+    return Board::slide(square, d, b.occupied());
   }
-  // Corners are only valid to the king.
-  if ((target_w == 0 && target_h == 0) ||
-      (target_w == WIDTH - 1 && target_h == 0) ||
-      (target_w == 0 && target_h == HEIGHT - 1) ||
-      (target_w == WIDTH - 1 && target_h == HEIGHT - 1)) {
-    return is_king;
-  }
-  // Otherwise is valid if it is empty.
-  return bt(0, target_h, target_w) == 0 && bt(1, target_h, target_w) == 0 &&
-         bt(2, target_h, target_w) == 0;
+  return Board::slide(square, d, b.occupied() | CORNERS) & ~THRONE;
 }
 
 [[nodiscard]] bool OpenTaflGS::has_valid_moves() const noexcept {
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      if (is_players_piece(board_, player_, h, w)) {
-        bool is_king = board_(0, h, w) == 1;
-        {
-          auto target_w = w + 1;
-          while (is_valid_square(board_, is_king, h, target_w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (h == 5 && target_w == 5 && !is_king) {
-              ++target_w;
-              continue;
-            }
-            return true;
-          }
-        }
-        {
-          auto target_w = w - 1;
-          while (is_valid_square(board_, is_king, h, target_w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (h == 5 && target_w == 5 && !is_king) {
-              --target_w;
-              continue;
-            }
-            return true;
-          }
-        }
-        {
-          auto target_h = h + 1;
-          while (is_valid_square(board_, is_king, target_h, w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (target_h == 5 && w == 5 && !is_king) {
-              ++target_h;
-              continue;
-            }
-            return true;
-          }
-        }
-        {
-          auto target_h = h - 1;
-          while (is_valid_square(board_, is_king, target_h, w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (target_h == 5 && w == 5 && !is_king) {
-              --target_h;
-              continue;
-            }
-            return true;
-          }
-        }
+  auto pieces = board_.player(player_);
+  while (pieces != 0) {
+    const auto s = bitboard::pop_lsb(pieces);
+    const auto is_king = (board_.king & Board::bit(s)) != 0;
+    for (auto d = 0; d < NUM_DIRECTIONS; ++d) {
+      if (move_targets(board_, s, d, is_king) != 0) {
+        return true;
       }
     }
   }
@@ -147,139 +93,50 @@ bool is_valid_square(const BoardTensor& bt, bool is_king, int target_h,
 [[nodiscard]] Vector<uint8_t> OpenTaflGS::valid_moves() const noexcept {
   auto valids = Vector<uint8_t>{NUM_MOVES};
   valids.setZero();
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      if (is_players_piece(board_, player_, h, w)) {
-        bool is_king = board_(0, h, w) == 1;
-        {
-          auto target_w = w + 1;
-          while (is_valid_square(board_, is_king, h, target_w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (h == 5 && target_w == 5 && !is_king) {
-              ++target_w;
-              continue;
-            }
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + target_w + 0] = 1;
-            ++target_w;
-          }
-        }
-        {
-          auto target_w = w - 1;
-          while (is_valid_square(board_, is_king, h, target_w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (h == 5 && target_w == 5 && !is_king) {
-              --target_w;
-              continue;
-            }
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + target_w + 0] = 1;
-            --target_w;
-          }
-        }
-        {
-          auto target_h = h + 1;
-          while (is_valid_square(board_, is_king, target_h, w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (target_h == 5 && w == 5 && !is_king) {
-              ++target_h;
-              continue;
-            }
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + WIDTH + target_h] = 1;
-            ++target_h;
-          }
-        }
-        {
-          auto target_h = h - 1;
-          while (is_valid_square(board_, is_king, target_h, w)) {
-            // Special exception for the center. If not king you can move
-            // through but not land on.
-            if (target_h == 5 && w == 5 && !is_king) {
-              --target_h;
-              continue;
-            }
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + WIDTH + target_h] = 1;
-            --target_h;
-          }
-        }
+  auto pieces = board_.player(player_);
+  while (pieces != 0) {
+    const auto s = bitboard::pop_lsb(pieces);
+    const auto is_king = (board_.king & Board::bit(s)) != 0;
+    for (auto d = 0; d < NUM_DIRECTIONS; ++d) {
+      auto targets = move_targets(board_, s, d, is_king);
+      while (targets != 0) {
+        const auto t = bitboard::pop_lsb(targets);
+        valids[tafl_bitboard::move_index<WIDTH, HEIGHT>(s, t)] = 1;
       }
     }
   }
   return valids;
 }
 
-bool is_hostile_to(const BoardTensor& bt, uint8_t player, int target_h,
-                   int target_w) {
+// Squares that capture pieces of player when on the far side of them.
+Mask128 hostile_to(const Bitboards& b, uint8_t player) {
   // Corners are always hostile to all.
-  if ((target_w == 0 && target_h == 0) ||
-      (target_w == WIDTH - 1 && target_h == 0) ||
-      (target_w == 0 && target_h == HEIGHT - 1) ||
-      (target_w == WIDTH - 1 && target_h == HEIGHT - 1)) {
-    return true;
+  auto hostile = CORNERS | b.opponent(player);
+  // The throne is only hostile to other defenders if the king isn't there.
+  // Throne is otherwise hostile to all.
+  if (player != DEF_PLAYER || (b.king & THRONE) == 0) {
+    hostile |= THRONE;
   }
-  if (target_w == 5 && target_h == 5) {
-    // The throne is only hostile to other defenders if the king isn't there.
-    if (player == DEF_PLAYER) {
-      return bt(KING_LAYER, 5, 5) == 0;
-    }
-    // Throne is otherwise hostile to all.
-    return true;
-  }
-  // Otherwise, opponent pieces decide if a square is hostile.
-  return is_opponent_piece(bt, player, target_h, target_w);
+  return hostile;
 }
 
-bool captured(const BoardTensor& bt, int from_h, int from_w, int delta_h,
-              int delta_w) {
-  auto target_h = from_h + delta_h;
-  auto target_w = from_w + delta_w;
-  if (target_w < 0 || target_w >= WIDTH || target_h < 0 || target_h >= HEIGHT) {
-    return false;
-  }
-  // Special case: King
-  if (bt(KING_LAYER, target_h, target_w) == 1) {
-    // King cannot be caught if on the edge.
-    if (target_h == 0 || target_h == HEIGHT - 1 || target_w == 0 ||
-        target_w == WIDTH - 1) {
-      return false;
-    }
-    // King must have hostile squares on all four sides.
-    return (is_hostile_to(bt, DEF_PLAYER, target_h - 1, target_w) &&
-            is_hostile_to(bt, DEF_PLAYER, target_h + 1, target_w) &&
-            is_hostile_to(bt, DEF_PLAYER, target_h, target_w - 1) &&
-            is_hostile_to(bt, DEF_PLAYER, target_h, target_w + 1));
-  }
-
-  uint8_t from_player = piece_to_player(bt, from_h, from_w);
-  // Only opponent pieces can be captured.
-  if (!is_opponent_piece(bt, from_player, target_h, target_w)) {
+// The king is captured when next to square, off the edge, and surrounded
+// by hostile squares on all four sides.
+bool king_captured(const Bitboards& b, int square) {
+  if ((Board::neighbors(Board::bit(square)) & b.king) == 0 ||
+      (b.king & EDGES) != 0) {
     return false;
   }
-
-  // Only captured if the final square is hostile to the target player.
-  uint8_t target_player = piece_to_player(bt, target_h, target_w);
-  auto final_h = target_h + delta_h;
-  auto final_w = target_w + delta_w;
-  if (final_w < 0 || final_w >= WIDTH || final_h < 0 || final_h >= HEIGHT) {
-    return false;
-  }
-  return is_hostile_to(bt, target_player, final_h, final_w);
+  return (Board::neighbors(b.king) & ~hostile_to(b, DEF_PLAYER)) == 0;
 }
 
 void OpenTaflGS::play_move(uint32_t move) {
   if (move < 0 || move >= NUM_MOVES) {
     throw std::runtime_error{"Invalid move: You have a bug in your code."};
   }
-  // Initialize board interning if it is turn is 0.
-  // We initialize it with the first move because we only want to share it
-  // within one game, not across all games.
-  if (turn_ == 0) {
-    board_intern_ =
-        std::make_shared<absl::flat_hash_set<RepetitionKeyWrapper>>();
-    auto [key, _inserted_new] = board_intern_->emplace(board_, player_);
-    const auto key_ptr = key->data;
-    repetition_counts_[key_ptr] = 1;
+  // The start position counts towards repetitions.
+  if (history_.empty()) {
+    history_.push_back(key_);
   }
 
   // Move specified piece to row/column.
@@ -299,71 +156,37 @@ void OpenTaflGS::play_move(uint32_t move) {
   } else {
     new_w = new_loc;
   }
-  board_(0, new_h, new_w) = board_(0, piece_h, piece_w);
-  board_(1, new_h, new_w) = board_(1, piece_h, piece_w);
-  board_(2, new_h, new_w) = board_(2, piece_h, piece_w);
-
-  board_(0, piece_h, piece_w) = 0;
-  board_(1, piece_h, piece_w) = 0;
-  board_(2, piece_h, piece_w) = 0;
+  const auto to_square = new_h * WIDTH + new_w;
+  const auto from = Board::bit(piece_h, piece_w);
+  const auto to = Board::bit(to_square);
+  key_ ^= board_.key(from);
+  board_.move(from, to);
+  key_ ^= board_.key(to);
 
   // Check if it captures anything.
-  if (captured(board_, new_h, new_w, -1, 0)) {
-    board_(0, new_h - 1, new_w) = 0;
-    board_(1, new_h - 1, new_w) = 0;
-    board_(2, new_h - 1, new_w) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
-  }
-  if (captured(board_, new_h, new_w, 1, 0)) {
-    board_(0, new_h + 1, new_w) = 0;
-    board_(1, new_h + 1, new_w) = 0;
-    board_(2, new_h + 1, new_w) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
-  }
-  if (captured(board_, new_h, new_w, 0, -1)) {
-    board_(0, new_h, new_w - 1) = 0;
-    board_(1, new_h, new_w - 1) = 0;
-    board_(2, new_h, new_w - 1) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
-  }
-  if (captured(board_, new_h, new_w, 0, 1)) {
-    board_(0, new_h, new_w + 1) = 0;
-    board_(1, new_h, new_w + 1) = 0;
-    board_(2, new_h, new_w + 1) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
+  // The king is never captured by just two pieces.
+  const auto opponent = (player_ + 1) % 2;
+  auto captured =
+      Board::sandwiched(to_square, board_.player(opponent) & ~board_.king,
+                        hostile_to(board_, opponent));
+  if (king_captured(board_, to_square)) {
+    captured |= board_.king;
+  }
+  if (captured != 0) {
+    key_ ^= board_.key(captured);
+    board_.remove(captured);
+    // All old repetitions are invalid since we no longer have the same
+    // number of pieces.
+    history_.clear();
   }
 
   player_ = (player_ + 1) % 2;
+  key_ ^= tafl_bitboard::DEF_TO_MOVE_KEY;
   ++turn_;
 
   // Update repetitions.
-  auto [key, _inserted_new] = board_intern_->emplace(board_, player_);
-  const auto key_ptr = key->data;
-  if (!repetition_counts_.contains(key_ptr)) {
-    repetition_counts_[key_ptr] = 1;
-  } else {
-    ++repetition_counts_[key_ptr];
-  }
-  current_repetition_count_ = repetition_counts_[key_ptr];
-}
-
-[[nodiscard]] bool king_exists(const BoardTensor& bt) noexcept {
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      if (bt(KING_LAYER, h, w) == 1) {
-        return true;
-      }
-    }
-  }
-  return false;
+  history_.push_back(key_);
+  current_repetition_count_ = tafl_bitboard::repetition_count(history_);
 }
 
 [[nodiscard]] std::optional<Vector<float>> OpenTaflGS::scores() const noexcept {
@@ -386,55 +209,19 @@ void OpenTaflGS::play_move(uint32_t move) {
     return scores;
   }
   // Check if the king is on a corner.
-  if (board_(KING_LAYER, 0, 0) == 1 || board_(KING_LAYER, HEIGHT - 1, 0) == 1 ||
-      board_(KING_LAYER, 0, WIDTH - 1) == 1 ||
-      board_(KING_LAYER, HEIGHT - 1, WIDTH - 1) == 1) {
+  if ((board_.king & CORNERS) != 0) {
     scores(1) = 1;
     return scores;
   }
   // Check if the king still exists.
-  if (!king_exists(board_)) {
+  if (board_.king == 0) {
     scores(0) = 1;
     return scores;
   }
   // Check if all defenders are surrounded (can't reach edge with infinite
-  // moves)
-  auto visited = std::deque<std::pair<int, int>>{};
-  auto live = std::deque<std::pair<int, int>>{
-      {0, 0},  {0, 1},  {0, 2},  {0, 3},  {0, 4},   {0, 5},  {0, 6},  {0, 7},
-      {0, 8},  {0, 9},  {0, 10}, {1, 10}, {2, 10},  {3, 10}, {4, 10}, {5, 10},
-      {6, 10}, {7, 10}, {8, 10}, {9, 10}, {10, 10}, {10, 9}, {10, 8}, {10, 7},
-      {10, 6}, {10, 5}, {10, 4}, {10, 3}, {10, 2},  {10, 1}, {10, 0}, {9, 0},
-      {8, 0},  {7, 0},  {6, 0},  {5, 0},  {4, 0},   {3, 0},  {2, 0},  {1, 0},
-  };
-  auto can_escape = false;
-  while (!live.empty()) {
-    auto [h, w] = live.back();
-    live.pop_back();
-    visited.emplace_back(h, w);
-
-    if (board_(KING_LAYER, h, w) == 1 || board_(DEF_LAYER, h, w) == 1) {
-      can_escape = true;
-      break;
-    }
-    // If no attacker on the square, add the neighboring squares.
-    if (board_(ATK_LAYER, h, w) == 0) {
-      for (auto pair : std::array<std::pair<int, int>, 4>{
-               {{h - 1, w}, {h + 1, w}, {h, w - 1}, {h, w + 1}}}) {
-        auto [target_h, target_w] = pair;
-        if (target_h < 0 || target_h >= HEIGHT || target_w < 0 ||
-            target_w >= WIDTH) {
-          continue;
-        }
-        // Only add neighbors if not live or visited.
-        if (std::find(visited.begin(), visited.end(), pair) == visited.end() &&
-            std::find(live.begin(), live.end(), pair) == live.end()) {
-          live.emplace_back(target_h, target_w);
-        }
-      }
-    }
-  }
-  if (!can_escape) {
+  // moves). Flood out from the edges through squares without attackers.
+  const auto open = Board::TABLES.full & ~board_.atk;
+  if (!Board::reaches(EDGES, open, board_.king | board_.def)) {
     scores(0) = 1;
     return scores;
   }
@@ -452,66 +239,41 @@ void OpenTaflGS::play_move(uint32_t move) {
   return std::nullopt;
 }
 
-[[nodiscard]] Tensor<float, 3> OpenTaflGS::canonicalized() const noexcept {
-  auto out = CanonicalTensor{};
+void OpenTaflGS::canonicalize_into(float* data) const noexcept {
+  auto out = sized_tensor_map<CanonicalTensor>(data);
+  out.setZero();
 
   // Board planes.
+  const auto layers = std::array<Mask128, 3>{board_.king, board_.def,
+                                             board_.atk};
   for (auto p = 0; p < 3; ++p) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(p, h, w) = board_(p, h, w);
-      }
+    auto pieces = layers[p];
+    while (pieces != 0) {
+      const auto s = bitboard::pop_lsb(pieces);
+      out(p, s / WIDTH, s % WIDTH) = 1;
     }
   }
 
   // Current player planes.
-  auto p = player_ + 3;
-  auto op = (player_ + 1) % 2 + 3;
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      out(p, h, w) = 1;
-      out(op, h, w) = 0;
-    }
-  }
+  out.chip(player_ + 3, 0).setConstant(1);
 
   // Repetition count.
-  if (current_repetition_count_ == 0) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 0;
-        out(6, h, w) = 0;
-      }
-    }
-  } else if (current_repetition_count_ == 1) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 1;
-        out(6, h, w) = 0;
-      }
-    }
-  } else if (current_repetition_count_ == 2) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 0;
-        out(6, h, w) = 1;
-      }
-    }
-  } else if (current_repetition_count_ > 2) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 1;
-        out(6, h, w) = 1;
-      }
-    }
+  if (current_repetition_count_ == 1 || current_repetition_count_ > 2) {
+    out.chip(5, 0).setConstant(1);
+  }
+  if (current_repetition_count_ >= 2) {
+    out.chip(6, 0).setConstant(1);
   }
 
   // Current turn.
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      out(7, h, w) = static_cast<float>(turn_) / static_cast<float>(max_turns_);
-    }
-  }
+  out.chip(7, 0).setConstant(static_cast<float>(turn_) /
+                             static_cast<float>(max_turns_));
+}
 
+[[nodiscard]] Tensor<float, 3> OpenTaflGS::canonicalized() const noexcept {
+  auto out = Tensor<float, 3>{CANONICAL_SHAPE[0], CANONICAL_SHAPE[1],
+                              CANONICAL_SHAPE[2]};
+  canonicalize_into(out.data());
   return out;
 }
 
@@ -529,23 +291,21 @@ void OpenTaflGS::play_move(uint32_t move) {
       '\n';
   for (auto h = 0; h < HEIGHT; ++h) {
     for (auto w = 0; w < WIDTH; ++w) {
-      if ((h == 0 && w == 0) || (h == HEIGHT - 1 && w == 0) ||
-          (h == 0 && w == WIDTH - 1) || (h == HEIGHT - 1 && w == WIDTH - 1) ||
-          (h == 5 && w == 5)) {
+      const auto square = Board::bit(h, w);
+      const auto special = ((CORNERS | THRONE) & square) != 0;
+      if (special) {
         out += color::Modifier{color::BG_RED}.dump();
       }
-      if (board_(0, h, w) == 1) {
+      if ((board_.king & square) != 0) {
         out += '@';
-      } else if (board_(1, h, w) == 1) {
+      } else if ((board_.def & square) != 0) {
         out += 'O';
-      } else if (board_(2, h, w) == 1) {
+      } else if ((board_.atk & square) != 0) {
         out += 'X';
       } else {
         out += '.';
       }
-      if ((h == 0 && w == 0) || (h == HEIGHT - 1 && w == 0) ||
-          (h == 0 && w == WIDTH - 1) || (h == HEIGHT - 1 && w == WIDTH - 1) ||
-          (h == 5 && w == 5)) {
+      if (special) {
         out += color::Modifier{color::BG_DEFAULT}.dump();
       }
     }
@@ -555,9 +315,6 @@ void OpenTaflGS::play_move(uint32_t move) {
   return out;
 }
 
-void OpenTaflGS::minimize_storage() {
-  repetition_counts_ = {};
-  board_intern_ = nullptr;
-}
+void OpenTaflGS::minimize_storage() { history_ = {}; }
 
-}  // namespace alphazero::opentafl_gs
\ No newline at end of file
+}  // namespace alphazero::opentafl_gs
@@ -1,6 +1,7 @@
 
 #include "opentafl_gs.h"
 
+#include "game_state_digest.h"
 #include "gtest/gtest.h"
 
 namespace alphazero::opentafl_gs {
@@ -78,5 +79,51 @@ TEST(OpenTaflGS, RepetitionCount) {
   EXPECT_EQ(s, expected);
 }
 
+// NOLINTNEXTLINE
+TEST(OpenTaflGS, Encirclement) {
+  using Board = bitboard::Board<bitboard::Mask128, WIDTH, HEIGHT>;
+  auto b = Bitboards{};
+  b.king = Board::bit(5, 5);
+  b.def = Board::bit(4, 5) | Board::bit(6, 6);
+  // A closed ring of attackers around the middle of the board.
+  for (auto i = 2; i <= 8; ++i) {
+    b.atk |= Board::bit(2, i) | Board::bit(8, i) | Board::bit(i, 2) |
+             Board::bit(i, 8);
+  }
+  const auto scores_of = [](const Bitboards& board) {
+    return OpenTaflGS{board, DEF_PLAYER, 10, DEFAULT_MAX_TURNS, 1, {}}
+        .scores();
+  };
+
+  const auto scores = scores_of(b);
+  ASSERT_TRUE(scores.has_value());
+  EXPECT_EQ((*scores)(0), 1);
+
+  // A single gap lets the defenders out.
+  auto gap = b;
+  gap.atk &= ~Board::bit(8, 4);
+  EXPECT_FALSE(scores_of(gap).has_value());
+
+  // So does any defender outside the ring.
+  auto outside = b;
+  outside.def |= Board::bit(9, 9);
+  EXPECT_FALSE(scores_of(outside).has_value());
+}
+
+// Golden values were recorded from the tensor based implementation that the
+// bitboards replaced.
+// NOLINTNEXTLINE
+TEST(OpenTaflGS, Perft) {
+  const auto gs = OpenTaflGS{};
+  EXPECT_EQ(perft(gs, 1), 116);
+  EXPECT_EQ(perft(gs, 2), 6788);
+  EXPECT_EQ(perft(gs, 3), 806344);
+}
+
+// NOLINTNEXTLINE
+TEST(OpenTaflGS, PlayoutDigest) {
+  EXPECT_EQ(playout_digest(OpenTaflGS{}, 100, 7), 0x92662706c5fe9259);
+}
+
 }  // namespace
 }  // namespace alphazero::opentafl_gs
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <iostream>
 
+#include "bitboard.h"
 #include "color.h"
 #include "game_state.h"
 
@@ -19,7 +20,7 @@ const std::array<color::Modifier, 7> PLAYER_COLOR = {
 };
 const color::Modifier DEFAULT_COLOR = color::Modifier{color::FG_DEFAULT};
 
-bool on_board(int h, int w) {
+constexpr bool on_board(int h, int w) {
   if (h < 0 || h >= HEIGHT || w < 0 || w >= WIDTH) {
     return false;
   }
@@ -32,10 +33,58 @@ bool on_board(int h, int w) {
   return true;
 }
 
-int dist_from_center(int h, int w) {
-  return (std::abs(w - 3) + std::abs(w + h - 3 - 3) + std::abs(h - 3)) / 2;
+constexpr int dist_from_center(int h, int w) {
+  // std::abs isn't constexpr until C++23.
+  const auto abs = [](int x) { return x < 0 ? -x : x; };
+  return (abs(w - 3) + abs(w + h - 3 - 3) + abs(h - 3)) / 2;
 }
 
+// One bit per tile, indexed by h * WIDTH + w.
+using TileMask = uint64_t;
+
+constexpr TileMask tile_bit(int h, int w) {
+  return TileMask{1} << (h * WIDTH + w);
+}
+
+// The outer ring, where the first trees are placed.
+constexpr const TileMask EDGE_TILES = [] {
+  auto out = TileMask{0};
+  for (auto h = 0; h < HEIGHT; ++h) {
+    for (auto w = 0; w < WIDTH; ++w) {
+      if (dist_from_center(h, w) == 3) {
+        out |= tile_bit(h, w);
+      }
+    }
+  }
+  return out;
+}();
+
+// Tiles a tree of size 2 to 4 can seed from each tile. The range is the size
+// minus one. Includes the tree's own tile, which is never empty.
+constexpr const auto SEED_TARGETS = [] {
+  auto out = std::array<std::array<TileMask, WIDTH * HEIGHT>, 3>{};
+  for (auto seed_range = 1; seed_range <= 3; ++seed_range) {
+    for (auto h = 0; h < HEIGHT; ++h) {
+      for (auto w = 0; w < WIDTH; ++w) {
+        auto targets = TileMask{0};
+        for (auto offset_x = -seed_range; offset_x <= seed_range; ++offset_x) {
+          for (auto offset_y = std::max(-seed_range, -offset_x - seed_range);
+               offset_y <= std::min(seed_range, -offset_x + seed_range);
+               ++offset_y) {
+            const auto near_h = h - offset_x - offset_y;
+            const auto near_w = w + offset_x;
+            if (on_board(near_h, near_w)) {
+              targets |= tile_bit(near_h, near_w);
+            }
+          }
+        }
+        out[seed_range - 1][h * WIDTH + w] = targets;
+      }
+    }
+  }
+  return out;
+}();
+
 template <uint8_t NUM_PLAYERS>
 class PhotosynthesisGS : public GameState {
  public:
@@ -99,7 +148,8 @@ class PhotosynthesisGS : public GameState {
         buyable_plants_(buyable_plants),
         available_plants_(available_plants),
         score_tiles_collected_(score_tiles_collected),
-        score_(score) {
+        score_(score),
+        occupied_(occupied_tiles(board)) {
     for (auto i = 0; i < 4; ++i) {
       score_tiles_[i].clear();
       for (auto points : score_tiles[i]) {
@@ -196,104 +246,23 @@ class PhotosynthesisGS : public GameState {
   [[nodiscard]] Vector<uint8_t> valid_moves() const noexcept override {
     auto moves = SizedVector<uint8_t, NUM_MOVES>{};
     moves.setZero();
-
-    // Special case where we are setting up the board.
-    // Only valid moves are to place a tree on the edge that isn't occupied.
-    if (turn_ < 2 * NUM_PLAYERS) {
-      for (auto h = 0; h < HEIGHT; ++h) {
-        for (auto w = 0; w < WIDTH; ++w) {
-          if (dist_from_center(h, w) == 3) {
-            auto empty = true;
-            for (auto p = 0; p < NUM_PLAYERS; ++p) {
-              if (board_(p, h, w) != 0) {
-                empty = false;
-                break;
-              }
-            }
-            if (empty) {
-              moves(h * WIDTH + w) = 1;
-            }
-          }
-        }
-      }
-      return moves;
-    }
-
-    // board size of growable trees on specified tile.
-    auto offset = 0;
-    if (sun_points_(player_) > 0) {
-      for (auto h = 0; h < HEIGHT; ++h) {
-        for (auto w = 0; w < WIDTH; ++w) {
-          if (activated_tiles_(h, w) == 0 &&
-              (board_(player_, h, w) == 4 ||
-               (board_(player_, h, w) > 0 &&
-                available_plants_(player_, board_(player_, h, w)) > 0)) &&
-              sun_points_(player_) >= board_(player_, h, w)) {
-            moves(offset + h * WIDTH + w) = 1;
-          }
-        }
-      }
-    }
-    offset += WIDTH * HEIGHT;
-
-    // board size squared of plant seed on tile from tile.
-    if (available_plants_(player_, 0) > 0 && sun_points_(player_) >= 1) {
-      for (auto h = 0; h < HEIGHT; ++h) {
-        for (auto w = 0; w < WIDTH; ++w) {
-          if (activated_tiles_(h, w) == 0 && board_(player_, h, w) > 1) {
-            int seed_range = board_(player_, h, w) - 1;
-            const auto current_x = w;
-            const auto current_z = h;
-            const auto current_y = -current_x - current_z;
-            for (auto offset_x = -seed_range; offset_x <= seed_range;
-                 ++offset_x) {
-              for (auto offset_y =
-                       std::max(-seed_range, -offset_x - seed_range);
-                   offset_y <= std::min(seed_range, -offset_x + seed_range);
-                   ++offset_y) {
-                const auto near_z =
-                    -(offset_x + current_x) - (offset_y + current_y);
-                const auto near_h = near_z;
-                const auto near_w = offset_x + current_x;
-                if (on_board(near_h, near_w) &&
-                    activated_tiles_(near_h, near_w) == 0) {
-                  auto empty = true;
-                  for (auto p = 0; p < NUM_PLAYERS; ++p) {
-                    if (board_(p, near_h, near_w) != 0) {
-                      empty = false;
-                      break;
-                    }
-                  }
-                  if (empty) {
-                    moves(offset + near_h * WIDTH + near_w) = 1;
-                  }
-                }
-              }
-            }
-          }
-          offset += WIDTH * HEIGHT;
-        }
-      }
-    } else {
-      offset += (WIDTH * HEIGHT) * (WIDTH * HEIGHT);
-    }
-
-    // 4 x buy item.
-    for (auto i = 0; i < 4; ++i) {
-      if (buyable_plants_(player_, i) > 0 &&
-          sun_points_(player_) >=
-              BUY_COSTS[i][buyable_plants_(player_, i) - 1]) {
-        moves(offset + i) = 1;
-      }
-    }
-    offset += 4;
-
-    // Pass is always valid.
-    moves(offset) = 1;
-
+    for_each_valid_move([&](uint32_t move) {
+      moves(move) = 1;
+      return true;
+    });
     return moves;
   }
 
+  // Replaces out with the playable moves in increasing order. Most of the
+  // 2455 moves are never valid, so this is much smaller than valid_moves.
+  void legal_moves(std::vector<uint32_t>& out) const override {
+    out.clear();
+    for_each_valid_move([&](uint32_t move) {
+      out.push_back(move);
+      return true;
+    });
+  }
+
   void rotate_board() {
     for (auto p = 0; p < NUM_PLAYERS; ++p) {
       auto tmp = board_(p, 0, 3);
@@ -344,6 +313,7 @@ class PhotosynthesisGS : public GameState {
       board_(p, 4, 2) = board_(p, 3, 2);
       board_(p, 3, 2) = tmp;
     }
+    occupied_ = occupied_tiles(board_);
   }
 
   // Plays a move, modifying the current GameState.
@@ -354,6 +324,7 @@ class PhotosynthesisGS : public GameState {
       auto h = move / WIDTH;
       auto w = move % WIDTH;
       board_(player_, h, w) = 2;
+      occupied_ |= tile_bit(h, w);
       player_ = (player_ + 1) % NUM_PLAYERS;
       ++turn_;
       if (turn_ == 2 * NUM_PLAYERS) {
@@ -396,6 +367,7 @@ class PhotosynthesisGS : public GameState {
             std::min(buyable_plants_(player_, board_(player_, h, w) - 1),
                      MAX_BUYABLE_PLANTS[board_(player_, h, w) - 1]);
         board_(player_, h, w) = 0;
+        occupied_ &= ~tile_bit(h, w);
         activated_tiles_(h, w) = 1;
       } else {
         --available_plants_(player_, board_(player_, h, w));
@@ -417,6 +389,7 @@ class PhotosynthesisGS : public GameState {
       --sun_points_(player_);
       --available_plants_(player_, 0);
       ++board_(player_, to_h, to_w);
+      occupied_ |= tile_bit(to_h, to_w);
       activated_tiles_(from_h, from_w) = 1;
       activated_tiles_(to_h, to_w) = 1;
     }
@@ -442,36 +415,37 @@ class PhotosynthesisGS : public GameState {
 
   // Returns the canonicalized form of the board, ready for feeding to a NN.
   [[nodiscard]] Tensor<float, 3> canonicalized() const noexcept override {
+    auto out = Tensor<float, 3>{CANONICAL_SHAPE[0], CANONICAL_SHAPE[1],
+                                CANONICAL_SHAPE[2]};
+    canonicalize_into(out.data());
+    return out;
+  }
+
+  [[nodiscard]] std::array<int, 3> canonical_shape() const noexcept override {
+    return CANONICAL_SHAPE;
+  }
+
+  void canonicalize_into(float* data) const noexcept override {
     constexpr auto SUN_PHASE_COUNT = 18;
     constexpr std::array<int, 4> SCORE_TILE_COUNTS{9, 7, 5, 3};
     constexpr auto PIECE_TYPES = 4;
 
-    auto t = CanonicalTensor{};
+    // Most planes are one hot encodings of a single number, so they are
+    // filled a whole plane at a time.
+    auto t = sized_tensor_map<CanonicalTensor>(data);
     t.setZero();
 
     auto offset = 0;
     // Current player.
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        t(offset + player_, h, w) = 1;
-      }
-    }
+    t.chip(offset + player_, 0).setConstant(1);
     offset += NUM_PLAYERS;
 
     // Current round first player.
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        t(offset + first_player_, h, w) = 1;
-      }
-    }
+    t.chip(offset + first_player_, 0).setConstant(1);
     offset += NUM_PLAYERS;
 
     // Current sun phase.
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        t(offset + sun_phase_, h, w) = 1;
-      }
-    }
+    t.chip(offset + sun_phase_, 0).setConstant(1);
     offset += SUN_PHASE_COUNT;
 
     // Activated tiles.
@@ -484,22 +458,14 @@ class PhotosynthesisGS : public GameState {
 
     // Remaining score tiles.
     for (auto i = 0U; i < SCORE_TILE_COUNTS.size(); ++i) {
-      for (auto h = 0; h < HEIGHT; ++h) {
-        for (auto w = 0; w < WIDTH; ++w) {
-          t(offset + score_tiles_[i].size(), h, w) = 1;
-        }
-      }
+      t.chip(offset + score_tiles_[i].size(), 0).setConstant(1);
       // + 1 can also be zero.
       offset += SCORE_TILE_COUNTS[i] + 1;
     }
 
     // Player sun score.
     for (auto p = 0; p < NUM_PLAYERS; ++p) {
-      for (auto h = 0; h < HEIGHT; ++h) {
-        for (auto w = 0; w < WIDTH; ++w) {
-          t(offset + sun_points_[p], h, w) = 1;
-        }
-      }
+      t.chip(offset + sun_points_[p], 0).setConstant(1);
       // + 1 can also be zero.
       offset += MAX_SUN + 1;
     }
@@ -519,11 +485,7 @@ class PhotosynthesisGS : public GameState {
     // Player available plants.
     for (auto i = 0U; i < MAX_AVAILABLE_PLANTS.size(); ++i) {
       for (auto p = 0; p < NUM_PLAYERS; ++p) {
-        for (auto h = 0; h < HEIGHT; ++h) {
-          for (auto w = 0; w < WIDTH; ++w) {
-            t(offset + available_plants_(p, i), h, w) = 1;
-          }
-        }
+        t.chip(offset + available_plants_(p, i), 0).setConstant(1);
         // + 1 can also be zero.
         offset += MAX_AVAILABLE_PLANTS[i] + 1;
       }
@@ -532,11 +494,7 @@ class PhotosynthesisGS : public GameState {
     // Player buyable plants.
     for (auto i = 0U; i < MAX_BUYABLE_PLANTS.size(); ++i) {
       for (auto p = 0; p < NUM_PLAYERS; ++p) {
-        for (auto h = 0; h < HEIGHT; ++h) {
-          for (auto w = 0; w < WIDTH; ++w) {
-            t(offset + buyable_plants_(p, i), h, w) = 1;
-          }
-        }
+        t.chip(offset + buyable_plants_(p, i), 0).setConstant(1);
         // + 1 can also be zero.
         offset += MAX_BUYABLE_PLANTS[i] + 1;
       }
@@ -545,11 +503,7 @@ class PhotosynthesisGS : public GameState {
     // player score tiles.
     for (auto i = 0U; i < SCORE_TILE_COUNTS.size(); ++i) {
       for (auto p = 0; p < NUM_PLAYERS; ++p) {
-        for (auto h = 0; h < HEIGHT; ++h) {
-          for (auto w = 0; w < WIDTH; ++w) {
-            t(offset + score_tiles_collected_(p, i), h, w) = 1;
-          }
-        }
+        t.chip(offset + score_tiles_collected_(p, i), 0).setConstant(1);
         // + 1 can also be zero.
         offset += SCORE_TILE_COUNTS[i] + 1;
       }
@@ -559,8 +513,6 @@ class PhotosynthesisGS : public GameState {
 
     // This shouldn't crash if everything is set correctly.
     assert(offset == t.dimension(0));
-
-    return t;
   }
 
   // Returns the number of symmetries the game has.
@@ -723,8 +675,43 @@ class PhotosynthesisGS : public GameState {
     if (turn_ < 2 * NUM_PLAYERS) {
       return false;
     }
+    // Pass is always valid and comes last, so stop at any other move.
+    return for_each_valid_move(
+        [](uint32_t move) { return move == NUM_MOVES - 1; });
+  }
+
+  [[nodiscard]] static TileMask occupied_tiles(const BoardTensor& board) {
+    auto out = TileMask{0};
+    for (auto p = 0; p < NUM_PLAYERS; ++p) {
+      for (auto h = 0; h < HEIGHT; ++h) {
+        for (auto w = 0; w < WIDTH; ++w) {
+          if (board(p, h, w) != 0) {
+            out |= tile_bit(h, w);
+          }
+        }
+      }
+    }
+    return out;
+  }
+
+  // Calls f with each valid move in increasing order until f returns false.
+  // Returns false if f stopped it early.
+  template <typename F>
+  bool for_each_valid_move(F&& f) const noexcept {
+    // Special case where we are setting up the board.
+    // Only valid moves are to place a tree on the edge that isn't occupied.
+    if (turn_ < 2 * NUM_PLAYERS) {
+      auto tiles = EDGE_TILES & ~occupied_;
+      while (tiles != 0) {
+        if (!f(bitboard::pop_lsb(tiles))) {
+          return false;
+        }
+      }
+      return true;
+    }
 
     // board size of growable trees on specified tile.
+    auto offset = 0U;
     if (sun_points_(player_) > 0) {
       for (auto h = 0; h < HEIGHT; ++h) {
         for (auto w = 0; w < WIDTH; ++w) {
@@ -732,62 +719,56 @@ class PhotosynthesisGS : public GameState {
               (board_(player_, h, w) == 4 ||
                (board_(player_, h, w) > 0 &&
                 available_plants_(player_, board_(player_, h, w)) > 0)) &&
-              sun_points_(player_) >= board_(player_, h, w)) {
+              sun_points_(player_) >= board_(player_, h, w) &&
+              !f(offset + h * WIDTH + w)) {
             return false;
           }
         }
       }
     }
+    offset += WIDTH * HEIGHT;
 
     // board size squared of plant seed on tile from tile.
     if (available_plants_(player_, 0) > 0 && sun_points_(player_) >= 1) {
+      auto blocked = occupied_;
+      for (auto h = 0; h < HEIGHT; ++h) {
+        for (auto w = 0; w < WIDTH; ++w) {
+          if (activated_tiles_(h, w) != 0) {
+            blocked |= tile_bit(h, w);
+          }
+        }
+      }
       for (auto h = 0; h < HEIGHT; ++h) {
         for (auto w = 0; w < WIDTH; ++w) {
-          if (activated_tiles_(h, w) == 0 && board_(player_, h, w) > 1) {
-            int seed_range = board_(player_, h, w) - 1;
-            const auto current_x = w;
-            const auto current_z = h;
-            const auto current_y = -current_x - current_z;
-            for (auto offset_x = -seed_range; offset_x <= seed_range;
-                 ++offset_x) {
-              for (auto offset_y =
-                       std::max(-seed_range, -offset_x - seed_range);
-                   offset_y <= std::min(seed_range, -offset_x + seed_range);
-                   ++offset_y) {
-                const auto near_z =
-                    -(offset_x + current_x) - (offset_y + current_y);
-                const auto near_h = near_z;
-                const auto near_w = offset_x + current_x;
-                if (on_board(near_h, near_w) &&
-                    activated_tiles_(near_h, near_w) == 0) {
-                  auto empty = true;
-                  for (auto p = 0; p < NUM_PLAYERS; ++p) {
-                    if (board_(p, near_h, near_w) != 0) {
-                      empty = false;
-                      break;
-                    }
-                  }
-                  if (empty) {
-                    return false;
-                  }
-                }
+          const auto size = board_(player_, h, w);
+          if (activated_tiles_(h, w) == 0 && size > 1) {
+            auto targets = SEED_TARGETS[size - 2][h * WIDTH + w] & ~blocked;
+            while (targets != 0) {
+              if (!f(offset + bitboard::pop_lsb(targets))) {
+                return false;
               }
             }
           }
+          offset += WIDTH * HEIGHT;
         }
       }
+    } else {
+      offset += (WIDTH * HEIGHT) * (WIDTH * HEIGHT);
     }
 
     // 4 x buy item.
     for (auto i = 0; i < 4; ++i) {
       if (buyable_plants_(player_, i) > 0 &&
           sun_points_(player_) >=
-              BUY_COSTS[i][buyable_plants_(player_, i) - 1]) {
+              BUY_COSTS[i][buyable_plants_(player_, i) - 1] &&
+          !f(offset + i)) {
         return false;
       }
     }
+    offset += 4;
 
-    return true;
+    // Pass is always valid.
+    return f(offset);
   }
 
   // Board contains a layer for each player.
@@ -808,6 +789,8 @@ class PhotosynthesisGS : public GameState {
        {13, 13, 14, 14, 16, 16, 17},
        {17, 17, 18, 18, 19},
        {20, 21, 22}}};
+  // Tiles with a tree of any player. Kept in sync with board_.
+  TileMask occupied_{0};
 };
 
 }  // namespace alphazero::photosynthesis_gs
\ No newline at end of file
@@ -1,6 +1,9 @@
 
 #include "photosynthesis_gs.h"
 
+#include <random>
+
+#include "game_state_digest.h"
 #include "gtest/gtest.h"
 
 namespace alphazero::photosynthesis_gs {
@@ -25,5 +28,56 @@ TEST(PhotosynthesisGS, Equals) {
   // EXPECT_TRUE(false);
 }
 
+// The buffer is reused between positions, so everything must be overwritten.
+// NOLINTNEXTLINE
+TEST(PhotosynthesisGS, CanonicalizeInto) {
+  auto gs = PhotosynthesisGS<4>{};
+  gs.play_move(3);
+  const auto shape = gs.canonical_shape();
+  EXPECT_EQ(shape, PhotosynthesisGS<4>::CANONICAL_SHAPE);
+  auto buffer = std::vector<float>(shape[0] * shape[1] * shape[2], 7);
+  gs.canonicalize_into(buffer.data());
+  const auto canonical = gs.canonicalized();
+  EXPECT_EQ(buffer, std::vector<float>(canonical.data(),
+                                       canonical.data() + canonical.size()));
+}
+
+// Goldens recorded from the dense valid move scan, before the sparse move
+// generator and cached occupancy.
+// NOLINTNEXTLINE
+TEST(PhotosynthesisGS, Perft) {
+  EXPECT_EQ(perft(PhotosynthesisGS<2>{}, 5), 827280);
+  EXPECT_EQ(perft(PhotosynthesisGS<3>{}, 5), 1028160);
+}
+
+// NOLINTNEXTLINE
+TEST(PhotosynthesisGS, PlayoutDigest) {
+  EXPECT_EQ(playout_digest(PhotosynthesisGS<2>{}, 20, 1), 0xa8f9810a05e5bf3c);
+  EXPECT_EQ(playout_digest(PhotosynthesisGS<3>{}, 20, 2), 0xc58b5e55eedfeee0);
+  EXPECT_EQ(playout_digest(PhotosynthesisGS<4>{}, 20, 3), 0x817057e8bf91e4e5);
+}
+
+// NOLINTNEXTLINE
+TEST(PhotosynthesisGS, LegalMovesMatchValidMoves) {
+  auto re = std::mt19937{5};
+  auto legal = std::vector<uint32_t>{};
+  for (auto game = 0; game < 5; ++game) {
+    auto gs = PhotosynthesisGS<4>{};
+    while (!gs.scores().has_value()) {
+      const auto valids = gs.valid_moves();
+      auto expected = std::vector<uint32_t>{};
+      for (auto m = 0U; m < gs.num_moves(); ++m) {
+        if (valids(m) == 1) {
+          expected.push_back(m);
+        }
+      }
+      gs.legal_moves(legal);
+      ASSERT_EQ(legal, expected);
+      gs.play_move(
+          legal[std::uniform_int_distribution<size_t>{0, legal.size() - 1}(re)]);
+    }
+  }
+}
+
 }  // namespace
 }  // namespace alphazero::photosynthesis_gs
\ No newline at end of file
@@ -2,32 +2,37 @@
 
 #include <cmath>
 #include <optional>
+#include <random>
 
 namespace alphazero {
 
+using Clock = std::chrono::steady_clock;
+
 PlayManager::PlayManager(std::unique_ptr<GameState> gs, PlayParams p)
     : base_gs_(std::move(gs)),
       params_(p),
-      games_started_(params_.concurrent_games) {
+      seed_(params_.seed.has_value()
+                ? params_.seed.value()
+                : (uint64_t{std::random_device{}()} << 32) |
+                      std::random_device{}()),
+      games_started_(params_.concurrent_games),
+      dedup_(params_.history_dedup_capacity),
+      tracer_(params_.trace_capacity) {
   games_.reserve(params_.concurrent_games);
   if (params_.mcts_depth.size() != base_gs_->num_players()) {
     throw std::runtime_error{"You must specify an MCTS depth for each player"};
   }
   for (auto i = 0U; i < params_.concurrent_games; ++i) {
     auto gd = GameData{};
-    gd.gs = base_gs_->copy();
-    gd.gs->randomize_start();
-    for (auto j = 0; j < base_gs_->num_players(); ++j) {
-      gd.mcts.emplace_back(params_.cpuct, base_gs_->num_players(),
-                           base_gs_->num_moves(), params_.epsilon,
-                           params_.mcts_root_temp, params_.fpu_reduction);
-    }
-    gd.canonical = Tensor<float, 3>{base_gs_->canonicalized()};
+    const auto shape = base_gs_->canonical_shape();
+    gd.canonical = Tensor<float, 3>{shape[0], shape[1], shape[2]};
+    gd.canonical.setZero();
     gd.v = Vector<float>{base_gs_->num_players() + 1};
     gd.pi = Vector<float>{base_gs_->num_moves()};
     gd.v.setZero();
     gd.pi.setZero();
     games_.push_back(std::move(gd));
+    start_game(i);
     awaiting_mcts_.push(i);
   }
   for (auto i = 0U; i < base_gs_->num_players(); ++i) {
@@ -42,25 +47,55 @@ PlayManager::PlayManager(std::unique_ptr<GameState> gs, PlayParams p)
   resign_scores_.setZero();
 }
 
+pcg32 PlayManager::stream(uint32_t i, uint32_t role) const noexcept {
+  // pcg32 uses the low 63 bits of the stream id.
+  const auto id = (uint64_t{i} << 40) |
+                  (uint64_t{games_[i].game_counter} << 8) | uint64_t{role};
+  return pcg32{seed_, id};
+}
+
+void PlayManager::start_game(uint32_t i) {
+  auto& game = games_[i];
+  game.rng = stream(i, 0);
+  game.gs = base_gs_->copy();
+  game.gs->randomize_start(game.rng());
+  game.mcts.clear();
+  for (auto j = 0U; j < base_gs_->num_players(); ++j) {
+    game.mcts.emplace_back(params_.cpuct, base_gs_->num_players(),
+                           base_gs_->num_moves(), params_.epsilon,
+                           params_.mcts_root_temp, params_.fpu_reduction,
+                           stream(i, j + 1));
+  }
+}
+
 void PlayManager::play() {
-  thread_local std::default_random_engine re{std::random_device{}()};
-  thread_local std::uniform_real_distribution<float> dist{0.0F, 1.0F};
+  std::uniform_real_distribution<float> dist{0.0F, 1.0F};
+  auto& stats = stats_.local();
+  auto* trace = tracer_.local("mcts");
   while (games_completed_ < params_.games_to_play) {
+    const auto wait_start = Clock::now();
     auto i = awaiting_mcts_.pop(MAX_WAIT);
     if (!i.has_value()) {
       continue;
     }
+    stats.record(MCTS_QUEUE_WAIT, wait_start);
     auto& game = games_[i.value()];
     if (game.initialized) {
       // Process previous results.
       const auto cp = game.gs->current_player();
       auto& mcts = game.mcts[cp];
-      mcts.process_result(*game.gs, game.v, game.pi,
-                          params_.add_noise && !game.capped);
+      const auto process_start = Clock::now();
+      {
+        TraceSpan span{tracer_, trace, "process_result"};
+        mcts.process_result(*game.gs, game.v, game.pi,
+                            params_.add_noise && !game.capped);
+      }
+      stats.record(PROCESS_RESULT, process_start);
       auto goal_depth =
           game.capped ? params_.playout_cap_depth : params_.mcts_depth[cp];
       if (mcts.depth() >= goal_depth) {
         // Actually play a move.
+        TraceSpan span{tracer_, trace, "play_move"};
         auto temp = params_.start_temp;
         if (params_.temp_decay_half_life != 0) {
           const auto t = game.gs->current_turn();
@@ -93,7 +128,7 @@ void PlayManager::play() {
           }
           if (tmp_score.sum() > 0) {
             // If we should resign randomly check playthrough chance.
-            if (dist(re) < params_.resign_playthrough_percent) {
+            if (dist(game.rng) < params_.resign_playthrough_percent) {
               game.playthrough = true;
             } else {
               resign_score = std::make_optional(tmp_score);
@@ -101,20 +136,26 @@ void PlayManager::play() {
           }
         }
         const auto pi = mcts.probs(temp);
-        const auto chosen_m = MCTS::pick_move(pi);
+        const auto chosen_m = MCTS::pick_move(pi, game.rng);
         if (params_.history_enabled && !game.capped) {
           PlayHistory ph{
-              .canonical = Tensor<float, 3>{game.gs->canonicalized()},
+              .canonical = Tensor<float, 3>{game.canonical.dimensions()},
               .v = Vector<float>{game.v.size()},
               .pi = Vector<float>{mcts.probs(1.0)},
           };
+          game.gs->canonicalize_into(ph.canonical.data());
           ph.v.setZero();
-          game.partial_history.push_back(ph);
+          game.partial_history.push_back(std::move(ph));
+          if (params_.history_dedup_capacity > 0) {
+            game.partial_fingerprints.push_back(game.gs->fingerprint());
+          }
         }
         for (auto& m : game.mcts) {
           m.update_root(*game.gs, chosen_m);
         }
         game.gs->play_move(chosen_m);
+        stats.record(MOVE_DECISION, game.move_start);
+        game.move_start = Clock::now();
         auto scores = game.gs->scores();
         if (!scores.has_value() && resign_score.has_value()) {
           scores = resign_score;
@@ -125,19 +166,35 @@ void PlayManager::play() {
           // Dump history.
           if (params_.history_enabled) {
             while (!game.partial_history.empty()) {
-              auto ph = game.partial_history.back();
+              auto ph = std::move(game.partial_history.back());
               ph.v = scores.value();
-              history_.push(ph);
+              if (params_.history_dedup_capacity > 0) {
+                auto kept = dedup_.add(game.partial_fingerprints.back(),
+                                       std::move(ph));
+                game.partial_fingerprints.pop_back();
+                if (kept.has_value()) {
+                  history_.push(std::move(*kept));
+                }
+              } else {
+                history_.push(std::move(ph));
+              }
               game.partial_history.pop_back();
             }
           }
           // Game ended, reset.
           {
-            std::unique_lock<std::mutex>{game_end_mutex_};
+            std::unique_lock<std::mutex> lock{game_end_mutex_};
             scores_ += scores.value();
             if (resign_score.has_value()) {
               resign_scores_ += resign_score.value();
             }
+            // All other games have added their history, so the merged history
+            // can be released. This must happen before the last game is
+            // counted so history consumers don't stop early.
+            if (params_.history_dedup_capacity > 0 &&
+                games_completed_ + 1 == params_.games_to_play) {
+              history_.push_many(dedup_.flush());
+            }
             ++games_completed_;
             game_length_ += game.gs->current_turn();
             // If we have started enough games just loop and complete games.
@@ -147,35 +204,52 @@ void PlayManager::play() {
             ++games_started_;
           }
           // Setup next game.
-          game.gs = base_gs_->copy();
-          game.gs->randomize_start();
-          for (auto& m : game.mcts) {
-            m = MCTS{params_.cpuct,          base_gs_->num_players(),
-                     base_gs_->num_moves(),  params_.epsilon,
-                     params_.mcts_root_temp, params_.fpu_reduction};
-          }
+          ++game.game_counter;
+          start_game(i.value());
         }
         // A move has been played, update playout cap.
         game.capped = params_.playout_cap_randomization &&
-                      (dist(re) < params_.playout_cap_percent);
+                      (dist(game.rng) < params_.playout_cap_percent);
         // If not reusing the mcts tree, reset mcts.
+        // The searches keep their random streams.
         if (!params_.tree_reuse) {
           for (auto& m : game.mcts) {
             m = MCTS{params_.cpuct,          base_gs_->num_players(),
                      base_gs_->num_moves(),  params_.epsilon,
-                     params_.mcts_root_temp, params_.fpu_reduction};
+                     params_.mcts_root_temp, params_.fpu_reduction,
+                     m.rng()};
           }
         }
       }
     } else {
       game.initialized = true;
+      game.move_start = Clock::now();
       game.capped = params_.playout_cap_randomization &&
-                    (dist(re) < params_.playout_cap_percent);
+                    (dist(game.rng) < params_.playout_cap_percent);
     }
     // Find the next leaf to process and put it in the inference queue.
     auto& mcts = game.mcts[game.gs->current_player()];
+    const auto find_start = Clock::now();
+    TraceSpan span{tracer_, trace, "prepare_leaf"};
     auto leaf = mcts.find_leaf(*game.gs);
-    game.canonical = leaf->canonicalized();
+    stats.record(FIND_LEAF, find_start);
+    if (params_.solver_max_moves > 0 && mcts.leaf_solvable()) {
+      const auto solve_start = Clock::now();
+      auto solved = leaf->solve(params_.solver_max_moves);
+      stats.record(SOLVE, solve_start);
+      ++solver_calls_;
+      if (solved.has_value()) {
+        ++solver_hits_;
+        mcts.solve_leaf(std::move(solved.value()));
+      }
+    }
+    // Terminal and solved leaves already have their value.
+    if (mcts.leaf_scored()) {
+      awaiting_mcts_.push(i.value());
+      continue;
+    }
+    // Written into the buffer allocated with the game.
+    leaf->canonicalize_into(game.canonical.data());
     // Minimize the storage of the leaf node. It is only used as a hash key and
     // network input.
     leaf->minimize_storage();
@@ -188,18 +262,42 @@ void PlayManager::play() {
         continue;
       }
     }
+    game.inference_start = Clock::now();
     awaiting_inference_[game.gs->current_player()]->push(i.value());
   }
 }
 
+std::optional<uint32_t> PlayManager::pop_game(uint32_t player) {
+  auto& stats = stats_.local();
+  const auto wait_start = Clock::now();
+  auto i = awaiting_inference_[player]->pop(MAX_WAIT);
+  if (i.has_value()) {
+    stats.record(INFERENCE_QUEUE_WAIT, wait_start);
+  }
+  return i;
+}
+
+std::vector<uint32_t> PlayManager::pop_games_upto(uint32_t player, size_t n) {
+  auto& stats = stats_.local();
+  const auto wait_start = Clock::now();
+  auto out = awaiting_inference_[player]->pop_upto(n, MAX_WAIT);
+  if (!out.empty()) {
+    stats.record(INFERENCE_QUEUE_WAIT, wait_start);
+  }
+  return out;
+}
+
 void PlayManager::update_inferences(const uint8_t player,
                                     const std::vector<uint32_t>& game_indices,
                                     const Eigen::Ref<const Matrix<float>>& v,
                                     const Eigen::Ref<const Matrix<float>>& pi) {
+  auto& stats = stats_.local();
+  TraceSpan span{tracer_, tracer_.local("results"), "update_inferences"};
   std::vector<GameStateKeyWrapper> keys;
   std::vector<std::tuple<Vector<float>, Vector<float>>> values;
   for (auto i = 0UL; i < game_indices.size(); ++i) {
     auto& game = games_[game_indices[i]];
+    stats.record(INFERENCE_LATENCY, game.inference_start);
     game.v = v.row(i);
     game.pi = pi.row(i);
     if (params_.max_cache_size > 0) {
@@ -214,24 +312,16 @@ void PlayManager::update_inferences(const uint8_t player,
 }
 
 void PlayManager::dumb_inference(const uint8_t player) {
-  // int count = 0;
+  // Results are instant. SyntheticEvaluator models inference latency.
+  auto& stats = stats_.local();
   while (games_completed_ < params_.games_to_play) {
-    auto i = awaiting_inference_[player]->pop(MAX_WAIT);
+    auto i = pop_game(player);
     if (!i.has_value()) {
       continue;
     }
-    // A basic model takes about 50ms per 1024 results.
-    // So this simulates waiting on the GPU.
-    // ++count;
-    // if (count % 1024 == 0) {
-    //   // Busy wait so that perf sees it clearly.
-    //   auto start = std::chrono::system_clock::now();
-    //   while (std::chrono::system_clock::now() - start <
-    //          std::chrono::milliseconds(50)) {
-    //   }
-    // }
     auto& game = games_[i.value()];
     std::tie(game.v, game.pi) = dumb_eval(*game.gs);
+    stats.record(INFERENCE_LATENCY, game.inference_start);
     // if (params_.max_cache_size > 0) {
     //   caches_[player]->insert(
     //       game.leaf, {Vector<float>{game.v}, Vector<float>{game.pi}});
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <deque>
 #include <limits>
@@ -12,8 +13,11 @@
 #include "concurrent_queue.h"
 #include "dll_export.h"
 #include "game_state.h"
+#include "history_dedup.h"
 #include "lru_cache.h"
 #include "mcts.h"
+#include "stats.h"
+#include "trace.h"
 
 namespace alphazero {
 
@@ -32,6 +36,16 @@ struct GameData {
   Vector<float> v;
   Vector<float> pi;
   std::vector<PlayHistory> partial_history;
+  // The fingerprint of each partial history sample when deduplicating.
+  std::vector<uint64_t> partial_fingerprints;
+  // When the game entered the inference queue and started searching its
+  // current position.
+  std::chrono::steady_clock::time_point inference_start;
+  std::chrono::steady_clock::time_point move_start;
+  // Random stream for the start state, resigning, and move choice.
+  pcg32 rng;
+  // Games played in this slot, used to pick the random streams of each game.
+  uint32_t game_counter = 0;
   bool initialized = false;
   bool capped = false;
   bool playthrough = false;
@@ -49,6 +63,8 @@ struct PlayParams {
   float final_temp = 1.0;
   float temp_decay_half_life = 0;
   bool history_enabled = false;
+  // Max distinct positions kept to merge duplicate history. 0 disables it.
+  uint32_t history_dedup_capacity = 0;
   bool self_play = false;
   bool tree_reuse = true;
   bool add_noise = false;
@@ -60,6 +76,15 @@ struct PlayParams {
   float fpu_reduction = 0.0;
   float resign_percent = 0.0;
   float resign_playthrough_percent = 0.0;
+  // Leaves that end within this many moves are solved exactly instead of
+  // sent to inference, for games with a solver. 0 disables it.
+  uint32_t solver_max_moves = 0;
+  // Max timeline events kept per thread. 0 disables tracing.
+  uint32_t trace_capacity = 0;
+  // Seeds the random streams of every game. Each game gets its own streams,
+  // so a game plays the same regardless of thread scheduling. Single threaded
+  // play is fully reproducible. Without a seed, play is randomly seeded.
+  std::optional<uint64_t> seed = std::nullopt;
 };
 
 // This is a multithread safe game play manager.
@@ -89,13 +114,9 @@ class DLLEXPORT PlayManager {
   }
   void dumb_inference(const uint8_t player);
 
-  [[nodiscard]] std::optional<uint32_t> pop_game(uint32_t player) noexcept {
-    return awaiting_inference_[player]->pop(MAX_WAIT);
-  }
+  [[nodiscard]] std::optional<uint32_t> pop_game(uint32_t player);
   [[nodiscard]] std::vector<uint32_t> pop_games_upto(uint32_t player,
-                                                     size_t n) noexcept {
-    return awaiting_inference_[player]->pop_upto(n, MAX_WAIT);
-  }
+                                                     size_t n);
   [[nodiscard]] std::optional<PlayHistory> pop_hist() noexcept {
     return history_.pop(MAX_WAIT);
   }
@@ -118,6 +139,22 @@ class DLLEXPORT PlayManager {
     return out;
   }
   size_t hist_count() const noexcept { return history_.size(); }
+  // Samples that entered and left deduplication.
+  // Their ratio is how much history shrank.
+  [[nodiscard]] uint64_t dedup_samples_in() const noexcept {
+    return dedup_.samples_in();
+  }
+  [[nodiscard]] uint64_t dedup_samples_out() const noexcept {
+    return dedup_.samples_out();
+  }
+  // Leaves given to the solver and how many it solved. The rest still went to
+  // inference.
+  [[nodiscard]] uint64_t solver_calls() const noexcept { return solver_calls_; }
+  [[nodiscard]] uint64_t solver_hits() const noexcept { return solver_hits_; }
+  // Latency histograms of each stage of play, merged from all threads.
+  [[nodiscard]] PlayStatsSnapshot stats() const { return stats_.snapshot(); }
+  // Timeline of all threads using the play manager. See trace.h.
+  [[nodiscard]] Tracer& tracer() noexcept { return tracer_; }
   [[nodiscard]] size_t cache_size() const {
     size_t out = 0;
     for (auto& cache : caches_) {
@@ -141,8 +178,15 @@ class DLLEXPORT PlayManager {
   };
 
  private:
+  // Resets game i to a new start state with fresh searches.
+  void start_game(uint32_t i);
+  // The random stream for role in the current game of slot i.
+  // Role 0 is the game itself. Role p + 1 is the search of player p.
+  [[nodiscard]] pcg32 stream(uint32_t i, uint32_t role) const noexcept;
+
   std::unique_ptr<GameState> base_gs_;
   const PlayParams params_;
+  const uint64_t seed_;
   std::vector<GameData> games_;
 
   std::mutex game_end_mutex_;
@@ -151,12 +195,17 @@ class DLLEXPORT PlayManager {
   uint64_t game_length_ = 0;
   std::atomic<uint32_t> games_completed_ = 0;
   Vector<float> resign_scores_;
+  std::atomic<uint64_t> solver_calls_ = 0;
+  std::atomic<uint64_t> solver_hits_ = 0;
 
   ConcurrentQueue<uint32_t> awaiting_mcts_;
   std::vector<std::unique_ptr<ConcurrentQueue<uint32_t>>> awaiting_inference_;
   ConcurrentQueue<PlayHistory> history_;
+  HistoryDedup dedup_;
 
   std::vector<Cache> caches_;
+  PlayStats stats_;
+  Tracer tracer_;
   // Eventaully contain history, maybe store it in GameData.
 };
 
@@ -2,7 +2,9 @@
 
 #include <future>
 
+#include "connect4_gs.h"
 #include "play_manager.h"
+#include "synthetic_evaluator.h"
 #include "tawlbwrdd_gs.h"
 
 namespace alphazero {
@@ -66,5 +68,56 @@ static void BM_PlayGameMultiThreaded(benchmark::State& state) {
 }
 BENCHMARK(BM_PlayGameMultiThreaded);
 
+// Self-play paced by a modeled GPU instead of instant inference.
+// Args are concurrent games, max batch size, and mcts workers.
+// Each player gets two concurrent batches on a shared device that takes
+// 1ms per batch plus 5us per sample.
+static void BM_PlayGameSyntheticGPU(benchmark::State& state) {
+  const auto concurrent_games = state.range(0);
+  const auto batch_size = state.range(1);
+  const auto workers = state.range(2);
+  auto games = 0L;
+  for (auto _ : state) {
+    auto params = PlayParams{};
+    params.games_to_play = concurrent_games;
+    params.concurrent_games = concurrent_games;
+    params.max_batch_size = batch_size;
+    params.mcts_depth = {50, 50};
+    params.history_enabled = true;
+    auto pm = PlayManager{std::make_unique<connect4_gs::Connect4GS>(), params};
+    auto eval_params = SyntheticEvaluatorParams{};
+    eval_params.batch_latency = std::chrono::milliseconds(1);
+    eval_params.sample_latency = std::chrono::microseconds(5);
+    eval_params.max_batch_size = batch_size;
+    eval_params.concurrent_batches = 2;
+    auto evaluator = SyntheticEvaluator{pm, eval_params};
+    auto play_workers = std::vector<std::future<void>>(workers);
+    for (auto& pw : play_workers) {
+      pw = std::async(std::launch::async, [&] { pm.play(); });
+    }
+    auto hist = std::async(std::launch::async, [&] {
+      while (pm.remaining_games() > 0 || pm.hist_count() > 0) {
+        benchmark::DoNotOptimize(pm.pop_hist_upto(batch_size));
+      }
+    });
+    evaluator.run();
+    for (auto& pw : play_workers) {
+      pw.wait();
+    }
+    hist.wait();
+    games += concurrent_games;
+    const auto stats = pm.stats();
+    state.counters["sims_per_second"] = stats.per_second(PROCESS_RESULT);
+    state.counters["inference_p50_us"] = stats.stages[INFERENCE_LATENCY].p50;
+  }
+  state.counters["games_per_second"] =
+      benchmark::Counter(games, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_PlayGameSyntheticGPU)
+    ->ArgNames({"games", "batch", "workers"})
+    ->ArgsProduct({{64, 256}, {16, 64}, {1, 4}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
 }  // namespace
 }  // namespace alphazero
\ No newline at end of file
@@ -1,9 +1,14 @@
 #include "play_manager.h"
 
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
 #include <future>
+#include <sstream>
 
 #include "connect4_gs.h"
 #include "gtest/gtest.h"
+#include "synthetic_evaluator.h"
 
 namespace alphazero {
 namespace {
@@ -43,6 +48,209 @@ TEST(PlayManager, Basic) {
   infer_p1.wait();
 }
 
+// NOLINTNEXTLINE
+TEST(PlayManager, HistoryDedup) {
+  auto params = PlayParams{};
+  params.games_to_play = 32;
+  params.concurrent_games = 8;
+  params.mcts_depth = {10, 10};
+  params.history_enabled = true;
+  params.history_dedup_capacity = 10'000;
+  auto pm = PlayManager{std::make_unique<connect4_gs::Connect4GS>(), params};
+  auto play = std::async(std::launch::async, [&] { pm.play(); });
+  auto infer_p0 = std::async(std::launch::async, [&] { pm.dumb_inference(0); });
+  auto infer_p1 = std::async(std::launch::async, [&] { pm.dumb_inference(1); });
+  play.get();
+  infer_p0.get();
+  infer_p1.get();
+
+  auto count = 0UL;
+  auto total_weight = 0.0;
+  for (auto hist = pm.pop_hist_upto(1'000); !hist.empty();
+       hist = pm.pop_hist_upto(1'000)) {
+    for (const auto& ph : hist) {
+      ++count;
+      total_weight += ph.weight;
+      EXPECT_NEAR(ph.v.sum(), 1, 1e-5);
+      EXPECT_NEAR(ph.pi.sum(), 1, 1e-5);
+    }
+  }
+  EXPECT_EQ(count, pm.dedup_samples_out());
+  EXPECT_FLOAT_EQ(total_weight, pm.dedup_samples_in());
+  // Every game starts from the same position.
+  EXPECT_LE(count, pm.dedup_samples_in() - 31);
+}
+
+// NOLINTNEXTLINE
+TEST(PlayManager, Stats) {
+  auto params = PlayParams{};
+  params.games_to_play = 8;
+  params.concurrent_games = 4;
+  params.mcts_depth = {10, 10};
+  params.solver_max_moves = 8;
+  auto pm = PlayManager{std::make_unique<connect4_gs::Connect4GS>(), params};
+  auto play = std::async(std::launch::async, [&] { pm.play(); });
+  auto infer_p0 = std::async(std::launch::async, [&] { pm.dumb_inference(0); });
+  auto infer_p1 = std::async(std::launch::async, [&] { pm.dumb_inference(1); });
+  play.get();
+  infer_p0.get();
+  infer_p1.get();
+
+  const auto stats = pm.stats();
+  EXPECT_GT(stats.elapsed_seconds, 0);
+  for (const auto& stage : stats.stages) {
+    EXPECT_GT(stage.count, 0);
+    EXPECT_LE(stage.p50, stage.p90);
+    EXPECT_LE(stage.p90, stage.p99);
+    EXPECT_LE(stage.p99, stage.max);
+  }
+  // Every move takes multiple searches to decide.
+  EXPECT_GT(stats.stages[PROCESS_RESULT].count,
+            stats.stages[MOVE_DECISION].count);
+  EXPECT_GE(stats.stages[MOVE_DECISION].count, pm.avg_game_length() * 7);
+  EXPECT_GT(stats.per_second(PROCESS_RESULT), 0);
+  // Only waits that got a game are recorded, and each is inferred once.
+  EXPECT_EQ(stats.stages[INFERENCE_QUEUE_WAIT].count,
+            stats.stages[INFERENCE_LATENCY].count);
+}
+
+// NOLINTNEXTLINE
+TEST(PlayManager, Solver) {
+  // The bottom four rows are full, leaving 14 empty squares.
+  auto board = connect4_gs::BoardTensor{};
+  board.setZero();
+  for (auto h = 2; h < connect4_gs::HEIGHT; ++h) {
+    for (auto w = 0; w < connect4_gs::WIDTH; ++w) {
+      board((h / 2 + w) % 2, h, w) = 1;
+    }
+  }
+  auto params = PlayParams{};
+  params.games_to_play = 8;
+  params.concurrent_games = 4;
+  params.mcts_depth = {10, 10};
+  params.solver_max_moves = 14;
+  auto pm = PlayManager{
+      std::make_unique<connect4_gs::Connect4GS>(board, 0, 28), params};
+  auto play = std::async(std::launch::async, [&] { pm.play(); });
+  auto infer_p0 = std::async(std::launch::async, [&] { pm.dumb_inference(0); });
+  auto infer_p1 = std::async(std::launch::async, [&] { pm.dumb_inference(1); });
+  play.get();
+  infer_p0.get();
+  infer_p1.get();
+
+  EXPECT_GT(pm.solver_calls(), 0);
+  EXPECT_EQ(pm.solver_hits(), pm.solver_calls());
+  const auto stats = pm.stats();
+  EXPECT_EQ(stats.stages[SOLVE].count, pm.solver_calls());
+  // Every leaf below the root is solved, so only roots need inference.
+  EXPECT_LE(stats.stages[INFERENCE_LATENCY].count,
+            stats.stages[MOVE_DECISION].count + params.concurrent_games);
+}
+
+// NOLINTNEXTLINE
+TEST(PlayManager, Trace) {
+  auto params = PlayParams{};
+  params.games_to_play = 4;
+  params.concurrent_games = 2;
+  params.mcts_depth = {10, 10};
+  params.trace_capacity = 1'000;
+  auto pm = PlayManager{std::make_unique<connect4_gs::Connect4GS>(), params};
+  auto play = std::async(std::launch::async, [&] { pm.play(); });
+  auto infer_p0 = std::async(std::launch::async, [&] { pm.dumb_inference(0); });
+  auto infer_p1 = std::async(std::launch::async, [&] { pm.dumb_inference(1); });
+  play.get();
+  infer_p0.get();
+  infer_p1.get();
+
+  const auto path = (std::filesystem::temp_directory_path() /
+                     "alphazero_play_manager_trace_test.json")
+                        .string();
+  pm.tracer().dump_json(path);
+  auto in = std::ifstream{path};
+  auto ss = std::stringstream{};
+  ss << in.rdbuf();
+  const auto json = ss.str();
+  std::filesystem::remove(path);
+  for (const auto* name :
+       {"\"mcts\"", "\"prepare_leaf\"", "\"process_result\"",
+        "\"play_move\""}) {
+    EXPECT_NE(json.find(name), std::string::npos) << name;
+  }
+}
+
+// NOLINTNEXTLINE
+TEST(PlayManager, SyntheticEvaluator) {
+  for (const auto device_thread : {true, false}) {
+    auto params = PlayParams{};
+    params.games_to_play = 16;
+    params.concurrent_games = 16;
+    params.max_batch_size = 4;
+    params.mcts_depth = {10, 10};
+    auto pm = PlayManager{std::make_unique<connect4_gs::Connect4GS>(), params};
+    auto eval_params = SyntheticEvaluatorParams{};
+    eval_params.batch_latency = std::chrono::microseconds(200);
+    eval_params.sample_latency = std::chrono::microseconds(10);
+    eval_params.max_batch_size = 4;
+    eval_params.concurrent_batches = 2;
+    eval_params.device_thread = device_thread;
+    auto evaluator = SyntheticEvaluator{pm, eval_params};
+    auto play = std::async(std::launch::async, [&] { pm.play(); });
+    evaluator.run();
+    play.get();
+
+    EXPECT_EQ(pm.remaining_games(), 0);
+    const auto stats = pm.stats();
+    // Every inference waits out at least the fixed batch latency.
+    EXPECT_GT(stats.stages[INFERENCE_LATENCY].count, 0);
+    EXPECT_GE(stats.stages[INFERENCE_LATENCY].p50, 200);
+  }
+}
+
+// Plays seeded games and returns their history, sorted so it doesn't depend
+// on the order games finished in.
+std::vector<std::string> seeded_history(uint64_t seed, uint32_t play_threads) {
+  auto params = PlayParams{};
+  params.games_to_play = 8;
+  params.concurrent_games = 8;
+  params.mcts_depth = {10, 10};
+  params.history_enabled = true;
+  params.add_noise = true;
+  params.playout_cap_randomization = true;
+  params.seed = seed;
+  auto pm = PlayManager{std::make_unique<connect4_gs::Connect4GS>(), params};
+  auto workers = std::vector<std::future<void>>{};
+  for (auto i = 0U; i < play_threads; ++i) {
+    workers.push_back(std::async(std::launch::async, [&] { pm.play(); }));
+  }
+  workers.push_back(
+      std::async(std::launch::async, [&] { pm.dumb_inference(0); }));
+  workers.push_back(
+      std::async(std::launch::async, [&] { pm.dumb_inference(1); }));
+  for (auto& w : workers) {
+    w.get();
+  }
+  auto out = std::vector<std::string>{};
+  while (pm.hist_count() > 0) {
+    for (const auto& ph : pm.pop_hist_upto(64)) {
+      auto ss = std::stringstream{};
+      ss << ph.v.transpose() << " | " << ph.pi.transpose();
+      out.push_back(ss.str());
+    }
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+// NOLINTNEXTLINE
+TEST(PlayManager, SeededIsReproducible) {
+  const auto single = seeded_history(7, 1);
+  EXPECT_FALSE(single.empty());
+  EXPECT_EQ(single, seeded_history(7, 1));
+  // Every game has its own streams, so scheduling doesn't matter.
+  EXPECT_EQ(single, seeded_history(7, 3));
+  EXPECT_NE(single, seeded_history(8, 1));
+}
+
 TEST(PlayManager, MultiThreaded) {
   const auto cores = std::thread::hardware_concurrency();
   const auto workers = cores - 1;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 
 #include "nichess_gs.h"
@@ -11,6 +12,8 @@
 #include "pybind11/numpy.h"
 #include "pybind11/pybind11.h"
 #include "pybind11/stl.h"
+#include "replay_buffer.h"
+#include "resampler.h"
 #include "tawlbwrdd_gs.h"
 
 // This file deals with exposing C++ to Python.
@@ -65,6 +68,7 @@ PYBIND11_MODULE(alphazero, m) {
       .def(
           "pi", [](PlayHistory& ph) { return &ph.pi; },
           py::return_value_policy::reference_internal)
+      .def("weight", [](const PlayHistory& ph) { return ph.weight; })
       .def(
           "canonical",
           [](PlayHistory& ph) {
@@ -95,15 +99,18 @@ PYBIND11_MODULE(alphazero, m) {
            py::call_guard<py::gil_scoped_release>())
       .def("scores", &GameState::scores,
            py::call_guard<py::gil_scoped_release>())
-      .def(
-          "canonicalized",
-          [](const GameState* gs) {
-            auto out_tensor = gs->canonicalized();
-            py::gil_scoped_acquire acquire;
-            return py::array_t<float, py::array::c_style>(
-                out_tensor.dimensions(), out_tensor.data());
-          },
-          py::call_guard<py::gil_scoped_release>());
+      .def("canonicalized",
+           [](const GameState* gs) {
+             // Fill the numpy array directly instead of copying a tensor.
+             auto out = py::array_t<float, py::array::c_style>(
+                 gs->canonical_shape());
+             auto* data = out.mutable_data();
+             {
+               py::gil_scoped_release release;
+               gs->canonicalize_into(data);
+             }
+             return out;
+           });
 
   py::class_<MCTS>(m, "MCTS")
       .def(py::init<float, uint32_t, uint32_t>())
@@ -115,7 +122,8 @@ PYBIND11_MODULE(alphazero, m) {
       .def("counts", &MCTS::counts)
       .def("probs", &MCTS::probs)
       .def("depth", &MCTS::depth)
-      .def_static("pick_move", &MCTS::pick_move);
+      .def_static("pick_move", static_cast<uint32_t (*)(const Vector<float>&)>(
+                                   &MCTS::pick_move));
 
   py::class_<GameData>(m, "GameData")
       .def(
@@ -159,6 +167,8 @@ PYBIND11_MODULE(alphazero, m) {
       .def_readwrite("final_temp", &PlayParams::final_temp)
       .def_readwrite("temp_decay_half_life", &PlayParams::temp_decay_half_life)
       .def_readwrite("history_enabled", &PlayParams::history_enabled)
+      .def_readwrite("history_dedup_capacity",
+                     &PlayParams::history_dedup_capacity)
       .def_readwrite("tree_reuse", &PlayParams::tree_reuse)
       .def_readwrite("self_play", &PlayParams::self_play)
       .def_readwrite("add_noise", &PlayParams::add_noise)
@@ -166,7 +176,10 @@ PYBIND11_MODULE(alphazero, m) {
       .def_readwrite("fpu_reduction", &PlayParams::fpu_reduction)
       .def_readwrite("resign_percent", &PlayParams::resign_percent)
       .def_readwrite("resign_playthrough_percent",
-                     &PlayParams::resign_playthrough_percent);
+                     &PlayParams::resign_playthrough_percent)
+      .def_readwrite("solver_max_moves", &PlayParams::solver_max_moves)
+      .def_readwrite("trace_capacity", &PlayParams::trace_capacity)
+      .def_readwrite("seed", &PlayParams::seed);
 
   py::class_<PlayManager>(m, "PlayManager")
       .def(py::init([](const GameState* gs, PlayParams params) {
@@ -184,7 +197,49 @@ PYBIND11_MODULE(alphazero, m) {
       .def("awaiting_inference_count", &PlayManager::awaiting_inference_count)
       .def("awaiting_mcts_count", &PlayManager::awaiting_mcts_count)
       .def("hist_count", &PlayManager::hist_count)
+      .def("dedup_samples_in", &PlayManager::dedup_samples_in)
+      .def("dedup_samples_out", &PlayManager::dedup_samples_out)
       .def("cache_hits", &PlayManager::cache_hits)
+      .def("solver_calls", &PlayManager::solver_calls)
+      .def("solver_hits", &PlayManager::solver_hits)
+      .def("trace_now", [](PlayManager& pm) { return pm.tracer().now(); })
+      .def(
+          "trace_span",
+          [](PlayManager& pm, const std::string& thread_name,
+             const std::string& name, int64_t start) {
+            auto& tracer = pm.tracer();
+            auto* trace = tracer.local(thread_name.c_str());
+            if (trace != nullptr) {
+              trace->record(tracer.intern(name), start, tracer.now());
+            }
+          },
+          py::call_guard<py::gil_scoped_release>())
+      .def(
+          "dump_trace",
+          [](PlayManager& pm, const std::string& path) {
+            pm.tracer().dump_json(path);
+          },
+          py::call_guard<py::gil_scoped_release>())
+      .def(
+          "stats",
+          [](const PlayManager& pm) {
+            const auto snap = pm.stats();
+            auto out = py::dict{};
+            out["elapsed_seconds"] = snap.elapsed_seconds;
+            for (auto s = 0; s < PLAY_STAGE_COUNT; ++s) {
+              const auto& stage = snap.stages[s];
+              auto d = py::dict{};
+              d["count"] = stage.count;
+              d["per_second"] = snap.per_second(static_cast<PlayStage>(s));
+              d["mean_us"] = stage.mean;
+              d["p50_us"] = stage.p50;
+              d["p90_us"] = stage.p90;
+              d["p99_us"] = stage.p99;
+              d["max_us"] = stage.max;
+              out[PLAY_STAGE_NAMES[s]] = d;
+            }
+            return out;
+          })
       .def("cache_misses", &PlayManager::cache_misses)
       .def("avg_game_length", &PlayManager::avg_game_length)
       .def("play", &PlayManager::play, py::call_guard<py::gil_scoped_release>())
@@ -199,39 +254,55 @@ PYBIND11_MODULE(alphazero, m) {
       .def(
           "build_history_batch",
           [](PlayManager& pm, py::array_t<float>& canonical,
-             py::array_t<float>& v, py::array_t<float>& pi) {
+             py::array_t<float>& v, py::array_t<float>& pi,
+             std::optional<py::array_t<float>>& weight) {
+            if ((canonical.flags() & py::array::c_style) == 0) {
+              throw std::runtime_error{"Batch must be C contiguous"};
+            }
             auto current = 0U;
             auto rc = canonical.mutable_unchecked<4>();
             auto rv = v.mutable_unchecked<2>();
             auto rpi = pi.mutable_unchecked<2>();
+            auto rw = std::optional<py::detail::unchecked_mutable_reference<
+                float, 1>>{};
+            if (weight.has_value()) {
+              rw = weight->mutable_unchecked<1>();
+            }
             while (current < canonical.shape(0) &&
                    (pm.remaining_games() > 0 || pm.hist_count() > 0)) {
               auto hist = pm.pop_hist();
               if (!hist.has_value()) {
                 continue;
               }
-              for (auto i = 0L; i < canonical.shape(1); ++i) {
-                for (auto j = 0L; j < canonical.shape(2); ++j) {
-                  for (auto k = 0L; k < canonical.shape(3); ++k) {
-                    rc(current, i, j, k) = hist->canonical(i, j, k);
-                  }
-                }
+              if (hist->canonical.size() !=
+                  canonical.shape(1) * canonical.shape(2) * canonical.shape(3)) {
+                throw std::runtime_error{"Improper batch size"};
               }
+              std::copy(hist->canonical.data(),
+                        hist->canonical.data() + hist->canonical.size(),
+                        rc.mutable_data(current, 0, 0, 0));
               for (auto i = 0L; i < v.shape(1); ++i) {
                 rv(current, i) = hist->v(i);
               }
               for (auto i = 0L; i < pi.shape(1); ++i) {
                 rpi(current, i) = hist->pi(i);
               }
+              if (rw.has_value()) {
+                (*rw)(current) = hist->weight;
+              }
               ++current;
             }
             return current;
           },
+          py::arg("canonical"), py::arg("v"), py::arg("pi"),
+          py::arg("weight") = std::nullopt,
           py::call_guard<py::gil_scoped_release>())
       .def(
           "build_batch",
           [](PlayManager& pm, uint32_t player, py::array_t<float>& batch,
              uint32_t concurrent_batches) {
+            TraceSpan span{pm.tracer(), pm.tracer().local("batch_builder"),
+                           "build_batch"};
             const auto mbs = pm.params().max_batch_size;
             const auto max_bs = [&]() {
               auto remaining_ratio =
@@ -255,17 +326,14 @@ PYBIND11_MODULE(alphazero, m) {
                       batch.shape(2) != canonical.dimension(1) ||
                       batch.shape(3) != canonical.dimension(2)) {
                     throw std::runtime_error{"Improper batch size"};
+                  } else if ((batch.flags() & py::array::c_style) == 0) {
+                    throw std::runtime_error{"Batch must be C contiguous"};
                   } else {
                     dimensions_checked = true;
                   }
                 }
-                for (auto j = 0L; j < canonical.dimension(0); ++j) {
-                  for (auto k = 0L; k < canonical.dimension(1); ++k) {
-                    for (auto l = 0L; l < canonical.dimension(2); ++l) {
-                      raw(current, j, k, l) = canonical(j, k, l);
-                    }
-                  }
-                }
+                std::copy(canonical.data(), canonical.data() + canonical.size(),
+                          raw.mutable_data(current, 0, 0, 0));
                 out.push_back(i);
                 ++current;
               }
@@ -274,6 +342,84 @@ PYBIND11_MODULE(alphazero, m) {
           },
           py::call_guard<py::gil_scoped_release>());
 
+  py::class_<ReplayBuffer>(m, "ReplayBuffer")
+      .def(py::init([](std::string folder,
+                       const std::vector<std::pair<std::string, size_t>>&
+                           columns,
+                       uint32_t batch_size, uint32_t prefetch_depth,
+                       uint32_t workers, std::optional<uint64_t> seed) {
+             auto cols = std::vector<ShardColumn>{};
+             for (const auto& [name, width] : columns) {
+               cols.push_back({name, width});
+             }
+             return std::make_unique<ReplayBuffer>(
+                 std::move(folder), std::move(cols), batch_size,
+                 prefetch_depth, workers, seed);
+           }),
+           py::arg("folder"), py::arg("columns"), py::arg("batch_size"),
+           py::arg("prefetch_depth"), py::arg("workers"),
+           py::arg("seed") = std::nullopt)
+      .def(
+          "set_buffers",
+          [](ReplayBuffer& rb, uint32_t slot, std::vector<py::array>& buffers) {
+            if (buffers.size() != rb.columns().size()) {
+              throw std::runtime_error{
+                  "There must be a buffer for each column"};
+            }
+            auto raw = std::vector<float*>{};
+            for (auto i = 0UL; i < buffers.size(); ++i) {
+              auto& buffer = buffers[i];
+              // Anything that would need a conversion would be filled as a
+              // temporary copy, so it must be rejected.
+              if (!py::isinstance<py::array_t<float>>(buffer) ||
+                  !(buffer.flags() & py::array::c_style) ||
+                  !buffer.writeable()) {
+                throw std::runtime_error{
+                    "Replay buffers must be writeable contiguous float32 "
+                    "arrays"};
+              }
+              if (static_cast<size_t>(buffer.size()) <
+                  rb.batch_size() * rb.columns()[i].width) {
+                throw std::runtime_error{"Replay buffer is too small"};
+              }
+              raw.push_back(static_cast<float*>(buffer.mutable_data()));
+            }
+            rb.set_buffers(slot, raw);
+          },
+          py::keep_alive<1, 3>())
+      .def("set_window", &ReplayBuffer::set_window,
+           py::call_guard<py::gil_scoped_release>())
+      .def("pop_batch", &ReplayBuffer::pop_batch,
+           py::call_guard<py::gil_scoped_release>())
+      .def("release_batch", &ReplayBuffer::release_batch)
+      .def("size", &ReplayBuffer::size)
+      .def("shard_count", &ReplayBuffer::shard_count)
+      .def("batch_size", &ReplayBuffer::batch_size)
+      .def("prefetch_depth", &ReplayBuffer::prefetch_depth);
+
+  m.def(
+      "resample_by_surprise",
+      [](const std::string& in_folder, const std::string& out_folder,
+         uint32_t iteration,
+         const std::vector<std::pair<std::string, size_t>>& columns,
+         const py::array_t<double, py::array::c_style |
+                                       py::array::forcecast>& losses,
+         uint32_t max_shard_size, uint32_t workers,
+         std::optional<uint64_t> seed) {
+        auto cols = std::vector<ShardColumn>{};
+        for (const auto& [name, width] : columns) {
+          cols.push_back({name, width});
+        }
+        const auto* data = losses.data();
+        const auto size = static_cast<size_t>(losses.size());
+        py::gil_scoped_release release;
+        return resample_by_surprise(in_folder, out_folder, iteration, cols,
+                                    data, size, max_shard_size, workers, seed);
+      },
+      py::arg("in_folder"), py::arg("out_folder"), py::arg("iteration"),
+      py::arg("columns"), py::arg("losses"), py::arg("max_shard_size"),
+      py::arg("workers"), py::arg("seed") = std::nullopt);
+
   py::class_<onitama_gs::Card>(m, "OnitamaCard")
       .def_readonly("name", &onitama_gs::Card::name)
       .def_readonly("movements", &onitama_gs::Card::movements)
@@ -0,0 +1,242 @@
+#include "replay_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <tuple>
+
+#include "pcg/pcg_random.hpp"
+
+namespace alphazero {
+
+using namespace std::chrono_literals;
+
+constexpr const auto REPLAY_WAIT = 10ms;
+
+ReplayBuffer::ReplayBuffer(std::string folder, std::vector<ShardColumn> columns,
+                           uint32_t batch_size, uint32_t prefetch_depth,
+                           uint32_t workers, std::optional<uint64_t> seed)
+    : folder_(std::move(folder)),
+      columns_(std::move(columns)),
+      batch_size_(batch_size),
+      weight_column_(find_weight_column(columns_)),
+      seed_(seed.has_value() ? *seed
+                             : (static_cast<uint64_t>(std::random_device{}())
+                                << 32) |
+                                   std::random_device{}()) {
+  if (columns_.empty() || batch_size_ == 0 || prefetch_depth == 0 ||
+      workers == 0) {
+    throw std::runtime_error{
+        "A replay buffer needs columns, a batch size, a prefetch depth, and "
+        "workers"};
+  }
+  buffers_.resize(prefetch_depth);
+  handed_out_.resize(prefetch_depth, false);
+  workers_.reserve(workers);
+  for (auto i = 0U; i < workers; ++i) {
+    workers_.emplace_back([this, i] { fill_loop(i); });
+  }
+}
+
+ReplayBuffer::~ReplayBuffer() {
+  stop_ = true;
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ReplayBuffer::set_buffers(uint32_t slot,
+                               const std::vector<float*>& buffers) {
+  if (slot >= buffers_.size()) {
+    throw std::runtime_error{"Slot is larger than the prefetch depth"};
+  }
+  if (!buffers_[slot].empty()) {
+    throw std::runtime_error{"Slot already has buffers"};
+  }
+  if (buffers.size() != columns_.size()) {
+    throw std::runtime_error{"There must be a buffer for each column"};
+  }
+  buffers_[slot] = buffers;
+  free_.push(slot);
+}
+
+uint64_t ReplayBuffer::set_window(uint32_t first_iteration,
+                                  uint32_t last_iteration) {
+  const auto found =
+      find_shards(folder_, first_iteration, last_iteration, columns_);
+
+  std::unique_lock lock{window_mutex_};
+  auto kept = std::map<std::string, size_t>{};
+  for (auto i = size_t{0}; i < shards_.size(); ++i) {
+    kept.emplace(shards_[i].info.path(columns_[0].name), i);
+  }
+  // The new window is built aside and only swapped in once every shard has
+  // opened, so a bad shard leaves the old window in place. Kept shards are
+  // moved over last, since moving them can't throw.
+  auto shards = std::vector<Shard>{};
+  shards.reserve(found.size());
+  auto moved = std::vector<std::pair<size_t, size_t>>{};
+  auto ends = std::vector<uint64_t>{};
+  ends.reserve(found.size());
+  auto weight_ends = std::vector<double>{};
+  auto total = uint64_t{0};
+  auto total_weight = 0.0;
+  for (const auto& info : found) {
+    auto it = kept.find(info.path(columns_[0].name));
+    if (it != kept.end()) {
+      moved.emplace_back(shards.size(), it->second);
+      shards.push_back(Shard{info, {}, {}});
+    } else {
+      auto shard = Shard{info, {}, {}};
+      shard.columns.reserve(columns_.size());
+      for (auto c = 0UL; c < columns_.size(); ++c) {
+        const auto path = info.path(columns_[c].name);
+        if (weight_column_ == c && !std::filesystem::exists(path)) {
+          shard.columns.emplace_back();
+          continue;
+        }
+        shard.columns.emplace_back(std::in_place, path);
+        if (shard.columns.back()->bytes() !=
+            sizeof(float) * columns_[c].width * info.size) {
+          throw std::runtime_error{"Shard has the wrong size: " + path};
+        }
+      }
+      if (weight_column_.has_value()) {
+        const auto& weights = shard.columns[*weight_column_];
+        shard.weight_ends.reserve(info.size);
+        auto sum = 0.0;
+        for (auto i = 0U; i < info.size; ++i) {
+          const auto w = weights.has_value() ? weights->data()[i] : 1.0F;
+          if (!(w >= 0)) {
+            throw std::runtime_error{"Sample weights must not be negative: " +
+                                     info.path(WEIGHT_COLUMN)};
+          }
+          sum += w;
+          shard.weight_ends.push_back(sum);
+        }
+      }
+      shards.push_back(std::move(shard));
+    }
+    total += info.size;
+    ends.push_back(total);
+    if (weight_column_.has_value()) {
+      const auto& shard_ends = it != kept.end()
+                                   ? shards_[it->second].weight_ends
+                                   : shards.back().weight_ends;
+      total_weight += shard_ends.empty() ? 0.0 : shard_ends.back();
+      weight_ends.push_back(total_weight);
+    }
+  }
+  for (const auto& [to, from] : moved) {
+    shards[to] = std::move(shards_[from]);
+  }
+  shards_ = std::move(shards);
+  ends_ = std::move(ends);
+  weight_ends_ = std::move(weight_ends);
+  total_ = total;
+
+  // Anything already sampled came from the old window.
+  while (auto slot = ready_.try_pop()) {
+    free_.push(*slot);
+  }
+  return total;
+}
+
+size_t ReplayBuffer::shard_count() const {
+  std::shared_lock lock{window_mutex_};
+  return shards_.size();
+}
+
+std::optional<uint32_t> ReplayBuffer::pop_batch() noexcept {
+  auto slot = ready_.pop(REPLAY_WAIT);
+  if (slot.has_value()) {
+    std::unique_lock lock{slots_mutex_};
+    handed_out_[*slot] = true;
+  }
+  return slot;
+}
+
+void ReplayBuffer::release_batch(uint32_t slot) {
+  if (slot >= buffers_.size() || buffers_[slot].empty()) {
+    throw std::runtime_error{"Released an unknown slot"};
+  }
+  {
+    std::unique_lock lock{slots_mutex_};
+    if (!handed_out_[slot]) {
+      throw std::runtime_error{"Released a slot that was not handed out"};
+    }
+    handed_out_[slot] = false;
+  }
+  free_.push(slot);
+}
+
+std::pair<size_t, uint64_t> ReplayBuffer::find_weighted(
+    double x) const noexcept {
+  // Each sample owns the range of weight that ends at it, so samples and
+  // shards with no weight are never found. Rounding can put x at the very
+  // end, which belongs to the last weighted shard.
+  x = std::min(x, std::nextafter(weight_ends_.back(), 0.0));
+  const auto s = static_cast<size_t>(
+      std::upper_bound(weight_ends_.begin(), weight_ends_.end(), x) -
+      weight_ends_.begin());
+  const auto& ends = shards_[s].weight_ends;
+  const auto local = x - (s == 0 ? 0.0 : weight_ends_[s - 1]);
+  const auto offset = std::min<size_t>(
+      std::upper_bound(ends.begin(), ends.end(), local) - ends.begin(),
+      ends.size() - 1);
+  return {s, offset};
+}
+
+void ReplayBuffer::fill_loop(uint32_t worker) {
+  auto re = pcg32{seed_, worker};
+  while (!stop_) {
+    const auto slot = free_.pop(REPLAY_WAIT);
+    if (!slot.has_value()) {
+      continue;
+    }
+    std::shared_lock lock{window_mutex_};
+    const auto total_weight =
+        weight_ends_.empty() ? 0.0 : weight_ends_.back();
+    if (total_ == 0 || (weight_column_.has_value() && total_weight <= 0)) {
+      lock.unlock();
+      free_.push(*slot);
+      std::this_thread::sleep_for(REPLAY_WAIT);
+      continue;
+    }
+    auto dist = std::uniform_int_distribution<uint64_t>{0, total_ - 1};
+    auto weight_dist =
+        std::uniform_real_distribution<double>{0.0, total_weight};
+    const auto& out = buffers_[*slot];
+    for (auto b = 0U; b < batch_size_; ++b) {
+      auto s = size_t{0};
+      auto offset = uint64_t{0};
+      if (weight_column_.has_value()) {
+        std::tie(s, offset) = find_weighted(weight_dist(re));
+      } else {
+        const auto sample = dist(re);
+        s = static_cast<size_t>(
+            std::upper_bound(ends_.begin(), ends_.end(), sample) -
+            ends_.begin());
+        offset = sample - (ends_[s] - shards_[s].info.size);
+      }
+      for (auto c = 0UL; c < columns_.size(); ++c) {
+        const auto width = columns_[c].width;
+        const auto& column = shards_[s].columns[c];
+        if (!column.has_value()) {
+          std::fill_n(out[c] + b * width, width, 1.0F);
+          continue;
+        }
+        std::memcpy(out[c] + b * width, column->data() + offset * width,
+                    sizeof(float) * width);
+      }
+    }
+    // Pushed under the lock so set_window can discard it if it is stale.
+    ready_.push(*slot);
+  }
+}
+
+}  // namespace alphazero
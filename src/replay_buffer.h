@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "concurrent_queue.h"
+#include "dll_export.h"
+#include "shard_io.h"
+
+namespace alphazero {
+
+// A replay buffer over the history shards of a sliding window of iterations.
+// Shards are memory mapped instead of loaded, so changing the window only
+// maps the newly added shards and unmaps the ones that fell out of it.
+//
+// Batches are sampled with replacement by worker threads. Samples are drawn
+// uniformly, or in proportion to their weight if there is a weight column.
+// They are written directly into caller provided buffers (generally pinned
+// tensors). Each buffer is a slot. The number of slots is the prefetch depth.
+// A slot is filled by a worker, handed out by pop_batch, and must be given
+// back with release_batch before it is filled again. Releasing a slot that
+// was not handed out throws, so a slot is never filled while it is read.
+
+class DLLEXPORT ReplayBuffer {
+ public:
+  ReplayBuffer(std::string folder, std::vector<ShardColumn> columns,
+               uint32_t batch_size, uint32_t prefetch_depth, uint32_t workers,
+               std::optional<uint64_t> seed = std::nullopt);
+  ~ReplayBuffer();
+  ReplayBuffer(const ReplayBuffer&) = delete;
+  ReplayBuffer& operator=(const ReplayBuffer&) = delete;
+
+  // Registers the buffers to fill for a slot. There must be one buffer per
+  // column, each able to hold batch_size samples. The buffers must outlive
+  // the replay buffer.
+  void set_buffers(uint32_t slot, const std::vector<float*>& buffers);
+
+  // Sets the window to all shards with iterations in [first, last].
+  // Batches prefetched from the old window are discarded.
+  // Returns the number of samples in the window. Throws if a shard can't be
+  // used, and the old window is kept.
+  uint64_t set_window(uint32_t first_iteration, uint32_t last_iteration);
+
+  // Returns a filled slot if one becomes ready within the max wait.
+  [[nodiscard]] std::optional<uint32_t> pop_batch() noexcept;
+  void release_batch(uint32_t slot);
+
+  [[nodiscard]] uint64_t size() const noexcept { return total_; }
+  [[nodiscard]] size_t shard_count() const;
+  [[nodiscard]] uint32_t batch_size() const noexcept { return batch_size_; }
+  [[nodiscard]] const std::vector<ShardColumn>& columns() const noexcept {
+    return columns_;
+  }
+  [[nodiscard]] uint32_t prefetch_depth() const noexcept {
+    return static_cast<uint32_t>(buffers_.size());
+  }
+
+ private:
+  struct Shard {
+    ShardInfo info;
+    // Only the weight column can be missing.
+    std::vector<std::optional<MappedFile>> columns;
+    // Cumulative weight at the end of each sample, if weighted.
+    std::vector<double> weight_ends;
+  };
+
+  // Returns the shard and offset of the sample that owns position x of the
+  // cumulative weight.
+  [[nodiscard]] std::pair<size_t, uint64_t> find_weighted(
+      double x) const noexcept;
+  void fill_loop(uint32_t worker);
+
+  const std::string folder_;
+  const std::vector<ShardColumn> columns_;
+  const uint32_t batch_size_;
+  const std::optional<size_t> weight_column_;
+  const uint64_t seed_;
+
+  std::vector<std::vector<float*>> buffers_;
+  ConcurrentQueue<uint32_t> free_;
+  ConcurrentQueue<uint32_t> ready_;
+  // Whether each slot has been handed out by pop_batch and not released.
+  std::mutex slots_mutex_;
+  std::vector<bool> handed_out_;
+
+  // Guards the shards. Workers hold it shared while filling a batch.
+  mutable std::shared_mutex window_mutex_;
+  std::vector<Shard> shards_;
+  // Cumulative sample count at the end of each shard.
+  std::vector<uint64_t> ends_;
+  std::atomic<uint64_t> total_ = 0;
+  // Cumulative weight at the end of each shard, if weighted.
+  std::vector<double> weight_ends_;
+
+  std::atomic<bool> stop_ = false;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace alphazero
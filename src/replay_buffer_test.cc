@@ -0,0 +1,233 @@
+#include "replay_buffer.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include "gtest/gtest.h"
+
+namespace alphazero {
+namespace {
+
+namespace fs = std::filesystem;
+
+const auto COLUMNS = std::vector<ShardColumn>{{"canonical", 3}, {"v", 2}};
+
+// Writes a shard where every float of a sample is its id.
+void write_shard(const fs::path& folder, uint32_t iteration, uint32_t batch,
+                 uint32_t size, float first_id) {
+  char head[16];
+  std::snprintf(head, sizeof(head), "%04u-%04u", iteration, batch);
+  const auto info = ShardInfo{(folder / head).string(), iteration, size};
+  for (const auto& col : COLUMNS) {
+    auto data = std::vector<float>{};
+    for (auto i = 0U; i < size; ++i) {
+      data.insert(data.end(), col.width, first_id + i);
+    }
+    std::ofstream f{info.path(col.name), std::ios::binary};
+    f.write(reinterpret_cast<const char*>(data.data()),
+            data.size() * sizeof(float));
+  }
+}
+
+// Adds a weight column to a shard.
+void write_weights(const fs::path& folder, uint32_t iteration, uint32_t batch,
+                   const std::vector<float>& weights) {
+  char head[16];
+  std::snprintf(head, sizeof(head), "%04u-%04u", iteration, batch);
+  const auto info = ShardInfo{(folder / head).string(), iteration,
+                              static_cast<uint32_t>(weights.size())};
+  std::ofstream f{info.path(WEIGHT_COLUMN), std::ios::binary};
+  f.write(reinterpret_cast<const char*>(weights.data()),
+          weights.size() * sizeof(float));
+}
+
+class ReplayBufferTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    folder_ = fs::temp_directory_path() /
+              ("replay_buffer_test_" +
+               std::string{::testing::UnitTest::GetInstance()
+                               ->current_test_info()
+                               ->name()});
+    fs::remove_all(folder_);
+    fs::create_directories(folder_);
+    // Iteration i has ids in [100 * i, 100 * i + 10).
+    for (auto i = 0U; i < 3; ++i) {
+      write_shard(folder_, i, 0, 4, 100 * i);
+      write_shard(folder_, i, 1, 6, 100 * i + 4);
+    }
+  }
+
+  void TearDown() override { fs::remove_all(folder_); }
+
+  fs::path folder_;
+};
+
+// NOLINTNEXTLINE
+TEST_F(ReplayBufferTest, FindShards) {
+  // An incomplete shard is ignored.
+  std::ofstream{folder_ / "0001-0002-canonical-3.pt"};
+
+  auto shards = find_shards(folder_.string(), 1, 2, COLUMNS);
+  ASSERT_EQ(shards.size(), 4);
+  EXPECT_EQ(shards[0].iteration, 1);
+  EXPECT_EQ(shards[0].size, 4);
+  EXPECT_EQ(shards[1].iteration, 1);
+  EXPECT_EQ(shards[1].size, 6);
+  EXPECT_EQ(shards[3].iteration, 2);
+  EXPECT_EQ(shards[3].path("v"), (folder_ / "0002-0001-v-6.pt").string());
+
+  EXPECT_TRUE(find_shards((folder_ / "missing").string(), 0, 2, COLUMNS)
+                  .empty());
+}
+
+// NOLINTNEXTLINE
+TEST_F(ReplayBufferTest, SamplesWindow) {
+  constexpr const auto BATCH_SIZE = 64;
+  constexpr const auto PREFETCH = 3;
+  auto rb = ReplayBuffer{folder_.string(), COLUMNS, BATCH_SIZE, PREFETCH, 2,
+                         42};
+  auto canonical = std::vector<std::vector<float>>(
+      PREFETCH, std::vector<float>(BATCH_SIZE * 3));
+  auto v = std::vector<std::vector<float>>(PREFETCH,
+                                           std::vector<float>(BATCH_SIZE * 2));
+  for (auto i = 0U; i < PREFETCH; ++i) {
+    rb.set_buffers(i, {canonical[i].data(), v[i].data()});
+  }
+  EXPECT_THROW(rb.set_buffers(0, {canonical[0].data(), v[0].data()}),
+               std::runtime_error);
+
+  // Nothing is sampled from an empty window.
+  EXPECT_EQ(rb.pop_batch(), std::nullopt);
+
+  const auto check_window = [&](uint32_t first, uint32_t last) {
+    auto seen = std::vector<bool>(300, false);
+    for (auto n = 0; n < 20; ++n) {
+      auto slot = rb.pop_batch();
+      while (!slot.has_value()) {
+        slot = rb.pop_batch();
+      }
+      for (auto b = 0; b < BATCH_SIZE; ++b) {
+        const auto id = canonical[*slot][b * 3];
+        EXPECT_GE(id, 100 * first);
+        EXPECT_LT(id, 100 * last + 10);
+        EXPECT_LT(static_cast<int>(id) % 100, 10);
+        // All columns come from the same sample.
+        EXPECT_EQ(canonical[*slot][b * 3 + 2], id);
+        EXPECT_EQ(v[*slot][b * 2], id);
+        EXPECT_EQ(v[*slot][b * 2 + 1], id);
+        seen[static_cast<int>(id)] = true;
+      }
+      rb.release_batch(*slot);
+    }
+    // With 1280 samples from at most 20 ids, every id should show up.
+    for (auto i = first; i <= last; ++i) {
+      for (auto j = 0U; j < 10; ++j) {
+        EXPECT_TRUE(seen[100 * i + j]) << 100 * i + j;
+      }
+    }
+  };
+
+  EXPECT_EQ(rb.set_window(0, 1), 20);
+  EXPECT_EQ(rb.shard_count(), 4);
+  check_window(0, 1);
+
+  // Slide the window forward.
+  EXPECT_EQ(rb.set_window(1, 2), 20);
+  check_window(1, 2);
+
+  EXPECT_EQ(rb.set_window(2, 2), 10);
+  EXPECT_EQ(rb.shard_count(), 2);
+  check_window(2, 2);
+}
+
+// NOLINTNEXTLINE
+TEST_F(ReplayBufferTest, BadShardKeepsOldWindow) {
+  constexpr const auto BATCH_SIZE = 16;
+  auto rb = ReplayBuffer{folder_.string(), COLUMNS, BATCH_SIZE, 1, 1, 42};
+  auto canonical = std::vector<float>(BATCH_SIZE * 3);
+  auto v = std::vector<float>(BATCH_SIZE * 2);
+  rb.set_buffers(0, {canonical.data(), v.data()});
+  EXPECT_EQ(rb.set_window(0, 0), 10);
+
+  // A shard whose v file is too short for its size.
+  write_shard(folder_, 3, 0, 5, 300);
+  std::ofstream{folder_ / "0003-0000-v-5.pt", std::ios::trunc};
+  EXPECT_THROW(rb.set_window(1, 3), std::runtime_error);
+  EXPECT_EQ(rb.size(), 10);
+  EXPECT_EQ(rb.shard_count(), 2);
+
+  for (auto n = 0; n < 10; ++n) {
+    auto slot = rb.pop_batch();
+    while (!slot.has_value()) {
+      slot = rb.pop_batch();
+    }
+    for (auto b = 0; b < BATCH_SIZE; ++b) {
+      EXPECT_LT(canonical[b * 3], 10);
+      EXPECT_EQ(v[b * 2], canonical[b * 3]);
+    }
+    rb.release_batch(*slot);
+  }
+}
+
+// NOLINTNEXTLINE
+TEST_F(ReplayBufferTest, SamplesByWeight) {
+  constexpr const auto BATCH_SIZE = 64;
+  write_weights(folder_, 0, 0, {0, 1, 1, 1});
+  write_weights(folder_, 0, 1, {1, 1, 1, 1, 1, 7});
+  auto columns = COLUMNS;
+  columns.push_back({WEIGHT_COLUMN, 1});
+  auto rb = ReplayBuffer{folder_.string(), columns, BATCH_SIZE, 1, 1, 42};
+  auto canonical = std::vector<float>(BATCH_SIZE * 3);
+  auto v = std::vector<float>(BATCH_SIZE * 2);
+  auto w = std::vector<float>(BATCH_SIZE);
+  rb.set_buffers(0, {canonical.data(), v.data(), w.data()});
+  // Iteration 1 has no weights, so its samples weigh 1.
+  EXPECT_EQ(rb.set_window(0, 1), 20);
+
+  constexpr const auto BATCHES = 40;
+  auto counts = std::vector<int>(110, 0);
+  for (auto n = 0; n < BATCHES; ++n) {
+    auto slot = rb.pop_batch();
+    while (!slot.has_value()) {
+      slot = rb.pop_batch();
+    }
+    for (auto b = 0; b < BATCH_SIZE; ++b) {
+      const auto id = static_cast<int>(canonical[b * 3]);
+      ASSERT_TRUE(id < 10 || (id >= 100 && id < 110)) << id;
+      EXPECT_EQ(w[b], id == 9 ? 7 : 1);
+      ++counts[id];
+    }
+    rb.release_batch(*slot);
+  }
+  // The total weight is 25.
+  EXPECT_EQ(counts[0], 0);
+  EXPECT_NEAR(counts[9], BATCHES * BATCH_SIZE * 7 / 25, 120);
+  for (auto id = 1; id < 110; id = id == 8 ? 100 : id + 1) {
+    EXPECT_NEAR(counts[id], BATCHES * BATCH_SIZE / 25, 50) << id;
+  }
+}
+
+// NOLINTNEXTLINE
+TEST_F(ReplayBufferTest, ReleaseOnlyHandedOutSlots) {
+  constexpr const auto BATCH_SIZE = 4;
+  auto rb = ReplayBuffer{folder_.string(), COLUMNS, BATCH_SIZE, 1, 1, 42};
+  auto canonical = std::vector<float>(BATCH_SIZE * 3);
+  auto v = std::vector<float>(BATCH_SIZE * 2);
+  rb.set_buffers(0, {canonical.data(), v.data()});
+  EXPECT_THROW(rb.release_batch(1), std::runtime_error);
+  // The slot is still waiting to be filled.
+  EXPECT_THROW(rb.release_batch(0), std::runtime_error);
+
+  rb.set_window(0, 0);
+  auto slot = rb.pop_batch();
+  while (!slot.has_value()) {
+    slot = rb.pop_batch();
+  }
+  rb.release_batch(*slot);
+  // A second release would let two workers fill the slot at once.
+  EXPECT_THROW(rb.release_batch(*slot), std::runtime_error);
+}
+
+}  // namespace
+}  // namespace alphazero
@@ -0,0 +1,169 @@
+#include "resampler.h"
+
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "pcg/pcg_random.hpp"
+
+namespace alphazero {
+
+namespace {
+
+uint64_t resample_shard(const ShardInfo& in, uint32_t shard,
+                        const std::string& out_folder,
+                        const std::vector<ShardColumn>& columns,
+                        const double* losses, double loss_scale,
+                        uint32_t max_shard_size, pcg32& re) {
+  // A missing weight column is written as a weight of 1.
+  static constexpr const float ONE = 1;
+  const auto weight_column = find_weight_column(columns);
+  auto inputs = std::vector<std::optional<MappedFile>>{};
+  inputs.reserve(columns.size());
+  for (auto c = 0UL; c < columns.size(); ++c) {
+    const auto path = in.path(columns[c].name);
+    if (weight_column == c && !std::filesystem::exists(path)) {
+      inputs.emplace_back();
+      continue;
+    }
+    inputs.emplace_back(std::in_place, path, true);
+    if (inputs.back()->bytes() != sizeof(float) * columns[c].width * in.size) {
+      throw std::runtime_error{"Shard has the wrong size: " + path};
+    }
+  }
+
+  auto dist = std::uniform_real_distribution<double>{0.0, 1.0};
+  auto sample = std::vector<const float*>(columns.size());
+  auto writer = std::optional<ShardWriter>{};
+  auto part = 0U;
+  auto written = uint64_t{0};
+  for (auto i = 0U; i < in.size; ++i) {
+    const auto weight = 0.5 + losses[i] * loss_scale;
+    const auto whole = std::floor(weight);
+    // Always draw so each sample consumes the same amount of randomness.
+    const auto extra = dist(re) < weight - whole ? 1 : 0;
+    const auto copies = static_cast<uint64_t>(whole) + extra;
+    for (auto c = 0UL; c < columns.size(); ++c) {
+      sample[c] = inputs[c].has_value()
+                      ? inputs[c]->data() + i * columns[c].width
+                      : &ONE;
+    }
+    for (auto n = 0UL; n < copies; ++n) {
+      if (!writer.has_value()) {
+        char head[32];
+        std::snprintf(head, sizeof(head), "%04u-%04u-%04u", in.iteration,
+                      shard, part++);
+        writer.emplace(
+            (std::filesystem::path{out_folder} / head).string(), columns);
+      }
+      writer->append(sample);
+      if (writer->size() == max_shard_size) {
+        writer->finish();
+        writer.reset();
+      }
+    }
+    written += copies;
+  }
+  if (writer.has_value()) {
+    writer->finish();
+  }
+  return written;
+}
+
+}  // namespace
+
+uint64_t resample_by_surprise(const std::string& in_folder,
+                              const std::string& out_folder,
+                              uint32_t iteration,
+                              const std::vector<ShardColumn>& columns,
+                              const double* losses, size_t loss_count,
+                              uint32_t max_shard_size, uint32_t workers,
+                              std::optional<uint64_t> seed) {
+  if (max_shard_size == 0 || workers == 0) {
+    throw std::runtime_error{"Resampling needs a shard size and workers"};
+  }
+  const auto shards = find_shards(in_folder, iteration, iteration, columns);
+  auto starts = std::vector<size_t>{};
+  auto sample_count = size_t{0};
+  for (const auto& shard : shards) {
+    starts.push_back(sample_count);
+    sample_count += shard.size;
+  }
+  if (sample_count != loss_count) {
+    throw std::runtime_error{"There must be a loss for every sample"};
+  }
+  auto total_weight = static_cast<double>(sample_count);
+  auto total_loss = 0.0;
+  if (find_weight_column(columns).has_value()) {
+    // Merged samples stand for many plays, so their loss counts that often.
+    total_weight = 0.0;
+    for (auto s = 0UL; s < shards.size(); ++s) {
+      const auto path = shards[s].path(WEIGHT_COLUMN);
+      if (!std::filesystem::exists(path)) {
+        total_weight += shards[s].size;
+        for (auto i = 0U; i < shards[s].size; ++i) {
+          total_loss += losses[starts[s] + i];
+        }
+        continue;
+      }
+      const auto weights = MappedFile{path, true};
+      if (weights.bytes() != sizeof(float) * shards[s].size) {
+        throw std::runtime_error{"Shard has the wrong size: " + path};
+      }
+      for (auto i = 0U; i < shards[s].size; ++i) {
+        total_weight += weights.data()[i];
+        total_loss += weights.data()[i] * losses[starts[s] + i];
+      }
+    }
+  } else {
+    for (auto i = 0UL; i < loss_count; ++i) {
+      total_loss += losses[i];
+    }
+  }
+  const auto loss_scale =
+      total_loss > 0 ? 0.5 * total_weight / total_loss : 0.0;
+  const auto base_seed =
+      seed.has_value() ? *seed
+                       : (static_cast<uint64_t>(std::random_device{}()) << 32) |
+                             std::random_device{}();
+
+  std::filesystem::create_directories(out_folder);
+  auto next = std::atomic<size_t>{0};
+  auto written = std::atomic<uint64_t>{0};
+  auto error_mutex = std::mutex{};
+  auto error = std::exception_ptr{};
+  const auto work = [&] {
+    try {
+      for (auto s = next++; s < shards.size(); s = next++) {
+        auto re = pcg32{base_seed, s};
+        written += resample_shard(shards[s], s, out_folder, columns,
+                                  losses + starts[s], loss_scale,
+                                  max_shard_size, re);
+      }
+    } catch (...) {
+      std::unique_lock lock{error_mutex};
+      error = std::current_exception();
+      // Stop handing out shards.
+      next = shards.size();
+    }
+  };
+  auto threads = std::vector<std::thread>{};
+  for (auto i = 1U; i < std::min<size_t>(workers, shards.size()); ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto& t : threads) {
+    t.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return written;
+}
+
+}  // namespace alphazero
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "dll_export.h"
+#include "shard_io.h"
+
+namespace alphazero {
+
+// Resamples an iteration of history by how surprising each sample is.
+// Each sample is given 0.5 weight as a base.
+// The other half of the weight is distributed based on the sample loss.
+// The sample is then written floor(weight) times.
+// It is also written an extra time with the probability of
+// weight - floor(weight).
+//
+// If there is a weight column, a sample with weight w counts as w samples
+// when distributing the loss half of the weight, and w is kept on every copy
+// so the replay buffer draws it w times as often. A sample's expected share
+// of training is then w * (0.5 + its share of the loss). Shards without the
+// weight column count as weight 1 and are written with it.
+//
+// losses must be in the order of the shards from find_shards.
+// Shards are streamed one sample at a time, so memory does not depend on the
+// iteration size. Each input shard is handled by one worker and gets its own
+// random stream, so a seeded run is deterministic for any number of workers.
+// Output shards hold at most max_shard_size samples and are named
+// `{iteration:04d}-{input shard:04d}-{part:04d}`.
+// Returns the number of samples written.
+DLLEXPORT uint64_t resample_by_surprise(
+    const std::string& in_folder, const std::string& out_folder,
+    uint32_t iteration, const std::vector<ShardColumn>& columns,
+    const double* losses, size_t loss_count, uint32_t max_shard_size,
+    uint32_t workers, std::optional<uint64_t> seed = std::nullopt);
+
+}  // namespace alphazero
@@ -0,0 +1,164 @@
+#include "resampler.h"
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+#include "gtest/gtest.h"
+
+namespace alphazero {
+namespace {
+
+namespace fs = std::filesystem;
+
+const auto COLUMNS = std::vector<ShardColumn>{{"canonical", 3}, {"v", 2}};
+
+// Writes a shard where every float of a sample is its id.
+void write_shard(const fs::path& folder, uint32_t iteration, uint32_t batch,
+                 uint32_t size, float first_id) {
+  char head[16];
+  std::snprintf(head, sizeof(head), "%04u-%04u", iteration, batch);
+  auto writer = ShardWriter{(folder / head).string(), COLUMNS};
+  for (auto i = 0U; i < size; ++i) {
+    const auto c = std::vector<float>(3, first_id + i);
+    const auto v = std::vector<float>(2, first_id + i);
+    writer.append({c.data(), v.data()});
+  }
+  writer.finish();
+}
+
+// Returns how many times each id was written and checks column consistency.
+std::map<int, int> read_ids(const fs::path& folder, uint32_t iteration,
+                            uint32_t* max_size = nullptr) {
+  auto out = std::map<int, int>{};
+  for (const auto& shard :
+       find_shards(folder.string(), iteration, iteration, COLUMNS)) {
+    const auto c = MappedFile{shard.path("canonical")};
+    const auto v = MappedFile{shard.path("v")};
+    EXPECT_EQ(c.bytes(), shard.size * 3 * sizeof(float));
+    for (auto i = 0U; i < shard.size; ++i) {
+      EXPECT_EQ(c.data()[i * 3], v.data()[i * 2]);
+      ++out[static_cast<int>(c.data()[i * 3])];
+    }
+    if (max_size != nullptr) {
+      *max_size = std::max(*max_size, shard.size);
+    }
+  }
+  return out;
+}
+
+// Adds a weight column to a shard.
+void write_weights(const fs::path& folder, uint32_t iteration, uint32_t batch,
+                   const std::vector<float>& weights) {
+  char head[16];
+  std::snprintf(head, sizeof(head), "%04u-%04u", iteration, batch);
+  const auto info = ShardInfo{(folder / head).string(), iteration,
+                              static_cast<uint32_t>(weights.size())};
+  std::ofstream f{info.path(WEIGHT_COLUMN), std::ios::binary};
+  f.write(reinterpret_cast<const char*>(weights.data()),
+          weights.size() * sizeof(float));
+}
+
+class ResamplerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    folder_ = fs::temp_directory_path() /
+              ("resampler_test_" +
+               std::string{::testing::UnitTest::GetInstance()
+                               ->current_test_info()
+                               ->name()});
+    fs::remove_all(folder_);
+    fs::create_directories(folder_ / "in");
+    write_shard(folder_ / "in", 1, 0, 4, 0);
+    write_shard(folder_ / "in", 1, 1, 6, 4);
+    // A different iteration is ignored.
+    write_shard(folder_ / "in", 2, 0, 4, 100);
+  }
+
+  void TearDown() override { fs::remove_all(folder_); }
+
+  fs::path folder_;
+};
+
+// NOLINTNEXTLINE
+TEST_F(ResamplerTest, EqualLossKeepsEverySample) {
+  const auto losses = std::vector<double>(10, 3.0);
+  EXPECT_EQ(resample_by_surprise((folder_ / "in").string(),
+                                 (folder_ / "out").string(), 1, COLUMNS,
+                                 losses.data(), losses.size(), 3, 2),
+            10);
+  auto max_size = 0U;
+  const auto ids = read_ids(folder_ / "out", 1, &max_size);
+  EXPECT_EQ(max_size, 3);
+  ASSERT_EQ(ids.size(), 10);
+  for (const auto& [id, count] : ids) {
+    EXPECT_LT(id, 10);
+    EXPECT_EQ(count, 1);
+  }
+
+  EXPECT_THROW(resample_by_surprise((folder_ / "in").string(),
+                                    (folder_ / "out").string(), 1, COLUMNS,
+                                    losses.data(), 9, 3, 2),
+               std::runtime_error);
+}
+
+// NOLINTNEXTLINE
+TEST_F(ResamplerTest, SurprisingSamplesAreRepeated) {
+  auto losses = std::vector<double>(10, 0.0);
+  losses[5] = 1.0;
+  resample_by_surprise((folder_ / "in").string(), (folder_ / "out").string(),
+                       1, COLUMNS, losses.data(), losses.size(), 4, 1, 7);
+  const auto ids = read_ids(folder_ / "out", 1);
+  // 0.5 + 0.5 * 10 = 5.5 copies.
+  ASSERT_TRUE(ids.count(5));
+  EXPECT_GE(ids.at(5), 5);
+  EXPECT_LE(ids.at(5), 6);
+  for (const auto& [id, count] : ids) {
+    if (id != 5) {
+      EXPECT_EQ(count, 1);
+    }
+  }
+}
+
+// NOLINTNEXTLINE
+TEST_F(ResamplerTest, WeightsCountTowardsLoss) {
+  // The second shard has no weights, so its samples weigh 1.
+  write_weights(folder_ / "in", 1, 0, {9, 1, 1, 1});
+  auto columns = COLUMNS;
+  columns.push_back({WEIGHT_COLUMN, 1});
+  auto losses = std::vector<double>(10, 0.0);
+  losses[0] = 1.0;
+  resample_by_surprise((folder_ / "in").string(), (folder_ / "out").string(),
+                       1, columns, losses.data(), losses.size(), 4, 1, 7);
+  // The weight is 18, so 0.5 + 0.5 * 18 / 9 = 1.5 copies instead of the 5.5
+  // an unweighted sample would get. The replay buffer applies the rest.
+  auto copies = 0;
+  for (const auto& shard : find_shards((folder_ / "out").string(), 1, 1,
+                                       columns)) {
+    const auto c = MappedFile{shard.path("canonical")};
+    const auto w = MappedFile{shard.path(WEIGHT_COLUMN)};
+    for (auto i = 0U; i < shard.size; ++i) {
+      const auto id = static_cast<int>(c.data()[i * 3]);
+      EXPECT_EQ(w.data()[i], id == 0 ? 9 : 1);
+      copies += id == 0 ? 1 : 0;
+    }
+  }
+  EXPECT_GE(copies, 1);
+  EXPECT_LE(copies, 2);
+}
+
+// NOLINTNEXTLINE
+TEST_F(ResamplerTest, SeedIsDeterministicAcrossWorkers) {
+  auto losses = std::vector<double>{};
+  for (auto i = 0; i < 10; ++i) {
+    losses.push_back(0.1 * i);
+  }
+  resample_by_surprise((folder_ / "in").string(), (folder_ / "a").string(), 1,
+                       COLUMNS, losses.data(), losses.size(), 5, 1, 1234);
+  resample_by_surprise((folder_ / "in").string(), (folder_ / "b").string(), 1,
+                       COLUMNS, losses.data(), losses.size(), 5, 4, 1234);
+  EXPECT_EQ(read_ids(folder_ / "a", 1), read_ids(folder_ / "b", 1));
+}
+
+}  // namespace
+}  // namespace alphazero
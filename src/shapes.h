@@ -29,4 +29,11 @@ using Tensor = Eigen::Tensor<T, DIMS, Eigen::RowMajor>;
 template <typename T, typename DIMS>
 using SizedTensor = Eigen::TensorFixedSize<T, DIMS, Eigen::RowMajor>;
 
+// Views data as a SizedTensor, for filling caller owned buffers.
+template <typename T>
+[[nodiscard]] Eigen::TensorMap<T> sized_tensor_map(
+    typename T::Scalar* data) noexcept {
+  return Eigen::TensorMap<T>{data, typename T::Dimensions{}};
+}
+
 }  // namespace alphazero
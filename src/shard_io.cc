@@ -0,0 +1,283 @@
+#include "shard_io.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <stdexcept>
+
+#if defined _WIN32 || defined __CYGWIN__
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace alphazero {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+bool all_digits(const std::string& s) noexcept {
+  return !s.empty() && std::all_of(s.begin(), s.end(), [](unsigned char c) {
+    return std::isdigit(c);
+  });
+}
+
+}  // namespace
+
+std::optional<size_t> find_weight_column(
+    const std::vector<ShardColumn>& columns) {
+  for (auto c = 0UL; c < columns.size(); ++c) {
+    if (columns[c].name == WEIGHT_COLUMN) {
+      if (columns[c].width != 1) {
+        throw std::runtime_error{"The weight column must have a width of 1"};
+      }
+      return c;
+    }
+  }
+  return std::nullopt;
+}
+
+std::vector<ShardInfo> find_shards(const std::string& folder,
+                                   uint32_t first_iteration,
+                                   uint32_t last_iteration,
+                                   const std::vector<ShardColumn>& columns) {
+  if (columns.empty()) {
+    throw std::runtime_error{"Shards need at least one column"};
+  }
+  auto out = std::vector<ShardInfo>{};
+  if (!fs::is_directory(folder)) {
+    return out;
+  }
+  const auto marker = "-" + columns[0].name;
+  for (const auto& entry : fs::directory_iterator(folder)) {
+    if (!entry.is_regular_file() || entry.path().extension() != ".pt") {
+      continue;
+    }
+    const auto stem = entry.path().stem().string();
+    const auto dash = stem.rfind('-');
+    if (dash == std::string::npos || !all_digits(stem.substr(dash + 1))) {
+      continue;
+    }
+    const auto rest = stem.substr(0, dash);
+    if (rest.size() <= marker.size() ||
+        rest.compare(rest.size() - marker.size(), marker.size(), marker) !=
+            0) {
+      continue;
+    }
+    const auto head = rest.substr(0, rest.size() - marker.size());
+    if (head.size() < 5 || !all_digits(head.substr(0, 4)) || head[4] != '-') {
+      continue;
+    }
+
+    auto info = ShardInfo{};
+    info.prefix = (fs::path{folder} / head).string();
+    info.iteration = std::stoul(head.substr(0, 4));
+    info.size = std::stoul(stem.substr(dash + 1));
+    if (info.iteration < first_iteration || info.iteration > last_iteration ||
+        info.size == 0) {
+      continue;
+    }
+    const auto complete = std::all_of(
+        columns.begin() + 1, columns.end(),
+        [&](const auto& col) {
+          return col.name == WEIGHT_COLUMN || fs::exists(info.path(col.name));
+        });
+    if (complete) {
+      out.push_back(std::move(info));
+    }
+  }
+  std::sort(out.begin(), out.end(), [](const auto& a, const auto& b) {
+    return a.prefix < b.prefix;
+  });
+  return out;
+}
+
+#if defined _WIN32 || defined __CYGWIN__
+
+MappedFile::MappedFile(const std::string& path, bool sequential) {
+  file_ = CreateFileA(
+      path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+      sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS,
+      nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    file_ = nullptr;
+    throw std::runtime_error{"Failed to open " + path};
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+    unmap();
+    throw std::runtime_error{"Failed to get a size for " + path};
+  }
+  bytes_ = static_cast<size_t>(size.QuadPart);
+  mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_ == nullptr) {
+    unmap();
+    throw std::runtime_error{"Failed to map " + path};
+  }
+  data_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+  if (data_ == nullptr) {
+    unmap();
+    throw std::runtime_error{"Failed to map " + path};
+  }
+}
+
+void MappedFile::unmap() noexcept {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_ != nullptr) {
+    CloseHandle(mapping_);
+  }
+  if (file_ != nullptr) {
+    CloseHandle(file_);
+  }
+  data_ = nullptr;
+  mapping_ = nullptr;
+  file_ = nullptr;
+  bytes_ = 0;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(other.data_),
+      bytes_(other.bytes_),
+      file_(other.file_),
+      mapping_(other.mapping_) {
+  other.data_ = nullptr;
+  other.bytes_ = 0;
+  other.file_ = nullptr;
+  other.mapping_ = nullptr;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    unmap();
+    std::swap(data_, other.data_);
+    std::swap(bytes_, other.bytes_);
+    std::swap(file_, other.file_);
+    std::swap(mapping_, other.mapping_);
+  }
+  return *this;
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path, bool sequential) {
+  const auto fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error{"Failed to open " + path};
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    throw std::runtime_error{"Failed to get a size for " + path};
+  }
+  bytes_ = static_cast<size_t>(st.st_size);
+  data_ = mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping keeps its own reference to the file.
+  close(fd);
+  if (data_ == MAP_FAILED) {
+    data_ = nullptr;
+    bytes_ = 0;
+    throw std::runtime_error{"Failed to map " + path};
+  }
+  madvise(data_, bytes_, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+}
+
+void MappedFile::unmap() noexcept {
+  if (data_ != nullptr) {
+    munmap(data_, bytes_);
+  }
+  data_ = nullptr;
+  bytes_ = 0;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(other.data_), bytes_(other.bytes_) {
+  other.data_ = nullptr;
+  other.bytes_ = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    unmap();
+    std::swap(data_, other.data_);
+    std::swap(bytes_, other.bytes_);
+  }
+  return *this;
+}
+
+#endif
+
+MappedFile::~MappedFile() { unmap(); }
+
+// Large buffers keep writes sequential without holding a whole shard.
+constexpr const size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+ShardWriter::ShardWriter(std::string head, std::vector<ShardColumn> columns)
+    : head_(std::move(head)), columns_(std::move(columns)) {
+  files_.reserve(columns_.size());
+  for (const auto& col : columns_) {
+    auto* f = std::fopen(tmp_path(col.name).c_str(), "wb");
+    if (f == nullptr) {
+      close_files();
+      throw std::runtime_error{"Failed to create " + tmp_path(col.name)};
+    }
+    std::setvbuf(f, nullptr, _IOFBF, WRITE_BUFFER_SIZE);
+    files_.push_back(f);
+  }
+}
+
+ShardWriter::~ShardWriter() {
+  close_files();
+  if (!finished_) {
+    for (const auto& col : columns_) {
+      std::remove(tmp_path(col.name).c_str());
+    }
+  }
+}
+
+void ShardWriter::append(const std::vector<const float*>& sample) {
+  if (sample.size() != columns_.size()) {
+    throw std::runtime_error{"A sample needs data for every column"};
+  }
+  for (auto c = 0UL; c < columns_.size(); ++c) {
+    if (std::fwrite(sample[c], sizeof(float), columns_[c].width, files_[c]) !=
+        columns_[c].width) {
+      throw std::runtime_error{"Failed to write " +
+                               tmp_path(columns_[c].name)};
+    }
+  }
+  ++size_;
+}
+
+ShardInfo ShardWriter::finish() {
+  auto ok = true;
+  for (auto* f : files_) {
+    ok = std::fclose(f) == 0 && ok;
+  }
+  files_.clear();
+  if (!ok) {
+    throw std::runtime_error{"Failed to write shard " + head_};
+  }
+  const auto iteration = fs::path{head_}.filename().string().substr(0, 4);
+  auto info = ShardInfo{head_, static_cast<uint32_t>(std::stoul(iteration)),
+                        size_};
+  for (const auto& col : columns_) {
+    fs::rename(tmp_path(col.name), info.path(col.name));
+  }
+  finished_ = true;
+  return info;
+}
+
+void ShardWriter::close_files() noexcept {
+  for (auto* f : files_) {
+    std::fclose(f);
+  }
+  files_.clear();
+}
+
+}  // namespace alphazero
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "dll_export.h"
+
+namespace alphazero {
+
+// History is saved as shards of raw float32 files.
+// Each shard has one file per column named:
+// `{iteration:04d}-{batch:04d}{name}-{column}-{size}.pt`
+// Where size is the number of samples in the shard.
+
+struct ShardColumn {
+  std::string name;
+  // Number of floats per sample.
+  size_t width;
+};
+
+// Samples may carry a weight column with the number of samples they stand
+// for, such as positions merged by HistoryDedup. Samplers draw weighted
+// samples that much more often. Shards saved without it weigh 1 per sample.
+constexpr const char* WEIGHT_COLUMN = "w";
+
+// Returns the index of the weight column, if there is one.
+DLLEXPORT std::optional<size_t> find_weight_column(
+    const std::vector<ShardColumn>& columns);
+
+struct ShardInfo {
+  // Path of the shard up to but not including the column name.
+  std::string prefix;
+  uint32_t iteration;
+  uint32_t size;
+
+  [[nodiscard]] std::string path(const std::string& column) const {
+    return prefix + "-" + column + "-" + std::to_string(size) + ".pt";
+  }
+};
+
+// Finds all shards in folder with iterations in [first, last].
+// Only shards that have a file for every column but the weight column are
+// returned.
+// The result is sorted by prefix.
+DLLEXPORT std::vector<ShardInfo> find_shards(
+    const std::string& folder, uint32_t first_iteration,
+    uint32_t last_iteration, const std::vector<ShardColumn>& columns);
+
+// A read only memory mapping of an entire file.
+// Sequential mappings hint the os to read ahead instead of reading randomly.
+class DLLEXPORT MappedFile {
+ public:
+  explicit MappedFile(const std::string& path, bool sequential = false);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+
+  [[nodiscard]] const float* data() const noexcept {
+    return static_cast<const float*>(data_);
+  }
+  [[nodiscard]] size_t bytes() const noexcept { return bytes_; }
+
+ private:
+  void unmap() noexcept;
+
+  void* data_ = nullptr;
+  size_t bytes_ = 0;
+#if defined _WIN32 || defined __CYGWIN__
+  void* file_ = nullptr;
+  void* mapping_ = nullptr;
+#endif
+};
+
+// Streams samples into a new shard.
+// Columns are written to temporary files that are only renamed to their
+// final shard names by finish, once the size is known.
+// An unfinished shard is removed on destruction.
+class DLLEXPORT ShardWriter {
+ public:
+  // head is the shard path without the column name. For example:
+  // `data/history/0003-0012`
+  ShardWriter(std::string head, std::vector<ShardColumn> columns);
+  ~ShardWriter();
+  ShardWriter(const ShardWriter&) = delete;
+  ShardWriter& operator=(const ShardWriter&) = delete;
+
+  // Appends one sample. There must be a pointer for every column.
+  void append(const std::vector<const float*>& sample);
+
+  // Closes and renames the files. Returns the finished shard.
+  ShardInfo finish();
+
+  [[nodiscard]] uint32_t size() const noexcept { return size_; }
+
+ private:
+  [[nodiscard]] std::string tmp_path(const std::string& column) const {
+    return head_ + "-" + column + ".tmp";
+  }
+  void close_files() noexcept;
+
+  const std::string head_;
+  const std::vector<ShardColumn> columns_;
+  std::vector<std::FILE*> files_;
+  uint32_t size_ = 0;
+  bool finished_ = false;
+};
+
+}  // namespace alphazero
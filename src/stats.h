@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+
+namespace alphazero {
+
+// Latency histograms with HDR style log linear buckets.
+// Every power of two range of nanoseconds is split into 2^HIST_SUB_BITS
+// buckets, so a value is recorded with at most 1/2^HIST_SUB_BITS relative
+// error. Values past 2^HIST_MAX_BITS ns (a few days) go in the last bucket.
+constexpr const int HIST_SUB_BITS = 4;
+constexpr const int HIST_MAX_BITS = 48;
+constexpr const size_t HIST_BUCKETS = (HIST_MAX_BITS - HIST_SUB_BITS + 1)
+                                      << HIST_SUB_BITS;
+
+[[nodiscard]] inline size_t hist_bucket(uint64_t ns) noexcept {
+  constexpr uint64_t sub_count = 1UL << HIST_SUB_BITS;
+  if (ns < sub_count) {
+    return ns;
+  }
+#if defined _MSC_VER
+  auto msb = 0;
+  while ((ns >> msb) > 1) {
+    ++msb;
+  }
+#else
+  auto msb = 63 - __builtin_clzll(ns);
+#endif
+  if (msb >= HIST_MAX_BITS) {
+    return HIST_BUCKETS - 1;
+  }
+  const auto shift = msb - HIST_SUB_BITS;
+  return ((shift + 1) << HIST_SUB_BITS) + ((ns >> shift) - sub_count);
+}
+
+// Returns the middle of the range of values in a bucket.
+[[nodiscard]] inline double hist_bucket_value(size_t bucket) noexcept {
+  constexpr uint64_t sub_count = 1UL << HIST_SUB_BITS;
+  const auto range = bucket >> HIST_SUB_BITS;
+  const auto sub = bucket & (sub_count - 1);
+  if (range == 0) {
+    return sub;
+  }
+  const auto low = (sub_count + sub) << (range - 1);
+  const auto width = 1UL << (range - 1);
+  return low + width / 2.0;
+}
+
+// Latencies are reported in microseconds.
+struct LatencySummary {
+  uint64_t count = 0;
+  double mean = 0;
+  double p50 = 0;
+  double p90 = 0;
+  double p99 = 0;
+  double max = 0;
+};
+
+// A plain histogram used to merge and summarize recorded latencies.
+class Histogram {
+ public:
+  Histogram() : buckets_(HIST_BUCKETS, 0) {}
+
+  void record(uint64_t ns) noexcept {
+    ++buckets_[hist_bucket(ns)];
+    ++count_;
+    sum_ += ns;
+    max_ = std::max(max_, ns);
+  }
+
+  void add(size_t bucket, uint64_t n) noexcept {
+    buckets_[bucket] += n;
+    count_ += n;
+  }
+  void add_totals(uint64_t sum, uint64_t max) noexcept {
+    sum_ += sum;
+    max_ = std::max(max_, max);
+  }
+
+  [[nodiscard]] uint64_t count() const noexcept { return count_; }
+
+  // Returns the value in ns that q of the recorded values are at or below.
+  [[nodiscard]] double percentile(double q) const noexcept {
+    if (count_ == 0) {
+      return 0;
+    }
+    const auto target = static_cast<uint64_t>(q * (count_ - 1)) + 1;
+    auto seen = 0UL;
+    for (auto i = 0UL; i < HIST_BUCKETS; ++i) {
+      seen += buckets_[i];
+      if (seen >= target) {
+        return std::min(hist_bucket_value(i), static_cast<double>(max_));
+      }
+    }
+    return max_;
+  }
+
+  [[nodiscard]] LatencySummary summary() const noexcept {
+    constexpr double us = 1000.0;
+    auto out = LatencySummary{};
+    out.count = count_;
+    if (count_ == 0) {
+      return out;
+    }
+    out.mean = static_cast<double>(sum_) / count_ / us;
+    out.p50 = percentile(0.5) / us;
+    out.p90 = percentile(0.9) / us;
+    out.p99 = percentile(0.99) / us;
+    out.max = max_ / us;
+    return out;
+  }
+
+ private:
+  std::vector<uint64_t> buckets_;
+  uint64_t count_ = 0;
+  uint64_t sum_ = 0;
+  uint64_t max_ = 0;
+};
+
+// A histogram with a single writing thread that can be read from any thread.
+// The writer avoids atomic read-modify-writes, so recording stays about as
+// cheap as a plain increment.
+class ThreadHistogram {
+ public:
+  void record(uint64_t ns) noexcept {
+    bump(buckets_[hist_bucket(ns)], 1);
+    bump(sum_, ns);
+    if (ns > max_.load(std::memory_order_relaxed)) {
+      max_.store(ns, std::memory_order_relaxed);
+    }
+  }
+
+  void merge_into(Histogram& out) const noexcept {
+    for (auto i = 0UL; i < HIST_BUCKETS; ++i) {
+      const auto n = buckets_[i].load(std::memory_order_relaxed);
+      if (n != 0) {
+        out.add(i, n);
+      }
+    }
+    out.add_totals(sum_.load(std::memory_order_relaxed),
+                   max_.load(std::memory_order_relaxed));
+  }
+
+ private:
+  static void bump(std::atomic<uint64_t>& a, uint64_t n) noexcept {
+    a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<uint64_t>, HIST_BUCKETS> buckets_{};
+  std::atomic<uint64_t> sum_ = 0;
+  std::atomic<uint64_t> max_ = 0;
+};
+
+// The timed stages of playing games.
+enum PlayStage : uint8_t {
+  // Selecting a leaf in MCTS.
+  FIND_LEAF,
+  // Backing up an inference result in MCTS.
+  PROCESS_RESULT,
+  // MCTS threads waiting for a game to search. Waits that time out without a
+  // game are not recorded.
+  MCTS_QUEUE_WAIT,
+  // Inference threads waiting for games to batch. Waits that time out without
+  // a game are not recorded.
+  INFERENCE_QUEUE_WAIT,
+  // From a leaf entering the inference queue to its result being returned.
+  INFERENCE_LATENCY,
+  // From starting to search a position to playing a move from it.
+  MOVE_DECISION,
+  // Solving a leaf exactly instead of sending it to inference.
+  SOLVE,
+  PLAY_STAGE_COUNT,
+};
+
+constexpr const std::array<const char*, PLAY_STAGE_COUNT> PLAY_STAGE_NAMES{
+    "find_leaf",            "process_result",    "mcts_queue_wait",
+    "inference_queue_wait", "inference_latency", "move_decision",
+    "solve",
+};
+
+struct ThreadStats {
+  std::array<ThreadHistogram, PLAY_STAGE_COUNT> stages;
+
+  void record(PlayStage stage,
+              std::chrono::steady_clock::time_point start) noexcept {
+    stages[stage].record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count());
+  }
+};
+
+struct PlayStatsSnapshot {
+  double elapsed_seconds = 0;
+  std::array<LatencySummary, PLAY_STAGE_COUNT> stages;
+
+  [[nodiscard]] double per_second(PlayStage stage) const noexcept {
+    if (elapsed_seconds <= 0) {
+      return 0;
+    }
+    return stages[stage].count / elapsed_seconds;
+  }
+};
+
+// Timing stats kept per thread so that recording never contends.
+// They are only merged when read.
+class PlayStats {
+ public:
+  PlayStats() : start_(std::chrono::steady_clock::now()) {}
+
+  // Returns the stats of the calling thread, registering them on first use.
+  // Each thread caches its last lookup, so calls from a thread that records
+  // into a single PlayStats skip the lock.
+  [[nodiscard]] ThreadStats& local() {
+    // Keyed by id instead of address, since a new PlayStats can reuse the
+    // address of a destroyed one.
+    thread_local auto cached = std::pair<uint64_t, ThreadStats*>{0, nullptr};
+    if (cached.first == id_) {
+      return *cached.second;
+    }
+    std::unique_lock l{m_};
+    auto& ts = threads_[std::this_thread::get_id()];
+    if (ts == nullptr) {
+      ts = std::make_unique<ThreadStats>();
+    }
+    cached = {id_, ts.get()};
+    return *ts;
+  }
+
+  [[nodiscard]] PlayStatsSnapshot snapshot() const {
+    auto merged = std::array<Histogram, PLAY_STAGE_COUNT>{};
+    {
+      std::unique_lock l{m_};
+      for (const auto& [_, ts] : threads_) {
+        for (auto s = 0; s < PLAY_STAGE_COUNT; ++s) {
+          ts->stages[s].merge_into(merged[s]);
+        }
+      }
+    }
+    auto out = PlayStatsSnapshot{};
+    out.elapsed_seconds = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start_)
+                              .count();
+    for (auto s = 0; s < PLAY_STAGE_COUNT; ++s) {
+      out.stages[s] = merged[s].summary();
+    }
+    return out;
+  }
+
+ private:
+  [[nodiscard]] static uint64_t next_id() noexcept {
+    static auto next = std::atomic<uint64_t>{1};
+    return next++;
+  }
+
+  const uint64_t id_ = next_id();
+  const std::chrono::steady_clock::time_point start_;
+  mutable std::mutex m_;
+  absl::flat_hash_map<std::thread::id, std::unique_ptr<ThreadStats>> threads_;
+};
+
+}  // namespace alphazero
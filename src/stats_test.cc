@@ -0,0 +1,88 @@
+#include "stats.h"
+
+#include <memory>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace alphazero {
+namespace {
+
+// NOLINTNEXTLINE
+TEST(Stats, BucketsKeepRelativeError) {
+  auto last = 0UL;
+  for (auto ns = 0UL; ns < (1UL << 20); ns += 7) {
+    const auto bucket = hist_bucket(ns);
+    EXPECT_GE(bucket, last);
+    EXPECT_LT(bucket, HIST_BUCKETS);
+    last = bucket;
+    const auto value = hist_bucket_value(bucket);
+    EXPECT_NEAR(value, ns, 0.5 + ns / 16.0);
+  }
+  EXPECT_EQ(hist_bucket(~0UL), HIST_BUCKETS - 1);
+}
+
+// NOLINTNEXTLINE
+TEST(Stats, Percentiles) {
+  auto h = Histogram{};
+  EXPECT_EQ(h.summary().count, 0);
+  for (auto us = 1UL; us <= 1000; ++us) {
+    h.record(us * 1000);
+  }
+  const auto s = h.summary();
+  EXPECT_EQ(s.count, 1000);
+  EXPECT_NEAR(s.mean, 500.5, 0.01);
+  EXPECT_NEAR(s.p50, 500, 500 / 16.0);
+  EXPECT_NEAR(s.p90, 900, 900 / 16.0);
+  EXPECT_NEAR(s.p99, 990, 990 / 16.0);
+  EXPECT_DOUBLE_EQ(s.max, 1000);
+}
+
+// NOLINTNEXTLINE
+TEST(Stats, MergesThreads) {
+  auto stats = PlayStats{};
+  auto threads = std::vector<std::thread>{};
+  for (auto t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      auto& local = stats.local();
+      for (auto i = 0; i < 100; ++i) {
+        local.stages[FIND_LEAF].record(1000);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  stats.local().stages[MOVE_DECISION].record(2000);
+
+  const auto snap = stats.snapshot();
+  EXPECT_EQ(snap.stages[FIND_LEAF].count, 400);
+  EXPECT_DOUBLE_EQ(snap.stages[FIND_LEAF].max, 1);
+  EXPECT_EQ(snap.stages[MOVE_DECISION].count, 1);
+  EXPECT_EQ(snap.stages[PROCESS_RESULT].count, 0);
+  EXPECT_GT(snap.per_second(FIND_LEAF), 0);
+}
+
+// NOLINTNEXTLINE
+TEST(Stats, LocalIsPerInstance) {
+  auto a = std::make_unique<PlayStats>();
+  auto b = PlayStats{};
+  auto* a_local = &a->local();
+  EXPECT_NE(a_local, &b.local());
+  EXPECT_EQ(a_local, &a->local());
+  a->local().stages[FIND_LEAF].record(1000);
+  EXPECT_EQ(a->snapshot().stages[FIND_LEAF].count, 1);
+  EXPECT_EQ(b.snapshot().stages[FIND_LEAF].count, 0);
+
+  // A new instance never sees the cached stats of a destroyed one, even at
+  // the same address.
+  a.reset();
+  a = std::make_unique<PlayStats>();
+  a->local().stages[MOVE_DECISION].record(1000);
+  const auto snap = a->snapshot();
+  EXPECT_EQ(snap.stages[FIND_LEAF].count, 0);
+  EXPECT_EQ(snap.stages[MOVE_DECISION].count, 1);
+}
+
+}  // namespace
+}  // namespace alphazero
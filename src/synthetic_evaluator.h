@@ -0,0 +1,134 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "concurrent_queue.h"
+#include "play_manager.h"
+
+namespace alphazero {
+
+struct SyntheticEvaluatorParams {
+  // Time for the device to run any batch.
+  std::chrono::nanoseconds batch_latency{0};
+  // Extra time for the device per sample in a batch.
+  std::chrono::nanoseconds sample_latency{0};
+  uint32_t max_batch_size = 1;
+  // Batches that can be in flight per player. Each has its own builder
+  // thread, like the batch workers of GameRunner.
+  uint32_t concurrent_batches = 1;
+  // Run every batch on one shared device thread, like a single GPU.
+  // Otherwise each builder waits on its own batch, like unlimited devices.
+  bool device_thread = true;
+};
+
+// Stands in for GPU inference so self-play can be benchmarked end to end on
+// CPU only machines. Batches are built from the inference queues of a play
+// manager, evaluated with dumb_eval, and returned through update_inferences
+// after waiting out a modeled device latency.
+//
+// A batch is sent once it is full, or when the inference queue runs dry.
+class SyntheticEvaluator {
+ public:
+  SyntheticEvaluator(PlayManager& pm, SyntheticEvaluatorParams params)
+      : pm_(pm), params_(params) {}
+
+  // Evaluates until all games are complete.
+  void run() {
+    auto threads = std::vector<std::thread>{};
+    const auto players = pm_.game_data(0).gs->num_players();
+    for (auto p = 0; p < players; ++p) {
+      for (auto b = 0U; b < params_.concurrent_batches; ++b) {
+        threads.emplace_back([this, p] { build_loop(p); });
+      }
+    }
+    if (params_.device_thread) {
+      threads.emplace_back([this] { device_loop(); });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+
+ private:
+  struct Batch {
+    uint8_t player;
+    std::vector<uint32_t> indices;
+    Matrix<float> v;
+    Matrix<float> pi;
+    std::promise<void> done;
+  };
+
+  void build_loop(uint8_t player) {
+    while (pm_.remaining_games() > 0) {
+      auto batch = std::make_shared<Batch>();
+      batch->player = player;
+      while (batch->indices.size() < params_.max_batch_size &&
+             pm_.remaining_games() > 0) {
+        const auto popped = pm_.pop_games_upto(
+            player, params_.max_batch_size - batch->indices.size());
+        if (popped.empty()) {
+          if (batch->indices.empty()) {
+            continue;
+          }
+          break;
+        }
+        batch->indices.insert(batch->indices.end(), popped.begin(),
+                              popped.end());
+      }
+      if (batch->indices.empty()) {
+        continue;
+      }
+      evaluate(*batch);
+      if (params_.device_thread) {
+        auto done = batch->done.get_future();
+        device_queue_.push(batch);
+        // The device stops once all games are complete.
+        while (done.wait_for(MAX_WAIT) != std::future_status::ready &&
+               pm_.remaining_games() > 0) {
+        }
+      } else {
+        run_on_device(*batch);
+      }
+    }
+  }
+
+  void device_loop() {
+    while (pm_.remaining_games() > 0) {
+      auto batch = device_queue_.pop(MAX_WAIT);
+      if (!batch.has_value()) {
+        continue;
+      }
+      run_on_device(*batch.value());
+      batch.value()->done.set_value();
+    }
+  }
+
+  void evaluate(Batch& batch) {
+    const auto& gs = *pm_.game_data(batch.indices[0]).gs;
+    batch.v = Matrix<float>{batch.indices.size(), gs.num_players() + 1};
+    batch.pi = Matrix<float>{batch.indices.size(), gs.num_moves()};
+    for (auto i = 0UL; i < batch.indices.size(); ++i) {
+      const auto [v, pi] = dumb_eval(*pm_.game_data(batch.indices[i]).gs);
+      batch.v.row(i) = v;
+      batch.pi.row(i) = pi;
+    }
+  }
+
+  void run_on_device(const Batch& batch) {
+    const auto latency = params_.batch_latency +
+                         params_.sample_latency * batch.indices.size();
+    std::this_thread::sleep_for(latency);
+    pm_.update_inferences(batch.player, batch.indices, batch.v, batch.pi);
+  }
+
+  PlayManager& pm_;
+  const SyntheticEvaluatorParams params_;
+  ConcurrentQueue<std::shared_ptr<Batch>> device_queue_;
+};
+
+}  // namespace alphazero
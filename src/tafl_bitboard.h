@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "bitboard.h"
+#include "zobrist.h"
+
+// Piece masks shared by the tafl games.
+
+namespace alphazero::tafl_bitboard {
+
+// Player 0 is the first player (the attackers).
+// Player 1 is the second player (the king side defenders).
+constexpr const int ATK_PLAYER = 0;
+constexpr const int DEF_PLAYER = 1;
+
+// Zobrist keys for the king, defender, and attacker layers on each square,
+// then one for the defenders to move.
+constexpr const int MAX_SQUARES = 128;
+constexpr const auto ZOBRIST_KEYS =
+    zobrist::make_keys<3 * MAX_SQUARES + 1>(0x7af1);
+constexpr const auto DEF_TO_MOVE_KEY = ZOBRIST_KEYS[3 * MAX_SQUARES];
+
+template <typename Mask>
+[[nodiscard]] uint64_t squares_key(int layer, Mask squares) noexcept {
+  auto key = uint64_t{0};
+  while (squares != 0) {
+    key ^= ZOBRIST_KEYS[layer * MAX_SQUARES + bitboard::pop_lsb(squares)];
+  }
+  return key;
+}
+
+template <typename Mask>
+struct Pieces {
+  Mask king = 0;
+  Mask def = 0;
+  Mask atk = 0;
+
+  [[nodiscard]] Mask occupied() const noexcept { return king | def | atk; }
+  // All pieces of player p. The king belongs to the defenders.
+  [[nodiscard]] Mask player(uint8_t p) const noexcept {
+    return p == DEF_PLAYER ? king | def : atk;
+  }
+  [[nodiscard]] Mask opponent(uint8_t p) const noexcept {
+    return p == DEF_PLAYER ? atk : king | def;
+  }
+  // Moves whatever piece is on from to to.
+  void move(Mask from, Mask to) noexcept {
+    for (auto* layer : {&king, &def, &atk}) {
+      if ((*layer & from) != 0) {
+        *layer = (*layer & ~from) | to;
+      }
+    }
+  }
+  // The Zobrist key of the pieces on squares.
+  [[nodiscard]] uint64_t key(Mask squares) const noexcept {
+    return squares_key(0, king & squares) ^ squares_key(1, def & squares) ^
+           squares_key(2, atk & squares);
+  }
+  void remove(Mask squares) noexcept {
+    king &= ~squares;
+    def &= ~squares;
+    atk &= ~squares;
+  }
+
+  friend bool operator==(const Pieces& lhs, const Pieces& rhs) noexcept {
+    return lhs.king == rhs.king && lhs.def == rhs.def && lhs.atk == rhs.atk;
+  }
+};
+
+// The Zobrist key of a position with player p to move.
+template <typename Mask>
+[[nodiscard]] uint64_t position_key(const Pieces<Mask>& b, uint8_t p) noexcept {
+  return b.key(b.occupied()) ^ (p == DEF_PLAYER ? DEF_TO_MOVE_KEY : 0);
+}
+
+// Positions are kept as Zobrist keys from the last capture on, since no
+// earlier position can come back once pieces are gone. Returns how many times
+// the latest position has been seen. Only positions with the same player to
+// move can match, so every other entry is skipped.
+[[nodiscard]] inline uint8_t repetition_count(
+    const std::vector<uint64_t>& history) noexcept {
+  auto count = uint8_t{0};
+  for (auto i = static_cast<int>(history.size()) - 1; i >= 0; i -= 2) {
+    if (history[i] == history.back()) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+// The policy index of moving the piece on square to target.
+// Moves are grouped by piece square, then by the column or row moved to.
+template <int WIDTH, int HEIGHT>
+[[nodiscard]] constexpr int move_index(int square, int target) noexcept {
+  const auto base = square * (WIDTH + HEIGHT);
+  if (square % WIDTH == target % WIDTH) {
+    return base + WIDTH + target / WIDTH;
+  }
+  return base + target % WIDTH;
+}
+
+}  // namespace alphazero::tafl_bitboard
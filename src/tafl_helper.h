@@ -26,6 +26,7 @@ PlayHistory mirrorWidth(const PlayHistory& base) noexcept {
   // out.canonical.setZero();
   // out.pi.setZero();
   out.v = base.v;
+  out.weight = base.weight;
 
   for (int c = 0; c < channels; ++c) {
     for (int h = 0; h < height; ++h) {
@@ -66,6 +67,7 @@ PlayHistory rot90Clockwise(const PlayHistory& base) noexcept {
   // out.canonical.setZero();
   // out.pi.setZero();
   out.v = base.v;
+  out.weight = base.weight;
 
   for (int c = 0; c < channels; ++c) {
     for (int h = 0; h < height / 2; ++h) {
@@ -1,13 +1,42 @@
 #include "tawlbwrdd_gs.h"
 
+#include "bitboard.h"
 #include "tafl_helper.h"
+#include "zobrist.h"
 
 namespace alphazero::tawlbwrdd_gs {
 
+using Board = bitboard::Board<bitboard::Mask128, WIDTH, HEIGHT>;
+using bitboard::Mask128;
+using bitboard::NUM_DIRECTIONS;
+
+const auto EDGES = Board::TABLES.edges;
+
+TawlbwrddGS::TawlbwrddGS(uint16_t max_turns) : max_turns_(max_turns) {
+  // King
+  board_.king = Board::bit(5, 5);
+
+  // Defenders
+  board_.def = Board::bit(2, 5) | Board::bit(3, 5) | Board::bit(4, 5) |
+               Board::bit(5, 4) | Board::bit(5, 3) | Board::bit(5, 2) |
+               Board::bit(6, 5) | Board::bit(7, 5) | Board::bit(8, 5) |
+               Board::bit(5, 6) | Board::bit(5, 7) | Board::bit(5, 8);
+
+  // Attackers
+  board_.atk = Board::bit(0, 4) | Board::bit(0, 5) | Board::bit(0, 6) |
+               Board::bit(1, 4) | Board::bit(1, 5) | Board::bit(1, 6) |
+               Board::bit(9, 4) | Board::bit(9, 5) | Board::bit(9, 6) |
+               Board::bit(10, 4) | Board::bit(10, 5) | Board::bit(10, 6) |
+               Board::bit(4, 0) | Board::bit(5, 0) | Board::bit(6, 0) |
+               Board::bit(4, 1) | Board::bit(5, 1) | Board::bit(6, 1) |
+               Board::bit(4, 9) | Board::bit(5, 9) | Board::bit(6, 9) |
+               Board::bit(4, 10) | Board::bit(5, 10) | Board::bit(6, 10);
+
+  key_ = tafl_bitboard::position_key(board_, player_);
+}
+
 [[nodiscard]] std::unique_ptr<GameState> TawlbwrddGS::copy() const noexcept {
-  return std::make_unique<TawlbwrddGS>(board_, player_, turn_, max_turns_,
-                                       current_repetition_count_,
-                                       repetition_counts_, board_intern_);
+  return std::make_unique<TawlbwrddGS>(*this);
 }
 
 [[nodiscard]] bool TawlbwrddGS::operator==(const GameState& other) const
@@ -16,91 +45,27 @@ namespace alphazero::tawlbwrdd_gs {
   if (other_cs == nullptr) {
     return false;
   }
-  for (auto p = 0; p < 3; ++p) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        if (other_cs->board_(p, h, w) != board_(p, h, w)) {
-          return false;
-        }
-      }
-    }
-  }
-  return (other_cs->player_ == player_ &&
+  return (other_cs->key_ == key_ && other_cs->board_ == board_ &&
+          other_cs->player_ == player_ &&
           other_cs->current_repetition_count_ == current_repetition_count_);
 }
 
 void TawlbwrddGS::hash(absl::HashState h) const {
-  h = absl::HashState::combine_contiguous(std::move(h), board_.data(),
-                                          board_.size());
-  absl::HashState::combine(std::move(h), player_, current_repetition_count_);
-}
-
-uint8_t piece_to_player(const BoardTensor& bt, uint8_t target_h,
-                        uint8_t target_w) {
-  if (bt(ATK_LAYER, target_h, target_w) == 1) {
-    return ATK_PLAYER;
-  } else if (bt(KING_LAYER, target_h, target_w) == 1 ||
-             bt(DEF_LAYER, target_h, target_w) == 1) {
-    return DEF_PLAYER;
-  }
-
-  throw std::runtime_error{
-      "piece to player called on a square without pieces...rip"};
-}
-
-bool is_players_piece(const BoardTensor& bt, uint8_t player, int target_h,
-                      int target_w) {
-  return (player == DEF_PLAYER && (bt(KING_LAYER, target_h, target_w) == 1 ||
-                                   bt(DEF_LAYER, target_h, target_w) == 1)) ||
-         (player == ATK_PLAYER && bt(ATK_LAYER, target_h, target_w) == 1);
+  absl::HashState::combine(std::move(h), fingerprint());
 }
 
-bool is_opponent_piece(const BoardTensor& bt, uint8_t player, int target_h,
-                       int target_w) {
-  return (player == ATK_PLAYER && (bt(KING_LAYER, target_h, target_w) == 1 ||
-                                   bt(DEF_LAYER, target_h, target_w) == 1)) ||
-         (player == DEF_PLAYER && bt(ATK_LAYER, target_h, target_w) == 1);
-}
-
-bool is_valid_square(const BoardTensor& bt, int target_h, int target_w) {
-  // Positions off the edge of the board are never valid.
-  if (target_w < 0 || target_w >= WIDTH || target_h < 0 || target_h >= HEIGHT) {
-    return false;
-  }
-  // Otherwise is valid if it is empty.
-  return bt(0, target_h, target_w) == 0 && bt(1, target_h, target_w) == 0 &&
-         bt(2, target_h, target_w) == 0;
+[[nodiscard]] uint64_t TawlbwrddGS::fingerprint() const noexcept {
+  return key_ ^ zobrist::mix(current_repetition_count_);
 }
 
 [[nodiscard]] bool TawlbwrddGS::has_valid_moves() const noexcept {
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      if (is_players_piece(board_, player_, h, w)) {
-        {
-          auto target_w = w + 1;
-          while (is_valid_square(board_, h, target_w)) {
-            return true;
-          }
-        }
-        {
-          auto target_w = w - 1;
-          while (is_valid_square(board_, h, target_w)) {
-            return true;
-          }
-        }
-        {
-          auto target_h = h + 1;
-          while (is_valid_square(board_, target_h, w)) {
-            return true;
-          }
-        }
-        {
-          auto target_h = h - 1;
-          while (is_valid_square(board_, target_h, w)) {
-            return true;
-          }
-        }
-      }
+  const auto occupied = board_.occupied();
+  auto pieces = board_.player(player_);
+  while (pieces != 0) {
+    const auto s = bitboard::pop_lsb(pieces);
+    // Pieces only stop next to other pieces.
+    if ((Board::neighbors(Board::bit(s)) & ~occupied) != 0) {
+      return true;
     }
   }
   return false;
@@ -109,86 +74,28 @@ bool is_valid_square(const BoardTensor& bt, int target_h, int target_w) {
 [[nodiscard]] Vector<uint8_t> TawlbwrddGS::valid_moves() const noexcept {
   auto valids = Vector<uint8_t>{NUM_MOVES};
   valids.setZero();
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      if (is_players_piece(board_, player_, h, w)) {
-        {
-          auto target_w = w + 1;
-          while (is_valid_square(board_, h, target_w)) {
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + target_w + 0] = 1;
-            ++target_w;
-          }
-        }
-        {
-          auto target_w = w - 1;
-          while (is_valid_square(board_, h, target_w)) {
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + target_w + 0] = 1;
-            --target_w;
-          }
-        }
-        {
-          auto target_h = h + 1;
-          while (is_valid_square(board_, target_h, w)) {
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + WIDTH + target_h] = 1;
-            ++target_h;
-          }
-        }
-        {
-          auto target_h = h - 1;
-          while (is_valid_square(board_, target_h, w)) {
-            valids[(h * WIDTH + w) * (WIDTH + HEIGHT) + WIDTH + target_h] = 1;
-            --target_h;
-          }
-        }
+  const auto occupied = board_.occupied();
+  auto pieces = board_.player(player_);
+  while (pieces != 0) {
+    const auto s = bitboard::pop_lsb(pieces);
+    for (auto d = 0; d < NUM_DIRECTIONS; ++d) {
+      auto targets = Board::slide(s, d, occupied);
+      while (targets != 0) {
+        const auto t = bitboard::pop_lsb(targets);
+        valids[tafl_bitboard::move_index<WIDTH, HEIGHT>(s, t)] = 1;
       }
     }
   }
   return valids;
 }
 
-bool is_hostile_to(const BoardTensor& bt, uint8_t player, int target_h,
-                   int target_w) {
-  // Only opponent pieces are hostile.
-  return is_opponent_piece(bt, player, target_h, target_w);
-}
-
-bool captured(const BoardTensor& bt, int from_h, int from_w, int delta_h,
-              int delta_w) {
-  auto target_h = from_h + delta_h;
-  auto target_w = from_w + delta_w;
-  if (target_w < 0 || target_w >= WIDTH || target_h < 0 || target_h >= HEIGHT) {
-    return false;
-  }
-
-  uint8_t from_player = piece_to_player(bt, from_h, from_w);
-  // Only opponent pieces can be captured.
-  if (!is_opponent_piece(bt, from_player, target_h, target_w)) {
-    return false;
-  }
-
-  // Only captured if the final square is hostile to the target player.
-  uint8_t target_player = piece_to_player(bt, target_h, target_w);
-  auto final_h = target_h + delta_h;
-  auto final_w = target_w + delta_w;
-  if (final_w < 0 || final_w >= WIDTH || final_h < 0 || final_h >= HEIGHT) {
-    return false;
-  }
-  return is_hostile_to(bt, target_player, final_h, final_w);
-}
-
 void TawlbwrddGS::play_move(uint32_t move) {
   if (move < 0 || move >= NUM_MOVES) {
     throw std::runtime_error{"Invalid move: You have a bug in your code."};
   }
-  // Initialize board interning if it is turn is 0.
-  // We initialize it with the first move because we only want to share it
-  // within one game, not across all games.
-  if (turn_ == 0) {
-    board_intern_ =
-        std::make_shared<absl::flat_hash_set<RepetitionKeyWrapper>>();
-    auto [key, _inserted_new] = board_intern_->emplace(board_, player_);
-    const auto key_ptr = key->data;
-    repetition_counts_[key_ptr] = 1;
+  // The start position counts towards repetitions.
+  if (history_.empty()) {
+    history_.push_back(key_);
   }
 
   // Move specified piece to row/column.
@@ -208,71 +115,34 @@ void TawlbwrddGS::play_move(uint32_t move) {
   } else {
     new_w = new_loc;
   }
-  board_(0, new_h, new_w) = board_(0, piece_h, piece_w);
-  board_(1, new_h, new_w) = board_(1, piece_h, piece_w);
-  board_(2, new_h, new_w) = board_(2, piece_h, piece_w);
-
-  board_(0, piece_h, piece_w) = 0;
-  board_(1, piece_h, piece_w) = 0;
-  board_(2, piece_h, piece_w) = 0;
+  const auto to_square = new_h * WIDTH + new_w;
+  const auto from = Board::bit(piece_h, piece_w);
+  const auto to = Board::bit(to_square);
+  key_ ^= board_.key(from);
+  board_.move(from, to);
+  key_ ^= board_.key(to);
 
   // Check if it captures anything.
-  if (captured(board_, new_h, new_w, -1, 0)) {
-    board_(0, new_h - 1, new_w) = 0;
-    board_(1, new_h - 1, new_w) = 0;
-    board_(2, new_h - 1, new_w) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
-  }
-  if (captured(board_, new_h, new_w, 1, 0)) {
-    board_(0, new_h + 1, new_w) = 0;
-    board_(1, new_h + 1, new_w) = 0;
-    board_(2, new_h + 1, new_w) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
-  }
-  if (captured(board_, new_h, new_w, 0, -1)) {
-    board_(0, new_h, new_w - 1) = 0;
-    board_(1, new_h, new_w - 1) = 0;
-    board_(2, new_h, new_w - 1) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
-  }
-  if (captured(board_, new_h, new_w, 0, 1)) {
-    board_(0, new_h, new_w + 1) = 0;
-    board_(1, new_h, new_w + 1) = 0;
-    board_(2, new_h, new_w + 1) = 0;
-    // All old repetitions are invalid since we no longer have the same number
-    // of pieces.
-    repetition_counts_.clear();
+  // Only opponent pieces are hostile, and the king is captured like any
+  // other piece.
+  const auto opponent = (player_ + 1) % 2;
+  const auto captured = Board::sandwiched(
+      to_square, board_.player(opponent), board_.player(player_));
+  if (captured != 0) {
+    key_ ^= board_.key(captured);
+    board_.remove(captured);
+    // All old repetitions are invalid since we no longer have the same
+    // number of pieces.
+    history_.clear();
   }
 
   player_ = (player_ + 1) % 2;
+  key_ ^= tafl_bitboard::DEF_TO_MOVE_KEY;
   ++turn_;
 
   // Update repetitions.
-  auto [key, _inserted_new] = board_intern_->emplace(board_, player_);
-  const auto key_ptr = key->data;
-  if (!repetition_counts_.contains(key_ptr)) {
-    repetition_counts_[key_ptr] = 1;
-  } else {
-    ++repetition_counts_[key_ptr];
-  }
-  current_repetition_count_ = repetition_counts_[key_ptr];
-}
-
-[[nodiscard]] bool king_exists(const BoardTensor& bt) noexcept {
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      if (bt(KING_LAYER, h, w) == 1) {
-        return true;
-      }
-    }
-  }
-  return false;
+  history_.push_back(key_);
+  current_repetition_count_ = tafl_bitboard::repetition_count(history_);
 }
 
 [[nodiscard]] std::optional<Vector<float>> TawlbwrddGS::scores() const
@@ -296,22 +166,12 @@ void TawlbwrddGS::play_move(uint32_t move) {
     return scores;
   }
   // Check if the king is on an edge.
-  for (auto w = 0; w < WIDTH; ++w) {
-    if (board_(KING_LAYER, 0, w) == 1 ||
-        board_(KING_LAYER, HEIGHT - 1, w) == 1) {
-      scores(1) = 1;
-      return scores;
-    }
-  }
-  for (auto h = 0; h < HEIGHT; ++h) {
-    if (board_(KING_LAYER, h, 0) == 1 ||
-        board_(KING_LAYER, h, WIDTH - 1) == 1) {
-      scores(1) = 1;
-      return scores;
-    }
+  if ((board_.king & EDGES) != 0) {
+    scores(1) = 1;
+    return scores;
   }
   // Check if the king still exists.
-  if (!king_exists(board_)) {
+  if (board_.king == 0) {
     scores(0) = 1;
     return scores;
   }
@@ -329,59 +189,37 @@ void TawlbwrddGS::play_move(uint32_t move) {
   return std::nullopt;
 }
 
-[[nodiscard]] Tensor<float, 3> TawlbwrddGS::canonicalized() const noexcept {
-  auto out = CanonicalTensor{};
+void TawlbwrddGS::canonicalize_into(float* data) const noexcept {
+  auto out = sized_tensor_map<CanonicalTensor>(data);
+  out.setZero();
 
   // Board planes.
+  const auto layers = std::array<Mask128, 3>{board_.king, board_.def,
+                                             board_.atk};
   for (auto p = 0; p < 3; ++p) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(p, h, w) = board_(p, h, w);
-      }
+    auto pieces = layers[p];
+    while (pieces != 0) {
+      const auto s = bitboard::pop_lsb(pieces);
+      out(p, s / WIDTH, s % WIDTH) = 1;
     }
   }
 
   // Current player planes.
-  auto p = player_ + 3;
-  auto op = (player_ + 1) % 2 + 3;
-  for (auto h = 0; h < HEIGHT; ++h) {
-    for (auto w = 0; w < WIDTH; ++w) {
-      out(p, h, w) = 1;
-      out(op, h, w) = 0;
-    }
-  }
+  out.chip(player_ + 3, 0).setConstant(1);
 
   // Repetition count.
-  if (current_repetition_count_ == 0) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 0;
-        out(6, h, w) = 0;
-      }
-    }
-  } else if (current_repetition_count_ == 1) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 1;
-        out(6, h, w) = 0;
-      }
-    }
-  } else if (current_repetition_count_ == 2) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 0;
-        out(6, h, w) = 1;
-      }
-    }
-  } else if (current_repetition_count_ > 2) {
-    for (auto h = 0; h < HEIGHT; ++h) {
-      for (auto w = 0; w < WIDTH; ++w) {
-        out(5, h, w) = 1;
-        out(6, h, w) = 1;
-      }
-    }
+  if (current_repetition_count_ == 1 || current_repetition_count_ > 2) {
+    out.chip(5, 0).setConstant(1);
   }
+  if (current_repetition_count_ >= 2) {
+    out.chip(6, 0).setConstant(1);
+  }
+}
 
+[[nodiscard]] Tensor<float, 3> TawlbwrddGS::canonicalized() const noexcept {
+  auto out = Tensor<float, 3>{CANONICAL_SHAPE[0], CANONICAL_SHAPE[1],
+                              CANONICAL_SHAPE[2]};
+  canonicalize_into(out.data());
   return out;
 }
 
@@ -399,11 +237,12 @@ void TawlbwrddGS::play_move(uint32_t move) {
       '\n';
   for (auto h = 0; h < HEIGHT; ++h) {
     for (auto w = 0; w < WIDTH; ++w) {
-      if (board_(0, h, w) == 1) {
+      const auto square = Board::bit(h, w);
+      if ((board_.king & square) != 0) {
         out += '@';
-      } else if (board_(1, h, w) == 1) {
+      } else if ((board_.def & square) != 0) {
         out += 'O';
-      } else if (board_(2, h, w) == 1) {
+      } else if ((board_.atk & square) != 0) {
         out += 'X';
       } else {
         out += '.';
@@ -415,9 +254,6 @@ void TawlbwrddGS::play_move(uint32_t move) {
   return out;
 }
 
-void TawlbwrddGS::minimize_storage() {
-  repetition_counts_ = {};
-  board_intern_ = nullptr;
-}
+void TawlbwrddGS::minimize_storage() { history_ = {}; }
 
-}  // namespace alphazero::tawlbwrdd_gs
\ No newline at end of file
+}  // namespace alphazero::tawlbwrdd_gs
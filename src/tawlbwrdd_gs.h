@@ -1,9 +1,10 @@
 #pragma once
 
-#include "absl/container/flat_hash_map.h"
-#include "absl/container/flat_hash_set.h"
+#include <vector>
+
 #include "dll_export.h"
 #include "game_state.h"
+#include "tafl_bitboard.h"
 
 // Base rules from http://www.cyningstan.com/game/175/tawlbwrdd
 // In addition, 3 fold repetitions lead to a loss for the player who forced the
@@ -38,124 +39,32 @@ constexpr const std::array<int, 3> BOARD_SHAPE = {3, HEIGHT, WIDTH};
 // May want to add some historical positions.
 constexpr const std::array<int, 3> CANONICAL_SHAPE = {7, HEIGHT, WIDTH};
 
-using BoardTensor =
-    SizedTensor<int8_t,
-                Eigen::Sizes<BOARD_SHAPE[0], BOARD_SHAPE[1], BOARD_SHAPE[2]>>;
-
 using CanonicalTensor =
     SizedTensor<float, Eigen::Sizes<CANONICAL_SHAPE[0], CANONICAL_SHAPE[1],
                                     CANONICAL_SHAPE[2]>>;
 
-struct RepetitionKey {
-  BoardTensor t;
-  uint8_t p;
-
-  RepetitionKey(BoardTensor tensor, uint8_t player) : t(tensor), p(player) {}
-};
-struct RepetitionKeyWrapper {
-  RepetitionKeyWrapper(const BoardTensor& tensor, uint8_t player) {
-    data = std::make_shared<RepetitionKey>(tensor, player);
-  }
-  RepetitionKeyWrapper(const RepetitionKeyWrapper& rkw) { data = rkw.data; }
-  std::shared_ptr<RepetitionKey> data;
-};
-template <typename H>
-H AbslHashValue(H h, const RepetitionKeyWrapper& rkw) {
-  h = H::combine_contiguous(std::move(h), rkw.data->t.data(),
-                            rkw.data->t.size());
-  return H::combine(std::move(h), rkw.data->p);
-}
-bool operator==(const RepetitionKeyWrapper& lhs,
-                const RepetitionKeyWrapper& rhs) {
-  for (auto i = 0; i < BOARD_SHAPE[0]; ++i) {
-    for (auto j = 0; j < BOARD_SHAPE[1]; ++j) {
-      for (auto k = 0; k < BOARD_SHAPE[2]; ++k) {
-        if (lhs.data->t(i, j, k) != rhs.data->t(i, j, k)) {
-          return false;
-        }
-      }
-    }
-  }
-  return rhs.data->p == lhs.data->p;
-}
+// One bit per square, indexed by h * WIDTH + w.
+using Bitboards = tafl_bitboard::Pieces<bitboard::Mask128>;
 
 class DLLEXPORT TawlbwrddGS : public GameState {
  public:
-  TawlbwrddGS(uint16_t max_turns = DEFAULT_MAX_TURNS) : max_turns_(max_turns) {
-    board_.setZero();
-    // King
-    board_(KING_LAYER, 5, 5) = 1;
-
-    // Defenders
-    board_(DEF_LAYER, 2, 5) = 1;
-    board_(DEF_LAYER, 3, 5) = 1;
-    board_(DEF_LAYER, 4, 5) = 1;
-    board_(DEF_LAYER, 5, 4) = 1;
-    board_(DEF_LAYER, 5, 3) = 1;
-    board_(DEF_LAYER, 5, 2) = 1;
-    board_(DEF_LAYER, 6, 5) = 1;
-    board_(DEF_LAYER, 7, 5) = 1;
-    board_(DEF_LAYER, 8, 5) = 1;
-    board_(DEF_LAYER, 5, 6) = 1;
-    board_(DEF_LAYER, 5, 7) = 1;
-    board_(DEF_LAYER, 5, 8) = 1;
-
-    // Attackers
-    board_(ATK_LAYER, 0, 4) = 1;
-    board_(ATK_LAYER, 0, 5) = 1;
-    board_(ATK_LAYER, 0, 6) = 1;
-    board_(ATK_LAYER, 1, 4) = 1;
-    board_(ATK_LAYER, 1, 5) = 1;
-    board_(ATK_LAYER, 1, 6) = 1;
-    board_(ATK_LAYER, 9, 4) = 1;
-    board_(ATK_LAYER, 9, 5) = 1;
-    board_(ATK_LAYER, 9, 6) = 1;
-    board_(ATK_LAYER, 10, 4) = 1;
-    board_(ATK_LAYER, 10, 5) = 1;
-    board_(ATK_LAYER, 10, 6) = 1;
-    board_(ATK_LAYER, 4, 0) = 1;
-    board_(ATK_LAYER, 5, 0) = 1;
-    board_(ATK_LAYER, 6, 0) = 1;
-    board_(ATK_LAYER, 4, 1) = 1;
-    board_(ATK_LAYER, 5, 1) = 1;
-    board_(ATK_LAYER, 6, 1) = 1;
-    board_(ATK_LAYER, 4, 9) = 1;
-    board_(ATK_LAYER, 5, 9) = 1;
-    board_(ATK_LAYER, 6, 9) = 1;
-    board_(ATK_LAYER, 4, 10) = 1;
-    board_(ATK_LAYER, 5, 10) = 1;
-    board_(ATK_LAYER, 6, 10) = 1;
-  }
-  TawlbwrddGS(
-      BoardTensor board, int8_t player, uint16_t turn, uint16_t max_turns,
-      uint8_t current_repetition_count,
-      absl::flat_hash_map<const std::shared_ptr<RepetitionKey>, uint8_t>
-          repetition_counts,
-      std::shared_ptr<absl::flat_hash_set<RepetitionKeyWrapper>> board_intern)
+  TawlbwrddGS(uint16_t max_turns = DEFAULT_MAX_TURNS);
+  TawlbwrddGS(Bitboards board, int8_t player, uint16_t turn, uint16_t max_turns,
+              uint8_t current_repetition_count,
+              std::vector<uint64_t> history)
       : board_(board),
         turn_(turn),
         max_turns_(max_turns),
         player_(player),
         current_repetition_count_(current_repetition_count),
-        repetition_counts_(std::move(repetition_counts)),
-        board_intern_(std::move(board_intern)) {
-    // Prune old unused keys from global intern pool.
-    if (board_intern_) {
-      for (auto it = board_intern_->begin(), end = board_intern_->end();
-           it != end;) {
-        // `erase()` will invalidate `it`, so advance `it` first.
-        auto copy_it = it++;
-        if (copy_it->data.use_count() == 1) {
-          board_intern_->erase(copy_it);
-        }
-      }
-    }
-  }
+        history_(std::move(history)),
+        key_(tafl_bitboard::position_key(board, player)) {}
 
   [[nodiscard]] std::unique_ptr<GameState> copy() const noexcept override;
   [[nodiscard]] bool operator==(const GameState& other) const noexcept override;
 
   void hash(absl::HashState h) const override;
+  [[nodiscard]] uint64_t fingerprint() const noexcept override;
 
   // Returns the current player. Players must be 0 indexed.
   [[nodiscard]] uint8_t current_player() const noexcept override {
@@ -192,6 +101,10 @@ class DLLEXPORT TawlbwrddGS : public GameState {
 
   // Returns the canonicalized form of the board, ready for feeding to a NN.
   [[nodiscard]] Tensor<float, 3> canonicalized() const noexcept override;
+  [[nodiscard]] std::array<int, 3> canonical_shape() const noexcept override {
+    return CANONICAL_SHAPE;
+  }
+  void canonicalize_into(float* data) const noexcept override;
 
   // Returns the number of symmetries the game has.
   [[nodiscard]] uint8_t num_symmetries() const noexcept override {
@@ -210,25 +123,15 @@ class DLLEXPORT TawlbwrddGS : public GameState {
   void minimize_storage() override;
 
  private:
-  // Board contains a layer for the king, other white pieces, and black pieces.
-  // A 0 means no piece, a 1 means a piece of the respective type.
-  BoardTensor board_{};
+  Bitboards board_{};
   uint16_t turn_{0};
   uint16_t max_turns_{DEFAULT_MAX_TURNS};
   int8_t player_{0};
   uint8_t current_repetition_count_{1};
-  // TODO: maybe look into making this a sorted vector/flat_map.
-  // It should be small enough that it would be faster than hashing.
-  absl::flat_hash_map<const std::shared_ptr<RepetitionKey>, uint8_t>
-      repetition_counts_{};
-  // This is used to avoid constantly copying board tensors.
-  // Instead a shared pointer to this set is copied.
-  // It has pointer stability, so we can use pointers to it's elements as if
-  // they were a copy of the element.
-  std::shared_ptr<absl::flat_hash_set<RepetitionKeyWrapper>> board_intern_ =
-      nullptr;
-
-  // Repetition count for each board position.
+  // Keys of the positions since the last capture, oldest first.
+  std::vector<uint64_t> history_{};
+  // Zobrist key of the board and player, updated by play_move.
+  uint64_t key_{0};
 };
 
 }  // namespace alphazero::tawlbwrdd_gs
\ No newline at end of file
@@ -1,6 +1,7 @@
 
 #include "tawlbwrdd_gs.h"
 
+#include "game_state_digest.h"
 #include "gtest/gtest.h"
 
 namespace alphazero::tawlbwrdd_gs {
@@ -54,5 +55,20 @@ TEST(TawlbwrddGS, RepetitionCount) {
   EXPECT_EQ(s, expected);
 }
 
+// Golden values were recorded from the tensor based implementation that the
+// bitboards replaced.
+// NOLINTNEXTLINE
+TEST(TawlbwrddGS, Perft) {
+  const auto gs = TawlbwrddGS{};
+  EXPECT_EQ(perft(gs, 1), 88);
+  EXPECT_EQ(perft(gs, 2), 8984);
+  EXPECT_EQ(perft(gs, 3), 835776);
+}
+
+// NOLINTNEXTLINE
+TEST(TawlbwrddGS, PlayoutDigest) {
+  EXPECT_EQ(playout_digest(TawlbwrddGS{}, 100, 7), 0x5bfd0fdda4dcf39);
+}
+
 }  // namespace
 }  // namespace alphazero::tawlbwrdd_gs
\ No newline at end of file
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/node_hash_set.h"
+
+namespace alphazero {
+
+// An opt in timeline of what every thread was doing.
+// Each thread records spans into its own fixed size ring buffer, so recording
+// never locks and only the newest events are kept. The timeline is dumped as
+// Chrome trace event JSON, which can be viewed in Perfetto or chrome://tracing.
+// When disabled, threads get no buffer and spans are a single branch.
+
+struct TraceEvent {
+  // Must outlive the tracer. Either a literal or interned by the tracer.
+  const char* name;
+  int64_t start;
+  int64_t duration;
+};
+
+class ThreadTrace {
+ public:
+  ThreadTrace(std::string name, size_t capacity)
+      : name_(std::move(name)), events_(capacity) {}
+
+  // Only the owning thread may record.
+  void record(const char* name, int64_t start, int64_t end) noexcept {
+    const auto head = head_.load(std::memory_order_relaxed);
+    events_[head % events_.size()] = TraceEvent{name, start, end - start};
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  // Returns the recorded events from oldest to newest.
+  // Should be called after the owning thread stops recording.
+  [[nodiscard]] std::vector<TraceEvent> events() const {
+    const auto head = head_.load(std::memory_order_acquire);
+    const auto count = std::min<uint64_t>(head, events_.size());
+    auto out = std::vector<TraceEvent>{};
+    out.reserve(count);
+    for (auto i = head - count; i < head; ++i) {
+      out.push_back(events_[i % events_.size()]);
+    }
+    return out;
+  }
+
+  [[nodiscard]] const std::string& name() const noexcept { return name_; }
+
+ private:
+  const std::string name_;
+  std::vector<TraceEvent> events_;
+  std::atomic<uint64_t> head_ = 0;
+};
+
+class Tracer {
+ public:
+  // Keeps up to capacity events per thread. 0 disables tracing.
+  explicit Tracer(size_t capacity)
+      : capacity_(capacity), start_(std::chrono::steady_clock::now()) {}
+
+  [[nodiscard]] bool enabled() const noexcept { return capacity_ > 0; }
+
+  // Nanoseconds since the tracer was created.
+  [[nodiscard]] int64_t now() const noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start_)
+        .count();
+  }
+
+  // Returns the trace of the calling thread or nullptr if tracing is disabled.
+  // The name of a thread is set by its first call.
+  // Threads should look this up once and keep the pointer.
+  [[nodiscard]] ThreadTrace* local(const char* thread_name) {
+    if (!enabled()) {
+      return nullptr;
+    }
+    std::unique_lock l{m_};
+    auto& tt = threads_[std::this_thread::get_id()];
+    if (tt == nullptr) {
+      tt = std::make_unique<ThreadTrace>(thread_name, capacity_);
+      order_.push_back(tt.get());
+    }
+    return tt.get();
+  }
+
+  // Returns a stable copy of a runtime name so it can be used for events.
+  [[nodiscard]] const char* intern(const std::string& name) {
+    std::unique_lock l{m_};
+    return names_.insert(name).first->c_str();
+  }
+
+  // Writes all events as Chrome trace event JSON.
+  void dump_json(const std::string& path) const {
+    auto* f = std::fopen(path.c_str(), "w");
+    if (f == nullptr) {
+      throw std::runtime_error{"Failed to create " + path};
+    }
+    std::unique_lock l{m_};
+    std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    auto first = true;
+    for (size_t tid = 0; tid < order_.size(); ++tid) {
+      const auto* tt = order_[tid];
+      std::fprintf(f,
+                   "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,"
+                   "\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                   first ? "" : ",\n", tid, json_escape(tt->name()).c_str());
+      first = false;
+      for (const auto& e : tt->events()) {
+        // Chrome traces use microseconds.
+        std::fprintf(f,
+                     ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":0,\"tid\":%zu,"
+                     "\"ts\":%.3f,\"dur\":%.3f}",
+                     json_escape(e.name).c_str(), tid, e.start / 1000.0,
+                     e.duration / 1000.0);
+      }
+    }
+    std::fprintf(f, "\n]}\n");
+    if (std::fclose(f) != 0) {
+      throw std::runtime_error{"Failed to write " + path};
+    }
+  }
+
+ private:
+  // Names are arbitrary text, so quotes, backslashes and control characters
+  // must be escaped to keep the JSON valid.
+  [[nodiscard]] static std::string json_escape(std::string_view s) {
+    auto out = std::string{};
+    out.reserve(s.size());
+    for (const auto c : s) {
+      if (c == '"' || c == '\\') {
+        out += '\\';
+        out += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char code[8];
+        std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(c));
+        out += code;
+      } else {
+        out += c;
+      }
+    }
+    return out;
+  }
+
+  const size_t capacity_;
+  const std::chrono::steady_clock::time_point start_;
+  mutable std::mutex m_;
+  absl::flat_hash_map<std::thread::id, std::unique_ptr<ThreadTrace>> threads_;
+  // Threads in the order they started tracing. Used as trace thread ids.
+  std::vector<const ThreadTrace*> order_;
+  absl::node_hash_set<std::string> names_;
+};
+
+// Records a span from construction to destruction.
+// Does nothing if the thread trace is nullptr.
+class TraceSpan {
+ public:
+  TraceSpan(const Tracer& tracer, ThreadTrace* trace, const char* name) noexcept
+      : tracer_(tracer),
+        trace_(trace),
+        name_(name),
+        start_(trace != nullptr ? tracer.now() : 0) {}
+  ~TraceSpan() {
+    if (trace_ != nullptr) {
+      trace_->record(name_, start_, tracer_.now());
+    }
+  }
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+  const Tracer& tracer_;
+  ThreadTrace* trace_;
+  const char* name_;
+  const int64_t start_;
+};
+
+}  // namespace alphazero
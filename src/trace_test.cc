@@ -0,0 +1,91 @@
+#include "trace.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+namespace alphazero {
+namespace {
+
+// NOLINTNEXTLINE
+TEST(Trace, DisabledRecordsNothing) {
+  auto tracer = Tracer{0};
+  EXPECT_FALSE(tracer.enabled());
+  EXPECT_EQ(tracer.local("main"), nullptr);
+  { TraceSpan span{tracer, tracer.local("main"), "nothing"}; }
+}
+
+// NOLINTNEXTLINE
+TEST(Trace, RingKeepsNewest) {
+  auto tracer = Tracer{4};
+  auto* trace = tracer.local("main");
+  ASSERT_NE(trace, nullptr);
+  EXPECT_EQ(tracer.local("other name"), trace);
+  EXPECT_EQ(trace->name(), "main");
+  for (auto i = 0; i < 10; ++i) {
+    trace->record("event", i, i + 1);
+  }
+  const auto events = trace->events();
+  ASSERT_EQ(events.size(), 4);
+  for (auto i = 0; i < 4; ++i) {
+    EXPECT_EQ(events[i].start, 6 + i);
+    EXPECT_EQ(events[i].duration, 1);
+  }
+}
+
+// NOLINTNEXTLINE
+TEST(Trace, DumpsChromeJson) {
+  auto tracer = Tracer{16};
+  {
+    TraceSpan span{tracer, tracer.local("main"), "outer"};
+    auto worker = std::thread{[&] {
+      auto* trace = tracer.local("worker");
+      trace->record(tracer.intern("inner"), 1000, 3500);
+    }};
+    worker.join();
+  }
+  const auto path =
+      (std::filesystem::temp_directory_path() / "alphazero_trace_test.json")
+          .string();
+  tracer.dump_json(path);
+  auto in = std::ifstream{path};
+  auto ss = std::stringstream{};
+  ss << in.rdbuf();
+  const auto json = ss.str();
+  std::filesystem::remove(path);
+
+  EXPECT_EQ(json.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0), 0);
+  EXPECT_NE(json.find("\"args\":{\"name\":\"main\"}"), std::string::npos);
+  EXPECT_NE(json.find("\"args\":{\"name\":\"worker\"}"), std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"outer\",\"pid\":0,\"tid\":0"),
+            std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"inner\",\"pid\":0,\"tid\":1,\"ts\":1.000,"
+                      "\"dur\":2.500}"),
+            std::string::npos);
+}
+
+// NOLINTNEXTLINE
+TEST(Trace, EscapesJsonNames) {
+  auto tracer = Tracer{4};
+  auto* trace = tracer.local("say \"hi\"");
+  trace->record(tracer.intern("C:\\tmp\n\x01"), 0, 1000);
+  const auto path =
+      (std::filesystem::temp_directory_path() / "alphazero_trace_escape.json")
+          .string();
+  tracer.dump_json(path);
+  auto in = std::ifstream{path};
+  auto ss = std::stringstream{};
+  ss << in.rdbuf();
+  const auto json = ss.str();
+  std::filesystem::remove(path);
+
+  EXPECT_NE(json.find("\"args\":{\"name\":\"say \\\"hi\\\"\"}"),
+            std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"C:\\\\tmp\\u000a\\u0001\","),
+            std::string::npos);
+}
+
+}  // namespace
+}  // namespace alphazero
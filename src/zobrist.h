@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Zobrist hashing.
+// A position's key is the xor of a random key for every feature it has, like
+// a piece on a square. Playing a move then updates the key by xoring out what
+// it removed and xoring in what it added, instead of rehashing the board.
+
+namespace alphazero::zobrist {
+
+// The splitmix64 finalizer. Distinct inputs give well mixed, distinct keys.
+[[nodiscard]] constexpr uint64_t mix(uint64_t x) noexcept {
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+// N keys for one game. Each game should use a different salt so games never
+// share keys.
+template <size_t N>
+[[nodiscard]] constexpr std::array<uint64_t, N> make_keys(
+    uint64_t salt) noexcept {
+  auto out = std::array<uint64_t, N>{};
+  for (auto i = 0UL; i < N; ++i) {
+    out[i] = mix((salt << 32) + i);
+  }
+  return out;
+}
+
+}  // namespace alphazero::zobrist